@@ -2,8 +2,6 @@
 #define BRUSH_H
 
 #include <QColor>
-#include <QPainter>
-#include <QPointF>
 
 class Brush {
 public:
@@ -21,20 +19,22 @@ public:
   void setHardness(int hardness);
   int hardness() const { return m_hardness; }
 
+  // Distance between dabs in percent of the dab diameter
+  void setSpacing(int spacing);
+  int spacing() const { return m_spacing; }
+
   void setTolerance(int tolerance);
   int tolerance() const { return m_tolerance; }
 
   void setEraser(bool eraser);
   bool isEraser() const { return m_isEraser; }
 
-  void paint(QPainter &painter, const QPointF &start, const QPointF &end,
-             double pressure);
-
 private:
   int m_size;
   QColor m_color;
   int m_opacity;   // 0-100
   int m_hardness;  // 0-100
+  int m_spacing;   // 1-200
   int m_tolerance; // 0-255 for flood fill
   bool m_isEraser;
 };
@@ -1,22 +1,85 @@
 #include "canvas.h"
+#include "core/floodfill.h"
+#include "rendering/glcanvasview.h"
 
+#include <QElapsedTimer>
 #include <QMouseEvent>
+#include <QPaintEvent>
 #include <QPainter>
+#include <QPainterPath>
+#include <QReadLocker>
 #include <QResizeEvent>
-#include <QSet>
-#include <QStack>
 #include <QTabletEvent>
+#include <QThreadPool>
+#include <QWheelEvent>
+#include <QWriteLocker>
+#include <QtMath>
+
+static const double MinZoom = 0.01;
+static const double MaxZoom = 32.0;
+static const double ZoomStep = 1.25;
+// Time a frame spends re-blending before the rest waits for the next one
+static const int FrameBudget = 30; // ms
+
+// Dash pattern of the selection outline, widget pixels
+static const int AntsDash = 4;
+static const int AntsInterval = 100; // ms per one pixel step
+
+// Ring around the pointer showing the colour under it while the
+// eyedropper is dragged, widget pixels
+static const int SampleRingInner = 16;
+static const int SampleRingOuter = 30;
+
+// Shift adds to the selection, Alt subtracts, both intersect
+static SelectionMask::Operation
+selectionOperation(Qt::KeyboardModifiers modifiers) {
+  bool add = modifiers & Qt::ShiftModifier;
+  bool subtract = modifiers & Qt::AltModifier;
+  if (add && subtract)
+    return SelectionMask::Intersect;
+  if (add)
+    return SelectionMask::Add;
+  return subtract ? SelectionMask::Subtract : SelectionMask::Replace;
+}
 
 Canvas::Canvas(QWidget *parent)
-    : QWidget(parent), m_drawing(false), m_currentTool(BrushTool),
-      m_selectionActive(false) {
+    : QWidget(parent), m_zoom(1.0), m_panning(false), m_drawing(false),
+      m_currentTool(BrushTool), m_selectionActive(false),
+      m_selectionOperation(SelectionMask::Replace), m_antsOffset(0),
+      m_sampleRadius(0), m_sampling(false), m_predictionWidth(1.0),
+      m_glView(nullptr),
+      m_strokeWorker(&m_layerManager) {
   setAttribute(Qt::WA_StaticContents);
 
   // Enable mouse tracking so we get move events even without buttons pressed
   setMouseTracking(true);
 
   connect(&m_layerManager, &LayerManager::canvasUpdateNeeded, this,
-          QOverload<>::of(&Canvas::update));
+          &Canvas::invalidateComposite);
+  connect(&m_layerManager, &LayerManager::regionChanged, this,
+          &Canvas::markDirty);
+  connect(&m_strokeWorker, &StrokeWorker::regionPainted, this,
+          [this](const QString &layerId, const QRect &rect) {
+            m_layerManager.invalidateRegion(rect,
+                                            m_layerManager.layerById(layerId));
+          });
+  m_strokeWorker.start();
+
+  // Present through OpenGL unless disabled or unavailable; the raster
+  // path in paintEvent() remains the fallback
+  if (qgetenv("ARIA_CANVAS_BACKEND") != "raster" &&
+      GLCanvasView::isSupported()) {
+    m_glView = new GLCanvasView(this);
+    m_glView->setGeometry(rect());
+  }
+
+  m_predictionTimer.setSingleShot(true);
+  m_predictionTimer.setInterval(50);
+  connect(&m_predictionTimer, &QTimer::timeout, this,
+          &Canvas::clearPrediction);
+
+  m_antsTimer.setInterval(AntsInterval);
+  connect(&m_antsTimer, &QTimer::timeout, this, &Canvas::advanceAnts);
 
   // Initialize with a default white canvas
   newImage(800, 600, Qt::white);
@@ -27,6 +90,9 @@ Canvas::~Canvas() {}
 void Canvas::newImage(int width, int height, const QColor &backgroundColor) {
   m_image = QImage(width, height, QImage::Format_ARGB32_Premultiplied);
   m_image.fill(backgroundColor);
+  m_pyramid.reset(m_image.size());
+  m_selection.reset(m_image.size());
+  selectionChanged();
 
   // Clear existing layers
   while (m_layerManager.layerCount() > 0) {
@@ -37,32 +103,212 @@ void Canvas::newImage(int width, int height, const QColor &backgroundColor) {
   m_layerManager.addLayer("Background", width, height);
   Layer *bgLayer = m_layerManager.layerAt(0);
   if (bgLayer) {
-    bgLayer->image().fill(backgroundColor);
+    QWriteLocker locker(m_layerManager.documentLock());
+    bgLayer->tiles().fill(backgroundColor);
   }
 
-  update();
+  // A new document starts with an empty history
+  m_layerManager.history()->clear();
+
+  invalidateComposite();
+}
+
+void Canvas::setDocument(const QSize &size,
+                         std::vector<std::unique_ptr<Layer>> layers,
+                         int currentLayer) {
+  m_image = QImage(size, QImage::Format_ARGB32_Premultiplied);
+  m_image.fill(Qt::white);
+  m_pyramid.reset(m_image.size());
+  m_selection.reset(m_image.size());
+  selectionChanged();
+
+  while (m_layerManager.layerCount() > 0)
+    m_layerManager.takeLayer(0);
+  for (auto &layer : layers)
+    m_layerManager.insertLayer(m_layerManager.layerCount(), std::move(layer));
+  m_layerManager.setCurrentLayer(currentLayer);
+
+  m_layerManager.history()->clear();
+  invalidateComposite();
+}
+
+void Canvas::setZoom(double zoom) { zoomAt(zoom, rect().center()); }
+
+void Canvas::zoomIn() { setZoom(m_zoom * ZoomStep); }
+
+void Canvas::zoomOut() { setZoom(m_zoom / ZoomStep); }
+
+void Canvas::fitToScreen() {
+  if (m_image.isNull() || width() <= 0 || height() <= 0)
+    return;
+
+  m_zoom = qBound(MinZoom,
+                  qMin(double(width()) / m_image.width(),
+                       double(height()) / m_image.height()),
+                  MaxZoom);
+  m_pan = QPointF();
+  updateView();
+}
+
+void Canvas::zoomAt(double zoom, const QPointF &anchor) {
+  zoom = qBound(MinZoom, zoom, MaxZoom);
+  if (qFuzzyCompare(zoom, m_zoom))
+    return;
+
+  // Keep the image point under anchor in place
+  QPointF imagePoint = mapToImage(anchor);
+  m_zoom = zoom;
+  m_pan += anchor - viewTransform().map(imagePoint);
+  updateView();
+}
+
+QTransform Canvas::viewTransform() const {
+  // Image centred in the widget, shifted by the pan; the origin is kept on
+  // whole pixels so 1:1 views are not resampled
+  QPointF origin((width() - m_image.width() * m_zoom) / 2 + m_pan.x(),
+                 (height() - m_image.height() * m_zoom) / 2 + m_pan.y());
+  QTransform transform;
+  transform.translate(qRound(origin.x()), qRound(origin.y()));
+  transform.scale(m_zoom, m_zoom);
+  return transform;
+}
+
+QPointF Canvas::mapToImage(const QPointF &point) const {
+  return viewTransform().inverted().map(point);
+}
+
+QRect Canvas::mapFromImage(const QRectF &rect) const {
+  return viewTransform().mapRect(rect).toAlignedRect().adjusted(-1, -1, 1, 1);
+}
+
+void Canvas::invalidateComposite() {
+  m_layerManager.invalidateCaches();
+  m_dirtyRect = m_image.rect();
+  updateView();
+}
+
+void Canvas::markDirty(const QRect &rect) {
+  QRect clipped = rect.intersected(m_image.rect());
+  if (clipped.isEmpty())
+    return;
+
+  m_dirtyRect |= clipped;
+  updateView(mapFromImage(clipped));
+}
+
+void Canvas::updateView(const QRect &rect) {
+  // The OpenGL view covers the whole widget and redraws it in one go
+  if (m_glView)
+    m_glView->update();
+  else if (rect.isNull())
+    update();
+  else
+    update(rect);
+}
+
+void Canvas::prepareFrame() {
+  // Re-blend only the part of the cache that changed since the last frame
+  // While the stroke worker is stamping dabs the previous frame is shown
+  // and the dirty area is kept for the next one
+  if (m_dirtyRect.isEmpty())
+    return;
+
+  QReadWriteLock *lock = m_layerManager.documentLock();
+  if (!lock->tryLockForRead()) {
+    updateView();
+    return;
+  }
+
+  // Large areas (a document just opened, a layer toggled on a huge
+  // canvas) are blended a few tile rows at a time from the top and shown
+  // as they complete, instead of in one long frame. Each step is still
+  // wide enough to keep every thread busy.
+  QElapsedTimer timer;
+  timer.start();
+  int size = TiledImage::TileSize;
+  int columns = m_dirtyRect.right() / size - m_dirtyRect.left() / size + 1;
+  int threads = QThreadPool::globalInstance()->maxThreadCount();
+  int rows = qMax(1, (threads * 2 + columns - 1) / columns);
+  while (!m_dirtyRect.isEmpty()) {
+    int bottom = qMin(m_dirtyRect.bottom(),
+                      (m_dirtyRect.top() / size + rows) * size - 1);
+    QRect part(QPoint(m_dirtyRect.left(), m_dirtyRect.top()),
+               QPoint(m_dirtyRect.right(), bottom));
+    m_layerManager.render(m_image, part);
+    m_pyramid.invalidate(part);
+    if (m_glView)
+      m_glView->invalidate(part);
+    m_dirtyRect.setTop(bottom + 1);
+
+    if (timer.elapsed() >= FrameBudget)
+      break;
+  }
+  lock->unlock();
+
+  if (m_dirtyRect.isEmpty())
+    m_dirtyRect = QRect();
+  else
+    updateView();
 }
 
 void Canvas::paintEvent(QPaintEvent *event) {
-  QPainter painter(this);
+  // The OpenGL view covers the widget and draws the whole frame itself
+  if (m_glView) {
+    m_glView->update();
+    return;
+  }
 
-  // Always composite the layers to show latest changes
-  QImage composited =
-      m_layerManager.composite(m_image.width(), m_image.height());
+  prepareFrame();
 
-  // Center the image in the widget
-  int xOffset = (width() - composited.width()) / 2;
-  int yOffset = (height() - composited.height()) / 2;
+  QPainter painter(this);
+  QTransform view = viewTransform();
 
   // Fill background
-  painter.fillRect(rect(), Qt::darkGray);
+  painter.fillRect(event->rect(), Qt::darkGray);
+
+  // Draw only the exposed part of the composited image. Zoomed out, it
+  // comes from the pyramid level closest to the zoom, so at most a 2x
+  // reduction is left to the painter.
+  QRect exposed = view.inverted()
+                      .mapRect(QRectF(event->rect()))
+                      .toAlignedRect()
+                      .intersected(m_image.rect());
+  if (!exposed.isEmpty()) {
+    int level = m_pyramid.levelForScale(m_zoom);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform, m_zoom < 1.0);
+    if (level == 0) {
+      painter.drawImage(view.mapRect(QRectF(exposed)), m_image, exposed);
+    } else {
+      int factor = 1 << level;
+      QRect source(QPoint(exposed.left() / factor, exposed.top() / factor),
+                   QPoint(exposed.right() / factor, exposed.bottom() / factor));
+      const QImage &image = m_pyramid.level(level, m_image, source);
+      QRectF target(source.left() * factor, source.top() * factor,
+                    source.width() * factor, source.height() * factor);
+      painter.drawImage(view.mapRect(target), image, source);
+    }
+    painter.setRenderHint(QPainter::SmoothPixmapTransform, false);
+  }
+
+  paintOverlays(painter, view);
+}
 
-  // Draw the composited image
-  painter.drawImage(xOffset, yOffset, composited);
+void Canvas::paintOverlays(QPainter &painter, const QTransform &view) {
+  // Predicted continuation of the stroke; replaced as real samples arrive
+  if (!m_prediction.isNull()) {
+    QColor color = m_brush.color();
+    color.setAlphaF(color.alphaF() * m_brush.opacity() / 100.0);
+    painter.save();
+    painter.setTransform(view);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setPen(QPen(color, m_predictionWidth, Qt::SolidLine, Qt::RoundCap));
+    painter.drawLine(m_prediction);
+    painter.restore();
+  }
 
   // Draw selection preview during drag
   if (m_selectionActive && !m_selectionRect.isNull()) {
-    QRect adjustedRect = m_selectionRect.translated(xOffset, yOffset);
+    QRectF adjustedRect = view.mapRect(QRectF(m_selectionRect));
     // High-contrast dual outline (black then white)
     painter.setPen(QPen(Qt::black, 2, Qt::SolidLine));
     painter.setBrush(Qt::NoBrush);
@@ -82,51 +328,129 @@ void Canvas::paintEvent(QPaintEvent *event) {
   // Draw lasso path preview during drag
   if (m_currentTool == LassoTool && m_selectionActive &&
       m_lassoPath.size() > 1) {
-    QPolygon adjustedPath = m_lassoPath.translated(xOffset, yOffset);
+    QPolygonF adjustedPath = view.map(QPolygonF(m_lassoPath));
     painter.setPen(QPen(Qt::black, 2, Qt::SolidLine));
     painter.drawPolyline(adjustedPath);
     painter.setPen(QPen(Qt::white, 1, Qt::DashLine));
     painter.drawPolyline(adjustedPath);
   }
 
-  // Draw finalized selection with VERY visible outline
-  if (!m_selectionRegion.isEmpty() && !m_selectionActive) {
-    QRegion adjustedRegion = m_selectionRegion.translated(xOffset, yOffset);
-    QRect boundingRect = adjustedRegion.boundingRect();
-    // Draw thick black outline
-    painter.setPen(QPen(Qt::black, 3, Qt::SolidLine));
+  // Colour under the eyedropper, as a ring around the pointer
+  if (m_sampling && m_sampleColor.isValid()) {
+    QPainterPath ring;
+    ring.addEllipse(m_samplePoint, SampleRingOuter, SampleRingOuter);
+    ring.addEllipse(m_samplePoint, SampleRingInner, SampleRingInner);
+    painter.save();
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setPen(QPen(Qt::black, 1));
+    painter.setBrush(m_sampleColor);
+    painter.drawPath(ring);
+    painter.restore();
+  }
+
+  // Marching ants along the finished selection, which stays visible while
+  // a shape that joins it is dragged
+  if (!m_selectionOutline.isEmpty() &&
+      (!m_selectionActive || m_selectionOperation != SelectionMask::Replace)) {
+    painter.save();
+    painter.setTransform(view);
     painter.setBrush(Qt::NoBrush);
-    painter.drawRect(boundingRect.adjusted(-1, -1, 1, 1));
-    // Draw white dashed line on top
-    painter.setPen(QPen(Qt::white, 2, Qt::DashLine));
-    painter.drawRect(boundingRect);
+    // Cosmetic pens keep the line and its dashes in widget pixels
+    QPen pen(Qt::black, 1);
+    pen.setCosmetic(true);
+    painter.setPen(pen);
+    painter.drawPath(m_selectionOutline);
+    pen.setColor(Qt::white);
+    pen.setDashPattern({double(AntsDash), double(AntsDash)});
+    pen.setDashOffset(m_antsOffset);
+    painter.setPen(pen);
+    painter.drawPath(m_selectionOutline);
+    painter.restore();
   }
 }
 
+void Canvas::sampleColor(const QPointF &position) {
+  QPoint point = mapToImage(position).toPoint();
+  if (!m_image.rect().contains(point))
+    return;
+
+  // Reads the layers under the pointer only, not the whole composite
+  QColor color = m_layerManager.sample(point, m_sampleRadius);
+  updateView(samplePreviewRect());
+  m_samplePoint = position;
+  updateView(samplePreviewRect());
+
+  if (color != m_sampleColor) {
+    m_sampleColor = color;
+    m_brush.setColor(color);
+    emit colorPicked(color);
+  }
+}
+
+QRect Canvas::samplePreviewRect() const {
+  QPoint centre = m_samplePoint.toPoint();
+  return QRect(centre, centre)
+      .adjusted(-SampleRingOuter - 1, -SampleRingOuter - 1,
+                SampleRingOuter + 1, SampleRingOuter + 1);
+}
+
+void Canvas::selectionChanged() {
+  // Traced once here rather than on every frame of the animation
+  m_selectionOutline = m_selection.outline();
+  if (m_selectionOutline.isEmpty())
+    m_antsTimer.stop();
+  else if (!m_antsTimer.isActive())
+    m_antsTimer.start();
+  updateView();
+}
+
+void Canvas::advanceAnts() {
+  m_antsOffset = (m_antsOffset + 1) % (2 * AntsDash);
+  // Only the strip around the outline changes
+  updateView(
+      mapFromImage(QRectF(m_selection.bounds())).adjusted(-2, -2, 2, 2));
+}
+
 void Canvas::resizeEvent(QResizeEvent *event) {
-  // In a real app, we might want to handle zoom/pan here,
-  // but for now we just let the canvas stay centered.
+  // The view stays centred (plus pan) as the widget resizes
+  if (m_glView)
+    m_glView->setGeometry(rect());
   QWidget::resizeEvent(event);
 }
 
+void Canvas::wheelEvent(QWheelEvent *event) {
+  if (event->modifiers() & Qt::ControlModifier) {
+    // Zoom around the cursor, one step per wheel notch
+    double steps = event->angleDelta().y() / 120.0;
+    zoomAt(m_zoom * qPow(ZoomStep, steps), event->position());
+  } else if (!event->pixelDelta().isNull()) {
+    m_pan += QPointF(event->pixelDelta());
+    updateView();
+  } else {
+    m_pan += QPointF(event->angleDelta()) / 2;
+    updateView();
+  }
+  event->accept();
+}
+
 void Canvas::mousePressEvent(QMouseEvent *event) {
+  // The middle button drags the view with any tool
+  if (event->button() == Qt::MiddleButton) {
+    m_panning = true;
+    m_panAnchor = event->position();
+    setCursor(Qt::ClosedHandCursor);
+    return;
+  }
+
   if (event->button() == Qt::LeftButton) {
-    int xOffset = (width() - m_image.width()) / 2;
-    int yOffset = (height() - m_image.height()) / 2;
-    QPointF currentPoint = event->position() - QPointF(xOffset, yOffset);
+    QPointF currentPoint = mapToImage(event->position());
 
     m_lastPoint = currentPoint;
 
     if (m_currentTool == EyedropperTool) {
-      // Pick color
-      if (currentPoint.x() >= 0 && currentPoint.x() < m_image.width() &&
-          currentPoint.y() >= 0 && currentPoint.y() < m_image.height()) {
-        QImage composited =
-            m_layerManager.composite(m_image.width(), m_image.height());
-        QColor pickedColor = composited.pixelColor(currentPoint.toPoint());
-        m_brush.setColor(pickedColor);
-        emit colorPicked(pickedColor);
-      }
+      // Keeps picking while dragged
+      m_sampling = true;
+      sampleColor(event->position());
       m_drawing = false;
     } else if (m_currentTool == FillBucketTool) {
       // Fill with current color
@@ -137,106 +461,119 @@ void Canvas::mousePressEvent(QMouseEvent *event) {
       m_drawing = false;
     } else if (m_currentTool == RectSelectTool ||
                m_currentTool == EllipseSelectTool) {
-      // Start new selection (clears old one)
+      // Start new selection; it replaces the old one unless modified
       m_selectionRect = QRect(currentPoint.toPoint(), QSize(0, 0));
       m_selectionActive = true;
-      m_selectionRegion = QRegion(); // Clear old selection
+      m_selectionOperation = selectionOperation(event->modifiers());
       m_drawing = false;
-      update();
+      updateView();
     } else if (m_currentTool == LassoTool) {
-      // Start new lasso selection (clears old one)
+      // Start new lasso selection; it replaces the old one unless modified
       m_lassoPath.clear();
       m_lassoPath << currentPoint.toPoint();
       m_selectionActive = true;
-      m_selectionRegion = QRegion(); // Clear old selection
+      m_selectionOperation = selectionOperation(event->modifiers());
       m_drawing = false;
-      update();
+      updateView();
     } else {
-      // Brush tool - start drawing
-      m_drawing = true;
-      // Draw initial dot at press point
-      drawLineTo(currentPoint, 1.0);
+      beginStroke(inputSample(event));
     }
   }
 }
 
 void Canvas::mouseMoveEvent(QMouseEvent *event) {
-  if (m_currentTool == RectSelectTool || m_currentTool == EllipseSelectTool) {
+  if (m_panning) {
+    m_pan += event->position() - m_panAnchor;
+    m_panAnchor = event->position();
+    updateView();
+    return;
+  }
+
+  if (m_sampling) {
+    sampleColor(event->position());
+  } else if (m_currentTool == RectSelectTool ||
+             m_currentTool == EllipseSelectTool) {
     // Update selection preview
-    int xOffset = (width() - m_image.width()) / 2;
-    int yOffset = (height() - m_image.height()) / 2;
-    QPointF currentPoint = event->position() - QPointF(xOffset, yOffset);
+    QPointF currentPoint = mapToImage(event->position());
     m_selectionRect = QRectF(m_lastPoint, currentPoint).toRect();
     m_selectionActive = true;
-    update();
+    updateView();
   } else if (m_currentTool == LassoTool && m_selectionActive) {
     // Add point to lasso path
-    int xOffset = (width() - m_image.width()) / 2;
-    int yOffset = (height() - m_image.height()) / 2;
-    QPointF currentPoint = event->position() - QPointF(xOffset, yOffset);
+    QPointF currentPoint = mapToImage(event->position());
     m_lassoPath << currentPoint.toPoint();
-    update();
+    updateView();
   } else if (m_drawing && (event->buttons() & Qt::LeftButton)) {
-    int xOffset = (width() - m_image.width()) / 2;
-    int yOffset = (height() - m_image.height()) / 2;
-    QPointF currentPoint = event->position() - QPointF(xOffset, yOffset);
-    // Draw line from last point to current point (drawLineTo updates
-    // m_lastPoint)
-    drawLineTo(currentPoint, 1.0);
+    addStrokeSample(inputSample(event));
   }
 }
 
 void Canvas::mouseReleaseEvent(QMouseEvent *event) {
+  if (event->button() == Qt::MiddleButton && m_panning) {
+    m_panning = false;
+    unsetCursor();
+    return;
+  }
+
   if (event->button() == Qt::LeftButton) {
-    if (m_currentTool == RectSelectTool || m_currentTool == EllipseSelectTool) {
+    if (m_sampling) {
+      m_sampling = false;
+      updateView(samplePreviewRect());
+    } else if (m_currentTool == RectSelectTool ||
+               m_currentTool == EllipseSelectTool) {
       // Finalize selection
       if (m_currentTool == RectSelectTool) {
-        m_selectionRegion = QRegion(m_selectionRect.normalized());
+        m_selection.combine(m_selectionRect.normalized(),
+                            m_selectionOperation);
       } else {
-        m_selectionRegion =
-            QRegion(m_selectionRect.normalized(), QRegion::Ellipse);
+        QPainterPath shape;
+        shape.addEllipse(QRectF(m_selectionRect.normalized()));
+        m_selection.combine(shape, m_selectionOperation);
       }
       // Keep selection active but not in preview mode
       m_selectionActive = false;
       m_selectionRect = QRect(); // Clear rect but keep region
-      update();
+      selectionChanged();
     } else if (m_currentTool == LassoTool && m_selectionActive) {
-      // Finalize lasso selection
+      // Finalize lasso selection; a click without a path deselects
       if (m_lassoPath.size() > 2) {
-        m_selectionRegion = QRegion(m_lassoPath);
+        QPainterPath shape;
+        shape.addPolygon(QPolygonF(m_lassoPath));
+        shape.closeSubpath();
+        m_selection.combine(shape, m_selectionOperation);
+      } else if (m_selectionOperation == SelectionMask::Replace) {
+        m_selection.clear();
       }
       m_selectionActive = false;
       m_lassoPath.clear();
-      update();
+      selectionChanged();
     } else if (m_drawing) {
-      int xOffset = (width() - m_image.width()) / 2;
-      int yOffset = (height() - m_image.height()) / 2;
-      QPointF currentPoint = event->position() - QPointF(xOffset, yOffset);
-      drawLineTo(currentPoint, 1.0);
-      m_drawing = false;
+      addStrokeSample(inputSample(event));
+      endStroke();
     }
   }
 }
 
 void Canvas::tabletEvent(QTabletEvent *event) {
-  // Basic tablet support
-  int xOffset = (width() - m_image.width()) / 2;
-  int yOffset = (height() - m_image.height()) / 2;
-  QPointF currentPoint = event->position() - QPointF(xOffset, yOffset);
+  // Only painting goes through the pen path; for the other tools the
+  // event is ignored and Qt delivers it again as a mouse event
+  if (!isPaintTool(m_currentTool) && !m_drawing) {
+    event->ignore();
+    return;
+  }
 
   switch (event->type()) {
   case QEvent::TabletPress:
-    m_drawing = true;
-    m_lastPoint = currentPoint;
+    if (event->button() == Qt::LeftButton)
+      beginStroke(inputSample(event));
     break;
   case QEvent::TabletMove:
-    if (m_drawing) {
-      drawLineTo(currentPoint, event->pressure());
-      m_lastPoint = currentPoint;
-    }
+    if (m_drawing)
+      addStrokeSample(inputSample(event));
     break;
   case QEvent::TabletRelease:
-    m_drawing = false;
+    if (m_drawing)
+      endStroke();
     break;
   default:
     break;
@@ -244,54 +581,110 @@ void Canvas::tabletEvent(QTabletEvent *event) {
   event->accept();
 }
 
-void Canvas::drawLineTo(const QPointF &endPoint, qreal pressure) {
-  if (!m_layerManager.currentLayer())
+bool Canvas::isPaintTool(ToolType tool) {
+  return tool != EyedropperTool && tool != FillBucketTool &&
+         tool != RectSelectTool && tool != EllipseSelectTool &&
+         tool != LassoTool;
+}
+
+InputSample Canvas::inputSample(const QSinglePointEvent *event) const {
+  InputSample sample;
+  sample.position = mapToImage(event->position());
+  sample.time = event->timestamp();
+  // A mouse has no pressure; it paints at full pressure
+  if (event->deviceType() == QInputDevice::DeviceType::Mouse)
+    sample.pressure = 1.0;
+  else
+    sample.pressure = event->point(0).pressure();
+  return sample;
+}
+
+void Canvas::beginStroke(const InputSample &sample) {
+  Layer *layer = m_layerManager.currentLayer();
+  if (!layer)
     return;
 
-  QImage &layerImage = m_layerManager.currentLayer()->image();
-  QPainter painter(&layerImage);
-  painter.setRenderHint(QPainter::Antialiasing, true);
+  Brush brush = m_brush;
+  if (m_currentTool == EraserTool)
+    brush.setEraser(true);
 
-  // Apply clipping if selection is active
-  if (!m_selectionRegion.isEmpty()) {
-    painter.setClipRegion(m_selectionRegion);
-  }
+  // The worker records the whole stroke as one undo step and hands it to
+  // the history once the stroke is done
+  InputSample first = m_strokeInput.begin(sample);
+  m_layerManager.history()->reserveEdit();
+  m_strokeWorker.beginStroke(layer->id(), brush, m_selection,
+                             first.position, first.pressure);
 
-  // Get brush properties (ignore pressure for now - use full size)
-  qreal size = m_brush.size();
-  QColor color = m_brush.color();
-  color.setAlphaF(m_brush.opacity());
+  m_drawing = true;
+  m_lastPoint = first.position;
+}
 
-  // Set up painter for brush or eraser
-  if (m_brush.isEraser()) {
-    painter.setCompositionMode(QPainter::CompositionMode_DestinationOut);
-    color = QColor(0, 0, 0, int(m_brush.opacity() * 255));
-  } else {
-    painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+void Canvas::addStrokeSample(const InputSample &sample) {
+  if (!m_drawing)
+    return;
+
+  // Dabs are stamped on the worker thread; the painted area comes back
+  // through StrokeWorker::regionPainted
+  InputSample smoothed;
+  if (m_strokeInput.add(sample, smoothed)) {
+    m_strokeWorker.addPoint(smoothed.position, smoothed.pressure);
+    m_lastPoint = smoothed.position;
   }
+  updatePrediction();
+}
+
+void Canvas::endStroke() {
+  InputSample last;
+  if (m_strokeInput.end(last))
+    m_strokeWorker.addPoint(last.position, last.pressure);
 
-  // Simple line drawing with round cap
-  QPen pen(color, size, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin);
-  painter.setPen(pen);
+  m_drawing = false;
+  m_strokeWorker.endStroke();
+  updatePrediction();
+}
+
+void Canvas::setStabilizer(int strength) {
+  m_strokeInput.setStabilizer(strength);
+}
+
+int Canvas::stabilizer() const { return m_strokeInput.stabilizer(); }
 
-  // Draw line from last point to current point
-  qDebug() << "Drawing from" << m_lastPoint << "to" << endPoint
-           << "size:" << size;
-  painter.drawLine(m_lastPoint, endPoint);
+void Canvas::setStrokePrediction(bool enabled) {
+  m_strokeInput.setPredictionEnabled(enabled);
+  updatePrediction();
+}
 
-  // Calculate update rect BEFORE updating m_lastPoint
-  int rad = int(size / 2) + 2;
-  QRect updateRect = QRect(m_lastPoint.toPoint(), endPoint.toPoint())
-                         .normalized()
-                         .adjusted(-rad, -rad, +rad, +rad);
+bool Canvas::strokePrediction() const {
+  return m_strokeInput.isPredictionEnabled();
+}
 
-  // Update m_lastPoint for next segment
-  m_lastPoint = endPoint;
+QRect Canvas::predictionRect() const {
+  if (m_prediction.isNull())
+    return QRect();
 
-  // Convert to widget coordinates
-  int xOffset = (width() - m_image.width()) / 2;
-  int yOffset = (height() - m_image.height()) / 2;
-  update(updateRect.translated(xOffset, yOffset));
+  double margin = m_predictionWidth / 2 + 1;
+  QRectF bounds = QRectF(m_prediction.p1(), m_prediction.p2()).normalized();
+  return mapFromImage(bounds.adjusted(-margin, -margin, margin, margin));
+}
+
+void Canvas::updatePrediction() {
+  updateView(predictionRect());
+
+  // Erasing has no meaningful preview
+  bool erasing = m_brush.isEraser() || m_currentTool == EraserTool;
+  m_prediction = erasing ? QLineF() : m_strokeInput.predictedSegment();
+  m_predictionWidth =
+      qMax(1.0, m_brush.size() * m_strokeInput.predictedPressure());
+  updateView(predictionRect());
+
+  // Without new samples the pen has stopped; drop the guess
+  if (!m_prediction.isNull())
+    m_predictionTimer.start();
+}
+
+void Canvas::clearPrediction() {
+  updateView(predictionRect());
+  m_prediction = QLineF();
 }
 
 void Canvas::resizeImage(QImage *image, const QSize &newSize) {
@@ -307,75 +700,44 @@ void Canvas::resizeImage(QImage *image, const QSize &newSize) {
 // Flood fill implementation added at end of canvas.cpp
 
 void Canvas::floodFill(const QPoint &startPoint, const QColor &fillColor) {
-  if (!m_layerManager.currentLayer())
+  Layer *layer = m_layerManager.currentLayer();
+  if (!layer)
     return;
 
-  QImage &layerImage = m_layerManager.currentLayer()->image();
+  TiledImage &tiles = layer->tiles();
 
   // Check bounds
-  if (startPoint.x() < 0 || startPoint.x() >= layerImage.width() ||
-      startPoint.y() < 0 || startPoint.y() >= layerImage.height()) {
+  if (!tiles.rect().contains(startPoint))
     return;
-  }
-
-  QColor targetColor = layerImage.pixelColor(startPoint);
 
-  // Don't fill if same color
-  if (targetColor == fillColor) {
+  // Nothing to fill when clicking outside the selection
+  if (!m_selection.isEmpty() && !m_selection.contains(startPoint))
     return;
-  }
 
-  int tolerance = m_brush.tolerance();
+  QRgb fillPixel = qPremultiply(fillColor.rgba());
 
-  // Scanline flood fill algorithm
-  QStack<QPoint> stack;
-  stack.push(startPoint);
+  // Waits for a stroke still being rasterized on this layer
+  QRect filledRect;
+  {
+    QWriteLocker locker(m_layerManager.documentLock());
 
-  auto colorMatch = [&](const QColor &c1, const QColor &c2) -> bool {
-    if (tolerance == 0) {
-      return c1 == c2;
-    }
-    int dr = qAbs(c1.red() - c2.red());
-    int dg = qAbs(c1.green() - c2.green());
-    int db = qAbs(c1.blue() - c2.blue());
-    int da = qAbs(c1.alpha() - c2.alpha());
-    return (dr <= tolerance && dg <= tolerance && db <= tolerance &&
-            da <= tolerance);
-  };
-
-  QSet<QPoint> visited;
-
-  while (!stack.isEmpty()) {
-    QPoint p = stack.pop();
-
-    if (p.x() < 0 || p.x() >= layerImage.width() || p.y() < 0 ||
-        p.y() >= layerImage.height()) {
-      continue;
-    }
-
-    if (visited.contains(p)) {
-      continue;
-    }
-
-    // Check if within selection (if active)
-    if (!m_selectionRegion.isEmpty() && !m_selectionRegion.contains(p)) {
-      continue;
-    }
-
-    QColor currentColor = layerImage.pixelColor(p);
-    if (!colorMatch(currentColor, targetColor)) {
-      continue;
-    }
+    // Don't fill if same color
+    if (tiles.pixel(startPoint.x(), startPoint.y()) == fillPixel)
+      return;
 
-    visited.insert(p);
-    layerImage.setPixelColor(p, fillColor);
+    FloodFill fill(tiles, m_brush.tolerance());
+    fill.setSelection(m_selection);
+    filledRect = fill.compute(startPoint);
+    if (filledRect.isEmpty())
+      return;
 
-    // Add neighbors
-    stack.push(QPoint(p.x() + 1, p.y()));
-    stack.push(QPoint(p.x() - 1, p.y()));
-    stack.push(QPoint(p.x(), p.y() + 1));
-    stack.push(QPoint(p.x(), p.y() - 1));
+    History *history = m_layerManager.history();
+    history->beginTileEdit(layer);
+    fill.apply(tiles, fillPixel,
+               [history](const QRect &rect) { history->captureTiles(rect); });
+    history->endTileEdit();
   }
 
-  update();
+  // Repaints the view and tells the layer panel
+  m_layerManager.invalidateRegion(filledRect, layer);
 }
@@ -3,15 +3,25 @@
 
 #include "core/brush.h"
 #include "core/layermanager.h"
+#include "core/selectionmask.h"
+#include "core/strokeinput.h"
+#include "rendering/displaypyramid.h"
+#include "rendering/strokeworker.h"
 #include <QColor>
 #include <QImage>
+#include <QLineF>
 #include <QPainter>
+#include <QPainterPath>
 #include <QPointF>
 #include <QRect>
+#include <QTimer>
+#include <QTransform>
 #include <QWidget>
 #include <memory>
 
 class Brush;
+class GLCanvasView;
+
 class Canvas : public QWidget {
   Q_OBJECT
 
@@ -37,11 +47,46 @@ public:
   void setTool(ToolType tool);
   ToolType currentTool() const { return m_currentTool; }
 
+  // The eyedropper averages the square of pixels within radius of the
+  // pointer (0: one pixel)
+  void setSampleRadius(int radius) { m_sampleRadius = qMax(0, radius); }
+  int sampleRadius() const { return m_sampleRadius; }
+
   void newImage(const QSize &size, const QColor &color = Qt::white);
   void newImage(int width, int height, const QColor &color = Qt::white);
+  // Replaces the document with layers (bottom to top) of the given size
+  void setDocument(const QSize &size,
+                   std::vector<std::unique_ptr<Layer>> layers,
+                   int currentLayer);
 
   LayerManager *layerManager() { return &m_layerManager; }
 
+  // Empty when nothing is selected
+  const SelectionMask &selection() const { return m_selection; }
+  // Neither rasterizes nor composites anything, whatever the canvas size
+  void selectAll();
+  void deselect();
+  void invertSelection();
+  void featherSelection(double radius);
+
+  double zoom() const { return m_zoom; }
+
+  // Stroke smoothing, 0 (off) to 100
+  void setStabilizer(int strength);
+  int stabilizer() const;
+  // Whether a short extrapolated segment is drawn ahead of the pen
+  void setStrokePrediction(bool enabled);
+  bool strokePrediction() const;
+
+public slots:
+  void setZoom(double zoom); // Keeps the widget centre in place
+  void zoomIn();
+  void zoomOut();
+  void fitToScreen();
+
+  // Marks the whole composite cache stale (layer stack or content replaced)
+  void invalidateComposite();
+
 signals:
   void colorPicked(QColor color);
 
@@ -53,16 +98,52 @@ protected:
   void mousePressEvent(QMouseEvent *event) override;
   void mouseMoveEvent(QMouseEvent *event) override;
   void mouseReleaseEvent(QMouseEvent *event) override;
+  void wheelEvent(QWheelEvent *event) override;
 
   // Tablet support
   void tabletEvent(QTabletEvent *event) override;
 
 private:
-  void drawLineTo(const QPointF &endPoint, double pressure);
+  friend class GLCanvasView;
+
+  // Mouse and pen samples both go through these
+  static bool isPaintTool(ToolType tool);
+  InputSample inputSample(const QSinglePointEvent *event) const;
+  void beginStroke(const InputSample &sample);
+  void addStrokeSample(const InputSample &sample);
+  void endStroke();
+  void updatePrediction();
+  void clearPrediction();
+  QRect predictionRect() const; // Widget coordinates
   void resizeImage(QImage *image, const QSize &newSize);
   void floodFill(const QPoint &startPoint, const QColor &fillColor);
-
-  QImage m_image; // This will now act as the composited cache
+  void markDirty(const QRect &rect);
+  // Eyedropper: picks the colour under position (widget coordinates)
+  void sampleColor(const QPointF &position);
+  QRect samplePreviewRect() const; // Widget coordinates
+  // Re-traces the outline of m_selection after it changed
+  void selectionChanged();
+  void advanceAnts();
+
+  // Schedules a repaint of rect (widget coordinates; null: everything)
+  void updateView(const QRect &rect = QRect());
+  // Frame steps shared by the raster and OpenGL presentation paths
+  void prepareFrame(); // Re-blends the dirty part of m_image
+  void paintOverlays(QPainter &painter, const QTransform &view);
+
+  // Image <-> widget coordinates
+  QTransform viewTransform() const;
+  QPointF mapToImage(const QPointF &point) const;
+  QRect mapFromImage(const QRectF &rect) const; // Covering widget rect
+  void zoomAt(double zoom, const QPointF &anchor);
+
+  QImage m_image;    // Composited cache, re-blended only inside m_dirtyRect
+  QRect m_dirtyRect; // Union of image-space rects awaiting recomposite
+  DisplayPyramid m_pyramid; // Reduced copies of m_image for zoomed-out views
+  double m_zoom;
+  QPointF m_pan; // View offset from the centred position, widget pixels
+  bool m_panning;
+  QPointF m_panAnchor;
   QPointF m_lastPoint;
   bool m_drawing;
 
@@ -70,11 +151,29 @@ private:
 
   bool m_selectionActive;
   QRect m_selectionRect;
-  QRegion m_selectionRegion; // For complex selections later
-  QPolygon m_lassoPath;      // For lasso selection
+  QPolygon m_lassoPath; // For lasso selection
+  SelectionMask m_selection;
+  // How the shape being dragged joins m_selection (from the modifiers)
+  SelectionMask::Operation m_selectionOperation;
+  QPainterPath m_selectionOutline; // Canvas coordinates
+  QTimer m_antsTimer;              // Steps the outline's dash offset
+  int m_antsOffset;
+
+  int m_sampleRadius;
+  bool m_sampling;        // The eyedropper is being dragged
+  QPointF m_samplePoint;  // Widget coordinates of the preview
+  QColor m_sampleColor;
+
+  StrokeInput m_strokeInput;
+  QLineF m_prediction; // Canvas coordinates; null when nothing is predicted
+  double m_predictionWidth;
+  QTimer m_predictionTimer;
+
+  GLCanvasView *m_glView; // Null when presenting through QPainter
 
   Brush m_brush;
   LayerManager m_layerManager;
+  StrokeWorker m_strokeWorker; // Stopped before m_layerManager goes away
 };
 
 #endif // CANVAS_H
@@ -11,3 +11,23 @@ void Canvas::setTool(ToolType tool) {
     m_selectionActive = false;
   }
 }
+
+void Canvas::selectAll() {
+  m_selection.selectAll();
+  selectionChanged();
+}
+
+void Canvas::deselect() {
+  m_selection.clear();
+  selectionChanged();
+}
+
+void Canvas::invertSelection() {
+  m_selection.invert();
+  selectionChanged();
+}
+
+void Canvas::featherSelection(double radius) {
+  m_selection.feather(radius);
+  selectionChanged();
+}
@@ -0,0 +1,319 @@
+#include "floodfill.h"
+
+#include <QtGlobal>
+#include <algorithm>
+
+static inline int div255(int x) { return (x + (x >> 8) + 0x80) >> 8; }
+
+// Moves each channel of the premultiplied pixel dest towards color by
+// amount / 255
+static inline QRgb mix(QRgb dest, QRgb color, int amount) {
+  QRgb result = 0;
+  for (int shift = 0; shift < 32; shift += 8) {
+    int d = (dest >> shift) & 0xff;
+    int c = (color >> shift) & 0xff;
+    result |= QRgb(d + div255((c - d) * amount)) << shift;
+  }
+  return result;
+}
+
+FloodFill::FloodFill(const TiledImage &image, int tolerance)
+    : m_width(image.width()), m_height(image.height()),
+      m_columns(image.tileColumns()), m_tolerance(qBound(0, tolerance, 255)),
+      m_words((image.width() + 63) / 64), m_target(0) {
+  m_tileBits.resize(image.tileColumns() * image.tileRows(), nullptr);
+  for (int ty = 0; ty < image.tileRows(); ++ty) {
+    for (int tx = 0; tx < image.tileColumns(); ++tx) {
+      const QImage &tile = image.tile(tx, ty);
+      if (!tile.isNull())
+        m_tileBits[ty * m_columns + tx] = tile.constBits();
+    }
+  }
+}
+
+void FloodFill::setSelection(const SelectionMask &selection) {
+  m_selection = selection;
+  if (selection.isEmpty()) {
+    m_blocked.clear();
+    return;
+  }
+
+  // Everything is blocked except the selection. Fully selected tiles open
+  // whole rows at once, the others each run of non-zero coverage.
+  m_blocked.assign(size_t(m_words) * m_height, ~quint64(0));
+  const int TileSize = TiledImage::TileSize;
+  QRect bounds = selection.bounds();
+  for (int ty = bounds.top() / TileSize; ty <= bounds.bottom() / TileSize;
+       ++ty) {
+    for (int tx = bounds.left() / TileSize;
+         tx <= bounds.right() / TileSize; ++tx) {
+      QRect tileRect = TiledImage::tileRect(tx, ty);
+      QRect area = tileRect.intersected(bounds);
+      const QImage &tile = selection.tile(tx, ty);
+      if (tile.isNull())
+        continue;
+
+      bool solid = selection.isSolid(tx, ty);
+      for (int y = area.top(); y <= area.bottom(); ++y) {
+        if (solid) {
+          clearBits(m_blocked, m_words, y, area.left(), area.right());
+          continue;
+        }
+
+        const quint8 *row = tile.constScanLine(y - tileRect.top());
+        int left = tileRect.left();
+        for (int x = area.left(); x <= area.right();) {
+          if (!row[x - left]) {
+            ++x;
+            continue;
+          }
+          int start = x;
+          while (x <= area.right() && row[x - left])
+            ++x;
+          clearBits(m_blocked, m_words, y, start, x - 1);
+        }
+      }
+    }
+  }
+}
+
+QRect FloodFill::compute(const QPoint &seed) {
+  m_filled.assign(size_t(m_words) * m_height, 0);
+  m_bounds = QRect();
+
+  if (seed.x() < 0 || seed.x() >= m_width || seed.y() < 0 ||
+      seed.y() >= m_height)
+    return m_bounds;
+
+  m_target = pixel(seed.x(), seed.y());
+  if (!isOpen(seed.x(), seed.y()))
+    return m_bounds;
+
+  std::vector<Span> stack;
+  stack.push_back({seed.x(), seed.x(), seed.y()});
+
+  while (!stack.empty()) {
+    Span span = stack.back();
+    stack.pop_back();
+
+    // Runs are maximal, so a run is either still open or was swallowed
+    // whole by a span filled after it was pushed
+    if (testBit(m_filled, m_words, span.left, span.y))
+      continue;
+
+    // Grow the run to both sides along the row
+    int left = extend(span.left, span.y, -1);
+    int right = extend(span.right, span.y, 1);
+
+    setBits(m_filled, m_words, span.y, left, right);
+    m_bounds |= QRect(left, span.y, right - left + 1, 1);
+
+    // Queue every open run in the rows above and below
+    if (span.y > 0)
+      seedRuns(stack, span.y - 1, left, right);
+    if (span.y < m_height - 1)
+      seedRuns(stack, span.y + 1, left, right);
+  }
+
+  return m_bounds;
+}
+
+int FloodFill::extend(int x, int y, int step) const {
+  const quint64 *filled = m_filled.data() + size_t(y) * m_words;
+  const quint64 *blocked =
+      m_blocked.empty() ? nullptr : m_blocked.data() + size_t(y) * m_words;
+
+  // Walk tile segment by tile segment so the row pointer is looked up once
+  // per segment instead of once per pixel
+  int last = x;
+  int nx = x + step;
+  while (nx >= 0 && nx < m_width) {
+    const QRgb *line = tileLine(nx, y);
+    int tileLeft = nx - nx % TiledImage::TileSize;
+    int end = step > 0 ? qMin(m_width - 1, tileLeft + TiledImage::TileSize - 1)
+                       : tileLeft;
+
+    for (; step > 0 ? nx <= end : nx >= end; nx += step) {
+      quint64 closed = filled[nx / 64] | (blocked ? blocked[nx / 64] : 0);
+      if ((closed >> (nx % 64)) & 1)
+        return last;
+      if (!matches(line ? line[nx - tileLeft] : 0))
+        return last;
+      last = nx;
+    }
+  }
+  return last;
+}
+
+void FloodFill::seedRuns(std::vector<Span> &stack, int y, int left,
+                         int right) const {
+  const quint64 *filled = m_filled.data() + size_t(y) * m_words;
+  const quint64 *blocked =
+      m_blocked.empty() ? nullptr : m_blocked.data() + size_t(y) * m_words;
+
+  int runStart = -1;
+  int x = left;
+  while (x <= right) {
+    // Chunks never cross a mask word or a tile boundary
+    int tileLeft = x - x % TiledImage::TileSize;
+    int end = qMin(right, (x / 64) * 64 + 63);
+    quint64 closed =
+        (filled[x / 64] | (blocked ? blocked[x / 64] : 0)) >> (x % 64);
+
+    if (closed == ~quint64(0) >> (x % 64)) {
+      // Whole remainder of the word is filled or outside the selection
+      if (runStart >= 0)
+        stack.push_back({runStart, x - 1, y});
+      runStart = -1;
+      x = end + 1;
+      continue;
+    }
+
+    const QRgb *line = tileLine(x, y);
+    for (; x <= end; ++x, closed >>= 1) {
+      bool open = !(closed & 1) && matches(line ? line[x - tileLeft] : 0);
+      if (open && runStart < 0) {
+        runStart = x;
+      } else if (!open && runStart >= 0) {
+        stack.push_back({runStart, x - 1, y});
+        runStart = -1;
+      }
+    }
+  }
+
+  if (runStart >= 0)
+    stack.push_back({runStart, right, y});
+}
+
+bool FloodFill::isFilled(int x, int y) const {
+  if (x < 0 || x >= m_width || y < 0 || y >= m_height || m_filled.empty())
+    return false;
+  return testBit(m_filled, m_words, x, y);
+}
+
+void FloodFill::apply(
+    TiledImage &image, QRgb color,
+    const std::function<void(const QRect &)> &beforeTileWrite) const {
+  QImage solidTile; // Shared by every tile the fill covers completely
+
+  QRect range = image.tileRange(m_bounds);
+  for (int ty = range.top(); ty <= range.bottom(); ++ty) {
+    for (int tx = range.left(); tx <= range.right(); ++tx) {
+      QRect tileRect = TiledImage::tileRect(tx, ty);
+      QRect area = tileRect.intersected(m_bounds);
+
+      // Partly selected tiles blend the color in by the coverage
+      const QImage *selection = nullptr;
+      if (!m_selection.isEmpty() && !m_selection.isSolid(tx, ty))
+        selection = &m_selection.tile(tx, ty);
+
+      if (!selection && area == tileRect.intersected(image.rect()) &&
+          isCovered(area)) {
+        if (solidTile.isNull()) {
+          solidTile = TiledImage::createTile();
+          solidTile.fill(color);
+        }
+        if (beforeTileWrite)
+          beforeTileWrite(area);
+        image.setTile(tx, ty, solidTile);
+        continue;
+      }
+
+      QImage *target = nullptr;
+
+      for (int y = area.top(); y <= area.bottom(); ++y) {
+        const quint64 *bits = m_filled.data() + size_t(y) * m_words;
+        QRgb *line = nullptr;
+
+        int x = area.left();
+        while (x <= area.right()) {
+          quint64 word = bits[x / 64] >> (x % 64);
+          if (word == 0) {
+            x = (x / 64 + 1) * 64; // Nothing left in this word
+            continue;
+          }
+
+          if (!target) {
+            if (beforeTileWrite)
+              beforeTileWrite(area);
+            target = &image.tileForWrite(tx, ty);
+          }
+          if (!line)
+            line = reinterpret_cast<QRgb *>(
+                target->scanLine(y - tileRect.top()));
+          const quint8 *limit =
+              selection ? selection->constScanLine(y - tileRect.top())
+                        : nullptr;
+
+          // Solid words are written as one run
+          int end = qMin(area.right(), (x / 64) * 64 + 63);
+          if (!limit && word == ~quint64(0) >> (x % 64)) {
+            std::fill(line + (x - tileRect.left()),
+                      line + (end - tileRect.left() + 1), color);
+            x = end + 1;
+            continue;
+          }
+
+          for (; x <= end; ++x, word >>= 1) {
+            if (!(word & 1))
+              continue;
+            int i = x - tileRect.left();
+            line[i] = limit ? mix(line[i], color, limit[i]) : color;
+          }
+        }
+      }
+    }
+  }
+}
+
+bool FloodFill::isCovered(const QRect &area) const {
+  for (int y = area.top(); y <= area.bottom(); ++y) {
+    const quint64 *bits = m_filled.data() + size_t(y) * m_words;
+    for (int x = area.left(); x <= area.right();) {
+      int bit = x % 64;
+      int count = qMin(64 - bit, area.right() - x + 1);
+      quint64 mask = count == 64 ? ~quint64(0) : ((quint64(1) << count) - 1);
+      if (((bits[x / 64] >> bit) & mask) != mask)
+        return false;
+      x += count;
+    }
+  }
+  return true;
+}
+
+bool FloodFill::isOpen(int x, int y) const {
+  if (testBit(m_filled, m_words, x, y))
+    return false;
+  if (!m_blocked.empty() && testBit(m_blocked, m_words, x, y))
+    return false;
+  return matches(pixel(x, y));
+}
+
+bool FloodFill::testBit(const std::vector<quint64> &mask, int words, int x,
+                        int y) {
+  return (mask[size_t(y) * words + x / 64] >> (x % 64)) & 1;
+}
+
+void FloodFill::setBits(std::vector<quint64> &mask, int words, int y,
+                        int from, int to) {
+  quint64 *row = mask.data() + size_t(y) * words;
+  for (int x = from; x <= to;) {
+    int bit = x % 64;
+    int count = qMin(64 - bit, to - x + 1);
+    quint64 bits = count == 64 ? ~quint64(0) : ((quint64(1) << count) - 1);
+    row[x / 64] |= bits << bit;
+    x += count;
+  }
+}
+
+void FloodFill::clearBits(std::vector<quint64> &mask, int words, int y,
+                          int from, int to) {
+  quint64 *row = mask.data() + size_t(y) * words;
+  for (int x = from; x <= to;) {
+    int bit = x % 64;
+    int count = qMin(64 - bit, to - x + 1);
+    quint64 bits = count == 64 ? ~quint64(0) : ((quint64(1) << count) - 1);
+    row[x / 64] &= ~(bits << bit);
+    x += count;
+  }
+}
@@ -0,0 +1,93 @@
+#ifndef FLOODFILL_H
+#define FLOODFILL_H
+
+#include "core/selectionmask.h"
+#include "core/tiledimage.h"
+#include <QPoint>
+#include <QRect>
+#include <functional>
+#include <vector>
+
+// Span-based scanline flood fill working directly on tile rows. The filled
+// area is computed into a 1-bit mask first, then written tile by tile so
+// that only tiles that actually receive pixels are allocated or un-shared.
+class FloodFill {
+public:
+  FloodFill(const TiledImage &image, int tolerance);
+
+  // Restricts the fill to the selected pixels (an empty selection means
+  // no restriction); partly selected ones are only partly filled
+  void setSelection(const SelectionMask &selection);
+
+  // Computes the connected area around seed; returns its bounding rect
+  QRect compute(const QPoint &seed);
+  QRect bounds() const { return m_bounds; }
+
+  bool isFilled(int x, int y) const;
+
+  // Writes color (premultiplied) into every filled pixel. beforeTileWrite
+  // is called with the affected part of a tile before it is modified.
+  void apply(TiledImage &image, QRgb color,
+             const std::function<void(const QRect &)> &beforeTileWrite) const;
+
+private:
+  struct Span {
+    int left;
+    int right;
+    int y;
+  };
+
+  QRgb pixel(int x, int y) const {
+    const QRgb *line = tileLine(x, y);
+    return line ? line[x % TiledImage::TileSize] : 0;
+  }
+
+  // Start of the tile row containing (x, y), or nullptr for absent tiles
+  const QRgb *tileLine(int x, int y) const {
+    const uchar *bits = m_tileBits[(y / TiledImage::TileSize) * m_columns +
+                                   x / TiledImage::TileSize];
+    if (!bits)
+      return nullptr;
+    return reinterpret_cast<const QRgb *>(bits) +
+           (y % TiledImage::TileSize) * TiledImage::TileSize;
+  }
+
+  // Last open x reached when walking from x in direction step (+1 / -1)
+  int extend(int x, int y, int step) const;
+  // Pushes every open run inside [left, right] of row y
+  void seedRuns(std::vector<Span> &stack, int y, int left, int right) const;
+
+  bool matches(QRgb color) const {
+    if (color == m_target)
+      return true;
+    if (m_tolerance == 0)
+      return false;
+    return qAbs(qAlpha(color) - qAlpha(m_target)) <= m_tolerance &&
+           qAbs(qRed(color) - qRed(m_target)) <= m_tolerance &&
+           qAbs(qGreen(color) - qGreen(m_target)) <= m_tolerance &&
+           qAbs(qBlue(color) - qBlue(m_target)) <= m_tolerance;
+  }
+  bool isOpen(int x, int y) const; // Not yet filled, not blocked, matching
+  bool isCovered(const QRect &area) const; // Every pixel of area is filled
+
+  static bool testBit(const std::vector<quint64> &mask, int words, int x,
+                      int y);
+  static void setBits(std::vector<quint64> &mask, int words, int y, int from,
+                      int to);
+  static void clearBits(std::vector<quint64> &mask, int words, int y,
+                        int from, int to);
+
+  int m_width;
+  int m_height;
+  int m_columns;
+  int m_tolerance;
+  int m_words; // 64-bit words per mask row
+  QRgb m_target;
+  QRect m_bounds;
+  std::vector<const uchar *> m_tileBits; // nullptr for absent tiles
+  std::vector<quint64> m_filled;
+  std::vector<quint64> m_blocked; // Outside the selection; empty if none
+  SelectionMask m_selection;
+};
+
+#endif // FLOODFILL_H
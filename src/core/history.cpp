@@ -0,0 +1,378 @@
+#include "history.h"
+#include "core/layer.h"
+#include "core/layermanager.h"
+
+#include <QReadLocker>
+#include <QWriteLocker>
+#include <algorithm>
+#include <cstring>
+
+// --- TileEditCommand ---
+
+TileEditCommand::TileEditCommand(const QString &layerId)
+    : m_layerId(layerId), m_compressed(false) {}
+
+void TileEditCommand::captureBefore(const Layer &layer, const QRect &rect) {
+  const TiledImage &tiles = layer.tiles();
+  QRect range = tiles.tileRange(rect);
+  for (int ty = range.top(); ty <= range.bottom(); ++ty) {
+    for (int tx = range.left(); tx <= range.right(); ++tx) {
+      quint64 key = (quint64(ty) << 32) | quint32(tx);
+      if (m_capturedTiles.contains(key))
+        continue;
+      m_capturedTiles.insert(key);
+
+      // Shallow copy: the layer detaches its own tile when it paints
+      TileDelta delta;
+      delta.tile = QPoint(tx, ty);
+      delta.before = tiles.tile(tx, ty);
+      m_deltas.push_back(delta);
+    }
+  }
+}
+
+bool TileEditCommand::captureAfter(const Layer &layer) {
+  const TiledImage &tiles = layer.tiles();
+  for (TileDelta &delta : m_deltas)
+    delta.after = tiles.tile(delta.tile.x(), delta.tile.y());
+
+  // A tile that still shares its data with the snapshot was never written
+  m_deltas.erase(std::remove_if(m_deltas.begin(), m_deltas.end(),
+                                [](const TileDelta &delta) {
+                                  if (delta.before.isNull() ||
+                                      delta.after.isNull())
+                                    return delta.before.isNull() &&
+                                           delta.after.isNull();
+                                  return delta.before.cacheKey() ==
+                                         delta.after.cacheKey();
+                                }),
+                 m_deltas.end());
+  m_capturedTiles.clear();
+
+  return !m_deltas.empty();
+}
+
+void TileEditCommand::undo(LayerManager &manager) { apply(manager, true); }
+
+void TileEditCommand::redo(LayerManager &manager) { apply(manager, false); }
+
+void TileEditCommand::apply(LayerManager &manager, bool useBefore) {
+  Layer *layer = manager.layerById(m_layerId);
+  if (!layer)
+    return;
+
+  QRect dirty;
+  {
+    QWriteLocker locker(manager.documentLock());
+    for (const TileDelta &delta : m_deltas) {
+      QImage tile;
+      if (m_compressed)
+        tile = unpack(useBefore ? delta.packedBefore : delta.packedAfter);
+      else
+        tile = useBefore ? delta.before : delta.after;
+
+      layer->tiles().setTile(delta.tile.x(), delta.tile.y(), tile);
+      dirty |= TiledImage::tileRect(delta.tile.x(), delta.tile.y());
+    }
+  }
+
+  manager.invalidateRegion(dirty.intersected(layer->tiles().rect()), layer);
+}
+
+qint64 TileEditCommand::byteSize(QSet<qint64> &counted) const {
+  qint64 bytes = 0;
+  for (const TileDelta &delta : m_deltas) {
+    if (m_compressed) {
+      bytes += delta.packedBefore.size() + delta.packedAfter.size();
+    } else {
+      bytes += tileBytes(delta.before, counted) +
+               tileBytes(delta.after, counted);
+    }
+  }
+  return bytes;
+}
+
+qint64 TileEditCommand::tileBytes(const QImage &tile,
+                                  QSet<qint64> &counted) {
+  // One stroke's after is usually the next one's before
+  if (tile.isNull() || counted.contains(tile.cacheKey()))
+    return 0;
+  counted.insert(tile.cacheKey());
+  return tile.sizeInBytes();
+}
+
+bool TileEditCommand::compress() {
+  if (m_compressed)
+    return false;
+
+  for (TileDelta &delta : m_deltas) {
+    delta.packedBefore = pack(delta.before);
+    delta.packedAfter = pack(delta.after);
+    delta.before = QImage();
+    delta.after = QImage();
+  }
+  m_compressed = true;
+  return true;
+}
+
+QByteArray TileEditCommand::pack(const QImage &tile) {
+  // An empty array stands for an absent (transparent) tile
+  if (tile.isNull())
+    return QByteArray();
+  return qCompress(tile.constBits(), tile.sizeInBytes(), 1);
+}
+
+QImage TileEditCommand::unpack(const QByteArray &data) {
+  if (data.isEmpty())
+    return QImage();
+
+  QByteArray raw = qUncompress(data);
+  QImage tile(TiledImage::TileSize, TiledImage::TileSize,
+              QImage::Format_ARGB32_Premultiplied);
+  if (raw.size() != tile.sizeInBytes())
+    return QImage();
+  std::memcpy(tile.bits(), raw.constData(), raw.size());
+  return tile;
+}
+
+// --- Layer stack commands ---
+
+InsertLayerCommand::InsertLayerCommand(int index) : m_index(index) {}
+
+InsertLayerCommand::~InsertLayerCommand() {}
+
+void InsertLayerCommand::undo(LayerManager &manager) {
+  m_layer = manager.takeLayer(m_index);
+}
+
+void InsertLayerCommand::redo(LayerManager &manager) {
+  if (m_layer)
+    manager.insertLayer(m_index, std::move(m_layer));
+}
+
+qint64 InsertLayerCommand::byteSize(QSet<qint64> &counted) const {
+  return m_layer ? m_layer->tiles().allocatedBytes(counted) : 0;
+}
+
+RemoveLayerCommand::RemoveLayerCommand(int index, std::unique_ptr<Layer> layer)
+    : m_index(index), m_layer(std::move(layer)) {}
+
+RemoveLayerCommand::~RemoveLayerCommand() {}
+
+void RemoveLayerCommand::undo(LayerManager &manager) {
+  if (m_layer)
+    manager.insertLayer(m_index, std::move(m_layer));
+}
+
+void RemoveLayerCommand::redo(LayerManager &manager) {
+  m_layer = manager.takeLayer(m_index);
+}
+
+qint64 RemoveLayerCommand::byteSize(QSet<qint64> &counted) const {
+  return m_layer ? m_layer->tiles().allocatedBytes(counted) : 0;
+}
+
+MoveLayerCommand::MoveLayerCommand(int fromIndex, int toIndex)
+    : m_fromIndex(fromIndex), m_toIndex(toIndex) {}
+
+void MoveLayerCommand::undo(LayerManager &manager) {
+  manager.moveLayer(m_toIndex, m_fromIndex);
+}
+
+void MoveLayerCommand::redo(LayerManager &manager) {
+  manager.moveLayer(m_fromIndex, m_toIndex);
+}
+
+qint64 MoveLayerCommand::byteSize(QSet<qint64> &) const { return 0; }
+
+// --- History ---
+
+History::History(LayerManager *manager, QObject *parent)
+    : QObject(parent), m_manager(manager), m_tick(0), m_index(0),
+      m_replaying(false), m_memoryBudget(DefaultMemoryBudget),
+      m_editLayer(nullptr), m_reservedEdits(0) {}
+
+History::~History() {}
+
+void History::push(std::unique_ptr<HistoryCommand> command) {
+  if (m_replaying || !command)
+    return;
+
+  // A new change discards everything that could have been redone
+  m_commands.erase(m_commands.begin() + m_index, m_commands.end());
+  m_lastUsed.erase(m_lastUsed.begin() + m_index, m_lastUsed.end());
+
+  m_commands.push_back(std::move(command));
+  m_lastUsed.push_back(0);
+  m_index = m_commands.size();
+  touch(m_index - 1);
+
+  enforceBudget();
+  emitStateChanged();
+}
+
+void History::beginTileEdit(Layer *layer) {
+  endTileEdit();
+  if (!layer)
+    return;
+
+  m_editLayer = layer;
+  m_pendingEdit = std::make_unique<TileEditCommand>(layer->id());
+}
+
+void History::captureTiles(const QRect &rect) {
+  if (m_pendingEdit)
+    m_pendingEdit->captureBefore(*m_editLayer, rect);
+}
+
+void History::endTileEdit() {
+  if (!m_pendingEdit)
+    return;
+
+  std::unique_ptr<TileEditCommand> edit = std::move(m_pendingEdit);
+  if (edit->captureAfter(*m_editLayer))
+    push(std::move(edit));
+  m_editLayer = nullptr;
+  applyDeferred();
+}
+
+void History::reserveEdit() {
+  ++m_reservedEdits;
+  emitStateChanged();
+}
+
+void History::completeEdit(std::unique_ptr<HistoryCommand> command) {
+  m_reservedEdits = qMax(0, m_reservedEdits - 1);
+  if (command)
+    push(std::move(command));
+  else
+    emitStateChanged();
+  applyDeferred();
+}
+
+bool History::canUndo() const { return m_index > 0 || editInProgress(); }
+
+bool History::canRedo() const {
+  // A finished edit discards what could be redone
+  return !editInProgress() && m_index < int(m_commands.size());
+}
+
+bool History::editInProgress() const {
+  return m_pendingEdit || m_reservedEdits > 0;
+}
+
+void History::applyDeferred() {
+  if (editInProgress())
+    return;
+
+  std::vector<bool> deferred;
+  deferred.swap(m_deferred);
+  for (bool undoing : deferred) {
+    if (undoing)
+      undo();
+    else
+      redo();
+  }
+}
+
+void History::setMemoryBudget(qint64 bytes) {
+  m_memoryBudget = qMax<qint64>(0, bytes);
+  enforceBudget();
+  emitStateChanged();
+}
+
+qint64 History::memoryUsage() const {
+  // Tiles the layers still use are not freed by dropping a command
+  QSet<qint64> counted;
+  QReadLocker locker(m_manager->documentLock());
+  for (int i = 0; i < m_manager->layerCount(); ++i)
+    m_manager->layerAt(i)->tiles().allocatedBytes(counted);
+
+  qint64 bytes = 0;
+  for (const auto &command : m_commands)
+    bytes += command->byteSize(counted);
+  return bytes;
+}
+
+void History::undo() {
+  // E.g. Ctrl+Z right after the pen is lifted, before the stroke is in
+  if (editInProgress()) {
+    m_deferred.push_back(true);
+    return;
+  }
+  if (!canUndo())
+    return;
+
+  m_replaying = true;
+  --m_index;
+  m_commands[m_index]->undo(*m_manager);
+  m_replaying = false;
+
+  touch(m_index);
+  emitStateChanged();
+}
+
+void History::redo() {
+  if (editInProgress()) {
+    m_deferred.push_back(false);
+    return;
+  }
+  if (!canRedo())
+    return;
+
+  m_replaying = true;
+  m_commands[m_index]->redo(*m_manager);
+  ++m_index;
+  m_replaying = false;
+
+  touch(m_index - 1);
+  emitStateChanged();
+}
+
+void History::clear() {
+  m_pendingEdit.reset();
+  m_editLayer = nullptr;
+  m_reservedEdits = 0;
+  m_deferred.clear();
+  m_commands.clear();
+  m_lastUsed.clear();
+  m_index = 0;
+  emitStateChanged();
+}
+
+void History::touch(int index) { m_lastUsed[index] = ++m_tick; }
+
+void History::enforceBudget() {
+  qint64 usage = memoryUsage();
+  if (usage <= m_memoryBudget)
+    return;
+
+  // First pass: compress the least recently used states
+  std::vector<int> order(m_commands.size());
+  for (int i = 0; i < int(order.size()); ++i)
+    order[i] = i;
+  std::sort(order.begin(), order.end(),
+            [this](int a, int b) { return m_lastUsed[a] < m_lastUsed[b]; });
+
+  // Shared tiles make a command's own size no measure of what compressing
+  // or dropping it frees, so usage is recounted after each step
+  for (int i : order) {
+    if (usage <= m_memoryBudget)
+      return;
+    if (m_commands[i]->compress())
+      usage = memoryUsage();
+  }
+
+  // Second pass: forget the oldest undo steps, always keeping the latest
+  while (usage > m_memoryBudget && m_index > 1) {
+    m_commands.erase(m_commands.begin());
+    m_lastUsed.erase(m_lastUsed.begin());
+    --m_index;
+    usage = memoryUsage();
+  }
+}
+
+void History::emitStateChanged() {
+  emit canUndoChanged(canUndo());
+  emit canRedoChanged(canRedo());
+}
@@ -0,0 +1,185 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QObject>
+#include <QPoint>
+#include <QRect>
+#include <QSet>
+#include <QString>
+#include <memory>
+#include <vector>
+
+class Layer;
+class LayerManager;
+
+// A single undoable document change. Commands are pushed after the change
+// has been applied, so the first redo() happens only after an undo().
+class HistoryCommand {
+public:
+  virtual ~HistoryCommand() = default;
+
+  virtual void undo(LayerManager &manager) = 0;
+  virtual void redo(LayerManager &manager) = 0;
+
+  // Memory held by the command, used for the history budget. Tiles whose
+  // cache key is in counted (shared with a layer or another command) free
+  // nothing when dropped and are left out; the others are added to it.
+  virtual qint64 byteSize(QSet<qint64> &counted) const = 0;
+
+  // Shrinks the held state to a compressed form; returns false when there
+  // is nothing left to compress
+  virtual bool compress() { return false; }
+};
+
+// Pixel change on one layer, stored as before/after copies of only the
+// tiles that were touched
+class TileEditCommand : public HistoryCommand {
+public:
+  explicit TileEditCommand(const QString &layerId);
+
+  // Remembers the current content of the tiles under rect (once per tile)
+  void captureBefore(const Layer &layer, const QRect &rect);
+  // Snapshots the result and drops tiles that did not change; returns
+  // false if nothing changed at all
+  bool captureAfter(const Layer &layer);
+
+  void undo(LayerManager &manager) override;
+  void redo(LayerManager &manager) override;
+  qint64 byteSize(QSet<qint64> &counted) const override;
+  bool compress() override;
+
+private:
+  struct TileDelta {
+    QPoint tile;
+    QImage before; // Null when the tile was absent (or compressed)
+    QImage after;
+    QByteArray packedBefore;
+    QByteArray packedAfter;
+  };
+
+  void apply(LayerManager &manager, bool useBefore);
+
+  static qint64 tileBytes(const QImage &tile, QSet<qint64> &counted);
+  static QByteArray pack(const QImage &tile);
+  static QImage unpack(const QByteArray &data);
+
+  QString m_layerId;
+  std::vector<TileDelta> m_deltas;
+  QSet<quint64> m_capturedTiles;
+  bool m_compressed;
+};
+
+// New layer placed at index; owns the layer while it is undone
+class InsertLayerCommand : public HistoryCommand {
+public:
+  explicit InsertLayerCommand(int index);
+  ~InsertLayerCommand() override;
+
+  void undo(LayerManager &manager) override;
+  void redo(LayerManager &manager) override;
+  qint64 byteSize(QSet<qint64> &counted) const override;
+
+private:
+  int m_index;
+  std::unique_ptr<Layer> m_layer;
+};
+
+// Layer removed from index; owns the layer until it is undone
+class RemoveLayerCommand : public HistoryCommand {
+public:
+  RemoveLayerCommand(int index, std::unique_ptr<Layer> layer);
+  ~RemoveLayerCommand() override;
+
+  void undo(LayerManager &manager) override;
+  void redo(LayerManager &manager) override;
+  qint64 byteSize(QSet<qint64> &counted) const override;
+
+private:
+  int m_index;
+  std::unique_ptr<Layer> m_layer;
+};
+
+class MoveLayerCommand : public HistoryCommand {
+public:
+  MoveLayerCommand(int fromIndex, int toIndex);
+
+  void undo(LayerManager &manager) override;
+  void redo(LayerManager &manager) override;
+  qint64 byteSize(QSet<qint64> &counted) const override;
+
+private:
+  int m_fromIndex;
+  int m_toIndex;
+};
+
+// Linear undo/redo stack with a memory budget. When the budget is exceeded
+// the least recently used commands are compressed first, and only then are
+// the oldest commands dropped.
+class History : public QObject {
+  Q_OBJECT
+
+public:
+  static constexpr qint64 DefaultMemoryBudget = 512ll * 1024 * 1024;
+
+  explicit History(LayerManager *manager, QObject *parent = nullptr);
+  ~History();
+
+  void push(std::unique_ptr<HistoryCommand> command);
+
+  // Tile edits (strokes, fills) are collected between begin and end
+  void beginTileEdit(Layer *layer);
+  void captureTiles(const QRect &rect); // Call before painting into rect
+  void endTileEdit();
+
+  // Edits recorded on another thread (brush strokes): reserveEdit() when
+  // one starts, completeEdit() with its command, or nullptr if nothing
+  // changed, once it is done. Undo and redo requested meanwhile are
+  // applied, in order, once all reserved edits are in.
+  void reserveEdit();
+  void completeEdit(std::unique_ptr<HistoryCommand> command);
+
+  // False while undo/redo replays commands through LayerManager
+  bool isRecording() const { return !m_replaying; }
+
+  // Count edits still being recorded, which a deferred undo takes back
+  bool canUndo() const;
+  bool canRedo() const;
+
+  void setMemoryBudget(qint64 bytes);
+  qint64 memoryBudget() const { return m_memoryBudget; }
+  // Tile storage only the history holds, not shared with the layers
+  qint64 memoryUsage() const;
+
+public slots:
+  void undo();
+  void redo();
+  void clear();
+
+signals:
+  void canUndoChanged(bool canUndo);
+  void canRedoChanged(bool canRedo);
+
+private:
+  void touch(int index);
+  void enforceBudget();
+  void emitStateChanged();
+  bool editInProgress() const;
+  void applyDeferred();
+
+  LayerManager *m_manager;
+  std::vector<std::unique_ptr<HistoryCommand>> m_commands;
+  std::vector<quint64> m_lastUsed; // LRU tick per command
+  quint64 m_tick;
+  int m_index; // Commands [0, m_index) are applied
+  bool m_replaying;
+  qint64 m_memoryBudget;
+
+  Layer *m_editLayer;
+  std::unique_ptr<TileEditCommand> m_pendingEdit;
+  int m_reservedEdits;
+  std::vector<bool> m_deferred; // Undo (true) or redo, in request order
+};
+
+#endif // HISTORY_H
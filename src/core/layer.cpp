@@ -1,12 +1,14 @@
 #include "layer.h"
-#include <QPainter>
 
 Layer::Layer(const QString &name, int width, int height)
     : m_id(QUuid::createUuid().toString()), m_name(name), m_visible(true),
-      m_opacity(1.0), m_blendMode(Normal), m_isClippingMask(false) {
-  m_image = QImage(width, height, QImage::Format_ARGB32_Premultiplied);
-  m_image.fill(Qt::transparent);
-}
+      m_opacity(1.0), m_blendMode(Normal), m_isClippingMask(false),
+      m_tiles(width, height) {}
+
+Layer::Layer(const QString &name, const TiledImage &tiles)
+    : m_id(QUuid::createUuid().toString()), m_name(name), m_visible(true),
+      m_opacity(1.0), m_blendMode(Normal), m_isClippingMask(false),
+      m_tiles(tiles) {}
 
 QString Layer::id() const { return m_id; }
 
@@ -30,16 +32,18 @@ bool Layer::isClippingMask() const { return m_isClippingMask; }
 
 void Layer::setClippingMask(bool clipping) { m_isClippingMask = clipping; }
 
-QImage &Layer::image() { return m_image; }
+int Layer::width() const { return m_tiles.width(); }
+
+int Layer::height() const { return m_tiles.height(); }
+
+TiledImage &Layer::tiles() { return m_tiles; }
+
+const TiledImage &Layer::tiles() const { return m_tiles; }
 
-const QImage &Layer::image() const { return m_image; }
+void Layer::setImage(const QImage &image) { m_tiles.setImage(image); }
 
-void Layer::setImage(const QImage &image) { m_image = image; }
+QImage Layer::toImage() const { return m_tiles.toImage(); }
 
 void Layer::resize(int newWidth, int newHeight) {
-  QImage newImage(newWidth, newHeight, QImage::Format_ARGB32_Premultiplied);
-  newImage.fill(Qt::transparent);
-  QPainter painter(&newImage);
-  painter.drawImage(QPoint(0, 0), m_image);
-  m_image = newImage;
+  m_tiles.resize(newWidth, newHeight);
 }
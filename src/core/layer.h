@@ -1,6 +1,7 @@
 #ifndef LAYER_H
 #define LAYER_H
 
+#include "core/tiledimage.h"
 #include <QImage>
 #include <QObject>
 #include <QString>
@@ -11,6 +12,8 @@ public:
   enum BlendMode { Normal, Multiply, Screen, Overlay };
 
   Layer(const QString &name, int width, int height);
+  // Shares the given tiles copy-on-write; pixels are copied on first write
+  Layer(const QString &name, const TiledImage &tiles);
 
   QString id() const;
 
@@ -29,9 +32,15 @@ public:
   bool isClippingMask() const;
   void setClippingMask(bool clipping);
 
+  int width() const;
+  int height() const;
+
+  // Pixel storage; only tiles that have been painted are allocated
+  TiledImage &tiles();
+  const TiledImage &tiles() const;
+
   void setImage(const QImage &image);
-  QImage &image();
-  const QImage &image() const;
+  QImage toImage() const;
 
   void resize(int width, int height);
 
@@ -42,7 +51,7 @@ private:
   double m_opacity;
   BlendMode m_blendMode;
   bool m_isClippingMask;
-  QImage m_image;
+  TiledImage m_tiles;
 };
 
 #endif // LAYER_H
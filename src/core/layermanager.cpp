@@ -1,31 +1,105 @@
 #include "layermanager.h"
-#include <QPainter>
+#include "rendering/compositor.h"
+#include "core/tileswap.h"
+#include "rendering/parallelfor.h"
+
+#include <QReadLocker>
+#include <QSet>
+#include <QThreadPool>
+#include <QWriteLocker>
+#include <algorithm>
+
+static const QRgb BackgroundColor = qRgb(255, 255, 255);
+// How often tile use is sampled, and so how long a tile must go unused
+// before it can be paged out
+static const int SwapInterval = 2000; // ms
+// Paging stops once usage is this far below the budget, so one pass frees
+// a good chunk instead of a tile or two every time
+static const double SwapTarget = 0.75;
+// Tiles paged out per pass at most, so a pass stays short; a large excess
+// is worked off over several passes
+static const int MaxSwapPerPass = 256;
+static const qint64 FallbackBudget = 4ll * 1024 * 1024 * 1024;
+
+// Splits area along the tile grid, so no part crosses a tile boundary
+static std::vector<QRect> splitAlongTiles(const QRect &area) {
+  std::vector<QRect> parts;
+  int size = TiledImage::TileSize;
+  for (int ty = area.top() / size; ty <= area.bottom() / size; ++ty) {
+    for (int tx = area.left() / size; tx <= area.right() / size; ++tx)
+      parts.push_back(TiledImage::tileRect(tx, ty).intersected(area));
+  }
+  return parts;
+}
 
 LayerManager::LayerManager(QObject *parent)
-    : QObject(parent), m_currentLayerIndex(-1) {}
+    : QObject(parent), m_documentLock(QReadWriteLock::Recursive),
+      m_currentLayerIndex(-1), m_history(this), m_overBudget(false) {
+  // Missing cache tiles are filled in whenever the event loop is idle
+  m_cacheTimer.setInterval(0);
+  connect(&m_cacheTimer, &QTimer::timeout, this, &LayerManager::buildCaches);
+
+  m_memoryBudget = defaultMemoryBudget();
+  m_swapTimer.setInterval(SwapInterval);
+  connect(&m_swapTimer, &QTimer::timeout, this, &LayerManager::trimMemory);
+  m_swapTimer.start();
+}
 
 void LayerManager::addLayer(const QString &name, int width, int height) {
-  auto layer = std::make_unique<Layer>(name, width, height);
-  m_layers.push_back(std::move(layer));
-  m_currentLayerIndex = m_layers.size() - 1;
+  int index = m_layers.size();
+  insertLayer(index, std::make_unique<Layer>(name, width, height));
 
-  emit layerAdded(m_currentLayerIndex);
-  emit currentLayerChanged(m_currentLayerIndex);
-  emit canvasUpdateNeeded();
+  if (m_history.isRecording())
+    m_history.push(std::make_unique<InsertLayerCommand>(index));
 }
 
 void LayerManager::deleteLayer(int index) {
   if (index < 0 || index >= m_layers.size())
     return;
 
-  m_layers.erase(m_layers.begin() + index);
+  std::unique_ptr<Layer> layer = takeLayer(index);
+
+  if (m_history.isRecording())
+    m_history.push(
+        std::make_unique<RemoveLayerCommand>(index, std::move(layer)));
+}
+
+void LayerManager::insertLayer(int index, std::unique_ptr<Layer> layer) {
+  if (!layer || index < 0 || index > m_layers.size())
+    return;
+
+  {
+    QWriteLocker locker(&m_documentLock);
+    m_layers.insert(m_layers.begin() + index, std::move(layer));
+    m_currentLayerIndex = index;
+  }
+  resetCaches();
+
+  emit layerAdded(index);
+  emit currentLayerChanged(m_currentLayerIndex);
+  emit canvasUpdateNeeded();
+}
+
+std::unique_ptr<Layer> LayerManager::takeLayer(int index) {
+  if (index < 0 || index >= m_layers.size())
+    return nullptr;
+
+  std::unique_ptr<Layer> layer;
+  {
+    QWriteLocker locker(&m_documentLock);
+    layer = std::move(m_layers[index]);
+    m_layers.erase(m_layers.begin() + index);
 
-  if (m_currentLayerIndex >= m_layers.size())
-    m_currentLayerIndex = m_layers.size() - 1;
+    if (m_currentLayerIndex >= m_layers.size())
+      m_currentLayerIndex = m_layers.size() - 1;
+  }
+  resetCaches();
 
   emit layerRemoved(index);
   emit currentLayerChanged(m_currentLayerIndex);
   emit canvasUpdateNeeded();
+
+  return layer;
 }
 
 void LayerManager::duplicateLayer(int index) {
@@ -33,25 +107,25 @@ void LayerManager::duplicateLayer(int index) {
     return;
 
   Layer *source = m_layers[index].get();
-  auto newLayer =
-      std::make_unique<Layer>(source->name() + " copy", source->image().width(),
-                              source->image().height());
 
-  // Copy image content
-  QPainter painter(&newLayer->image());
-  painter.drawImage(0, 0, source->image());
+  // Share the source tiles; each side gets a private copy of a tile only
+  // when it is painted on
+  std::unique_ptr<Layer> newLayer;
+  {
+    QReadLocker locker(&m_documentLock);
+    newLayer =
+        std::make_unique<Layer>(source->name() + " copy", source->tiles());
+  }
 
   // Copy properties
   newLayer->setOpacity(source->opacity());
   newLayer->setBlendMode(source->blendMode());
   newLayer->setClippingMask(source->isClippingMask());
 
-  m_layers.insert(m_layers.begin() + index + 1, std::move(newLayer));
-  m_currentLayerIndex = index + 1;
+  insertLayer(index + 1, std::move(newLayer));
 
-  emit layerAdded(index + 1);
-  emit currentLayerChanged(m_currentLayerIndex);
-  emit canvasUpdateNeeded();
+  if (m_history.isRecording())
+    m_history.push(std::make_unique<InsertLayerCommand>(index + 1));
 }
 
 void LayerManager::moveLayer(int fromIndex, int toIndex) {
@@ -62,24 +136,31 @@ void LayerManager::moveLayer(int fromIndex, int toIndex) {
   if (fromIndex == toIndex)
     return;
 
-  auto layer = std::move(m_layers[fromIndex]);
-  m_layers.erase(m_layers.begin() + fromIndex);
-  m_layers.insert(m_layers.begin() + toIndex, std::move(layer));
-
-  // Update current index if needed
-  if (m_currentLayerIndex == fromIndex) {
-    m_currentLayerIndex = toIndex;
-  } else if (fromIndex < m_currentLayerIndex &&
-             toIndex >= m_currentLayerIndex) {
-    m_currentLayerIndex--;
-  } else if (fromIndex > m_currentLayerIndex &&
-             toIndex <= m_currentLayerIndex) {
-    m_currentLayerIndex++;
+  {
+    QWriteLocker locker(&m_documentLock);
+    auto layer = std::move(m_layers[fromIndex]);
+    m_layers.erase(m_layers.begin() + fromIndex);
+    m_layers.insert(m_layers.begin() + toIndex, std::move(layer));
+
+    // Update current index if needed
+    if (m_currentLayerIndex == fromIndex) {
+      m_currentLayerIndex = toIndex;
+    } else if (fromIndex < m_currentLayerIndex &&
+               toIndex >= m_currentLayerIndex) {
+      m_currentLayerIndex--;
+    } else if (fromIndex > m_currentLayerIndex &&
+               toIndex <= m_currentLayerIndex) {
+      m_currentLayerIndex++;
+    }
   }
+  resetCaches();
 
   emit layerMoved(fromIndex, toIndex);
   emit currentLayerChanged(m_currentLayerIndex);
   emit canvasUpdateNeeded();
+
+  if (m_history.isRecording())
+    m_history.push(std::make_unique<MoveLayerCommand>(fromIndex, toIndex));
 }
 
 int LayerManager::layerCount() const { return m_layers.size(); }
@@ -90,6 +171,14 @@ Layer *LayerManager::layerAt(int index) {
   return m_layers[index].get();
 }
 
+Layer *LayerManager::layerById(const QString &id) {
+  for (const auto &layer : m_layers) {
+    if (layer->id() == id)
+      return layer.get();
+  }
+  return nullptr;
+}
+
 int LayerManager::currentLayerIndex() const { return m_currentLayerIndex; }
 
 Layer *LayerManager::currentLayer() { return layerAt(m_currentLayerIndex); }
@@ -100,91 +189,425 @@ void LayerManager::setCurrentLayer(int index) {
 
   if (m_currentLayerIndex != index) {
     m_currentLayerIndex = index;
+    resetCaches();
     emit currentLayerChanged(m_currentLayerIndex);
   }
 }
 
+void LayerManager::invalidateRegion(const QRect &rect, const Layer *layer) {
+  if (rect.isEmpty())
+    return;
+
+  int index = -1;
+  for (int i = 0; layer && i < m_layers.size(); ++i) {
+    if (m_layers[i].get() == layer)
+      index = i;
+  }
+
+  // Pixels of the current layer are never part of a flattened cache
+  if (index < 0 || (index >= m_below.from && index < m_below.to))
+    invalidateCache(m_below, rect);
+  if (index < 0 || (index >= m_above.from && index < m_above.to))
+    invalidateCache(m_above, rect);
+
+  emit regionChanged(rect);
+  if (index >= 0) {
+    emit layerContentChanged(index);
+  } else {
+    for (int i = 0; i < m_layers.size(); ++i)
+      emit layerContentChanged(i);
+  }
+}
+
+void LayerManager::invalidateCaches() { resetCaches(); }
+
+qint64 LayerManager::defaultMemoryBudget() {
+  qint64 memory = TileSwap::physicalMemory();
+  return memory > 0 ? memory / 2 : FallbackBudget;
+}
+
+void LayerManager::setMemoryBudget(qint64 bytes) {
+  m_memoryBudget = qMax<qint64>(0, bytes);
+  trimMemory();
+}
+
 QImage LayerManager::composite(int width, int height) {
   QImage result(width, height, QImage::Format_ARGB32_Premultiplied);
-  result.fill(Qt::white); // Background color
+  QReadLocker locker(&m_documentLock);
+  render(result, result.rect());
+  return result;
+}
+
+void LayerManager::render(QImage &target, const QRect &rect) {
+  QRect area = rect.intersected(target.rect());
+  if (area.isEmpty())
+    return;
+
+  // Every part walks the layer stack on its own, so parts are composited
+  // in parallel
+  std::vector<QRect> parts = splitAlongTiles(area);
+  PixelBuffer buffer(target);
+  parallelFor(parts.size(), [&](int i) { renderPart(buffer, parts[i]); });
+}
+
+QColor LayerManager::sample(const QPoint &point, int radius) {
+  QReadLocker locker(&m_documentLock);
+  if (m_layers.empty() || !m_layers.front()->tiles().rect().contains(point))
+    return QColor();
+
+  // The flatten caches are left alone: building a cache tile would cost
+  // more than blending this little square through every layer
+  QRect area = QRect(point, point)
+                   .adjusted(-radius, -radius, radius, radius)
+                   .intersected(m_layers.front()->tiles().rect());
+  QImage pixels(area.size(), QImage::Format_ARGB32_Premultiplied);
+  renderLayers(m_layers, pixels, area.topLeft(), area);
+
+  // The background is opaque, so the composite is too
+  qint64 red = 0, green = 0, blue = 0;
+  for (int y = 0; y < pixels.height(); ++y) {
+    const QRgb *row = reinterpret_cast<const QRgb *>(pixels.constScanLine(y));
+    for (int x = 0; x < pixels.width(); ++x) {
+      red += qRed(row[x]);
+      green += qGreen(row[x]);
+      blue += qBlue(row[x]);
+    }
+  }
+  qint64 count = qint64(area.width()) * area.height();
+  return QColor(int((red + count / 2) / count),
+                int((green + count / 2) / count),
+                int((blue + count / 2) / count));
+}
+
+std::vector<std::unique_ptr<Layer>> LayerManager::snapshot() {
+  QReadLocker locker(&m_documentLock);
+  return copyLayers(m_layers);
+}
+
+std::vector<std::unique_ptr<Layer>>
+LayerManager::copyLayers(const std::vector<std::unique_ptr<Layer>> &layers) {
+  std::vector<std::unique_ptr<Layer>> copies;
+  for (const auto &layer : layers)
+    copies.push_back(std::make_unique<Layer>(*layer));
+  return copies;
+}
+
+void LayerManager::renderLayers(
+    const std::vector<std::unique_ptr<Layer>> &layers, QImage &target,
+    const QPoint &origin, const QRect &rect) {
+  QRect area = rect.intersected(QRect(origin, target.size()));
+  if (area.isEmpty())
+    return;
+
+  std::vector<QRect> parts = splitAlongTiles(area);
+  PixelBuffer buffer(target, origin);
+  parallelFor(parts.size(), [&](int i) {
+    Compositor::fill(buffer, parts[i], BackgroundColor);
+    blendLayers(layers, buffer, parts[i], 0, int(layers.size()));
+  });
+}
+
+QImage LayerManager::takeComposite(std::vector<std::unique_ptr<Layer>> &layers,
+                                   const QRect &rect) {
+  QImage result(rect.size(), QImage::Format_ARGB32_Premultiplied);
+  if (result.isNull())
+    return result;
+  renderLayers(layers, result, rect.topLeft(), rect);
+  for (auto &layer : layers)
+    layer->tiles().dropTiles(rect);
+  return result;
+}
 
-  QPainter painter(&result);
+void LayerManager::renderPart(const PixelBuffer &target,
+                              const QRect &rect) const {
+  // Parts never cross a tile boundary
+  int tx = rect.left() / TiledImage::TileSize;
+  int ty = rect.top() / TiledImage::TileSize;
+
+  // With both caches in place this is one copy and two blends, however
+  // many layers the document has
+  int aboveFrom = m_above.enabled ? m_above.from : int(m_layers.size());
+  if (m_below.enabled) {
+    if (!m_below.tiles.rect().contains(rect))
+      Compositor::fill(target, rect, BackgroundColor);
+    Compositor::copyTiles(target, rect, flattened(m_below, tx, ty));
+    blendLayers(m_layers, target, rect, m_below.to, aboveFrom);
+  } else {
+    Compositor::fill(target, rect, BackgroundColor);
+    blendLayers(m_layers, target, rect, 0, aboveFrom);
+  }
+
+  if (m_above.enabled) {
+    Compositor::blendTiles(target, rect, flattened(m_above, tx, ty),
+                           Layer::Normal, 1.0);
+  }
+}
 
-  for (int i = 0; i < m_layers.size(); ++i) {
-    Layer *layer = m_layers[i].get();
-    if (!layer->isVisible())
+void LayerManager::blendLayers(
+    const std::vector<std::unique_ptr<Layer>> &layers,
+    const PixelBuffer &target, const QRect &rect, int from, int to) {
+  // A clipping mask is limited to the alpha of the nearest regular layer
+  // below it (its base) and is hidden together with that base
+  const Layer *base = nullptr;
+  for (int i = from - 1; i >= 0 && !base; --i) {
+    if (!layers[i]->isClippingMask())
+      base = layers[i].get();
+  }
+
+  for (int i = from; i < to; ++i) {
+    const Layer *layer = layers[i].get();
+    bool clipped = layer->isClippingMask() && base;
+    if (!layer->isClippingMask())
+      base = layer;
+
+    if (!layer->isVisible() || (clipped && !base->isVisible()))
       continue;
 
-    // Handle clipping masks
-    if (layer->isClippingMask() && i > 0) {
-      // This is a simplified clipping mask implementation
-      // In a real engine, we'd need to composite this layer into a temporary
-      // buffer masked by the alpha of the layer below. For now, we'll just draw
-      // it normally but respecting opacity
+    if (clipped) {
+      // The base's opacity fades the whole clipping group
+      Compositor::blendTiles(target, rect, layer->tiles(), layer->blendMode(),
+                             layer->opacity() * base->opacity(),
+                             &base->tiles());
+    } else {
+      Compositor::blendTiles(target, rect, layer->tiles(), layer->blendMode(),
+                             layer->opacity());
+    }
+  }
+}
+
+const TiledImage &LayerManager::flattened(FlattenCache &cache, int tx,
+                                          int ty) const {
+  if (tx >= cache.tiles.tileColumns() || ty >= cache.tiles.tileRows())
+    return cache.tiles;
+
+  int index = ty * cache.tiles.tileColumns() + tx;
+  if (cache.valid[index])
+    return cache.tiles;
+
+  QRect tileRect = TiledImage::tileRect(tx, ty);
+  QRect area = tileRect.intersected(cache.tiles.rect());
+
+  QImage tile = TiledImage::createTile();
+  PixelBuffer buffer(tile, tileRect.topLeft());
+  if (cache.from == 0)
+    Compositor::fill(buffer, area, BackgroundColor);
+  blendLayers(m_layers, buffer, area, cache.from, cache.to);
+
+  cache.tiles.setTile(tx, ty,
+                      TiledImage::isTransparent(tile) ? QImage() : tile);
+  cache.valid[index] = 1;
+  return cache.tiles;
+}
+
+bool LayerManager::canFlattenAbove(int index) const {
+  // Source-over is associative, so layers above can be pre-blended onto
+  // transparency and laid over the rest later; the other modes depend on
+  // the pixels below them
+  for (int i = index + 1; i < m_layers.size(); ++i) {
+    const Layer *layer = m_layers[i].get();
+    if (layer->isVisible() && layer->blendMode() != Layer::Normal)
+      return false;
+  }
+
+  // Masks clipped to the current layer change whenever it is painted
+  return m_layers[index]->isClippingMask() ||
+         !m_layers[index + 1]->isClippingMask();
+}
+
+void LayerManager::resetCaches() {
+  m_below = FlattenCache();
+  m_above = FlattenCache();
+
+  int count = m_layers.size();
+  int current = m_currentLayerIndex;
+  if (current < 0 || current >= count) {
+    m_cacheTimer.stop();
+    return;
+  }
+
+  int width = m_layers[0]->width();
+  int height = m_layers[0]->height();
+  auto setup = [&](FlattenCache &cache, int from, int to) {
+    cache.enabled = true;
+    cache.from = from;
+    cache.to = to;
+    cache.tiles = TiledImage(width, height);
+    cache.valid.assign(cache.tiles.tileColumns() * cache.tiles.tileRows(), 0);
+  };
+
+  // A cache only pays off once it stands in for two or more layers
+  if (current >= 2)
+    setup(m_below, 0, current);
+  if (count - current - 1 >= 2 && canFlattenAbove(current))
+    setup(m_above, current + 1, count);
+
+  if (m_below.enabled || m_above.enabled)
+    m_cacheTimer.start();
+  else
+    m_cacheTimer.stop();
+}
+
+void LayerManager::invalidateCache(FlattenCache &cache, const QRect &rect) {
+  if (!cache.enabled)
+    return;
 
-      // TODO: Implement proper clipping mask logic using
-      // QPainter::CompositionMode_DestinationIn
+  QRect range = cache.tiles.tileRange(rect);
+  for (int ty = range.top(); ty <= range.bottom(); ++ty) {
+    for (int tx = range.left(); tx <= range.right(); ++tx) {
+      cache.valid[ty * cache.tiles.tileColumns() + tx] = 0;
+      cache.tiles.setTile(tx, ty, QImage());
     }
+  }
+  m_cacheTimer.start();
+}
 
-    painter.setOpacity(layer->opacity());
+void LayerManager::buildCaches() {
+  // Pre-building would only page other tiles out again
+  if (m_overBudget) {
+    m_cacheTimer.stop();
+    return;
+  }
 
-    // Set composition mode based on blend mode
-    switch (layer->blendMode()) {
-    case Layer::Multiply:
-      painter.setCompositionMode(QPainter::CompositionMode_Multiply);
-      break;
-    case Layer::Screen:
-      painter.setCompositionMode(QPainter::CompositionMode_Screen);
-      break;
-    case Layer::Overlay:
-      painter.setCompositionMode(QPainter::CompositionMode_Overlay);
-      break;
-    default:
-      painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-      break;
+  // Never wait for the stroke worker here; try again on the next pass
+  if (!m_documentLock.tryLockForRead())
+    return;
+
+  // Build a few tiles per pass so input events are never held up for long
+  int batch = QThreadPool::globalInstance()->maxThreadCount() * 2;
+  std::vector<std::pair<FlattenCache *, QPoint>> pending;
+  for (FlattenCache *cache : {&m_below, &m_above}) {
+    if (!cache->enabled)
+      continue;
+    int columns = cache->tiles.tileColumns();
+    for (int i = 0; i < cache->valid.size() && pending.size() < batch; ++i) {
+      if (!cache->valid[i])
+        pending.push_back({cache, QPoint(i % columns, i / columns)});
     }
+  }
 
-    painter.drawImage(0, 0, layer->image());
+  if (pending.empty()) {
+    m_documentLock.unlock();
+    m_cacheTimer.stop();
+    return;
   }
 
-  return result;
+  parallelFor(pending.size(), [&](int i) {
+    flattened(*pending[i].first, pending[i].second.x(),
+              pending[i].second.y());
+  });
+  m_documentLock.unlock();
 }
 
-void LayerManager::render(QPainter &painter, const QRect &rect) {
-  // Fill background for the rect
-  painter.setCompositionMode(QPainter::CompositionMode_Source);
-  painter.fillRect(rect, Qt::white); // Background color
+void LayerManager::trimMemory() {
+  TileSwap *swap = TileSwap::instance();
+  swap->advanceEpoch();
 
-  painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+  // Never wait for the stroke worker; if it is busy, try again on the
+  // next pass
+  if (!m_documentLock.tryLockForRead())
+    return;
 
-  for (int i = 0; i < m_layers.size(); ++i) {
-    Layer *layer = m_layers[i].get();
-    if (!layer->isVisible())
-      continue;
+  // Tiles shared between layers (duplicates, undo) cost their storage
+  // once and cannot be paged out on their own, so they count once
+  QSet<qint64> counted;
+  qint64 used = 0;
+  for (const auto &layer : m_layers)
+    used += layer->tiles().allocatedBytes(counted);
+  for (const FlattenCache *cache : {&m_below, &m_above})
+    used += cache->tiles.allocatedBytes(counted);
+
+  bool wasOverBudget = m_overBudget;
+  m_overBudget = used > m_memoryBudget;
+  if (!m_overBudget) {
+    m_documentLock.unlock();
+    if (wasOverBudget && (m_below.enabled || m_above.enabled))
+      m_cacheTimer.start();
+    return;
+  }
 
-    // Handle clipping masks (simplified)
-    if (layer->isClippingMask() && i > 0) {
-      // TODO: Implement proper clipping
+  // Candidates are tiles left alone for at least a full interval: hidden
+  // or inactive layers and regions that are neither shown nor painted.
+  // Cache tiles are dropped rather than paged out, they are rebuilt from
+  // the layers when needed again.
+  struct Candidate {
+    quint32 age;
+    TiledImage *tiles;
+    FlattenCache *cache;
+    int tx;
+    int ty;
+  };
+  std::vector<Candidate> candidates;
+  quint32 epoch = swap->epoch();
+  auto collect = [&](TiledImage &tiles, FlattenCache *cache) {
+    for (int ty = 0; ty < tiles.tileRows(); ++ty) {
+      for (int tx = 0; tx < tiles.tileColumns(); ++tx) {
+        quint32 age = epoch - tiles.lastUse(tx, ty);
+        if (age >= 2 && tiles.canSwapOut(tx, ty))
+          candidates.push_back({age, &tiles, cache, tx, ty});
+      }
     }
+  };
+  for (const auto &layer : m_layers)
+    collect(layer->tiles(), nullptr);
+  for (FlattenCache *cache : {&m_below, &m_above}) {
+    if (cache->enabled)
+      collect(cache->tiles, cache);
+  }
 
-    painter.setOpacity(layer->opacity());
-
-    // Set composition mode based on blend mode
-    switch (layer->blendMode()) {
-    case Layer::Multiply:
-      painter.setCompositionMode(QPainter::CompositionMode_Multiply);
-      break;
-    case Layer::Screen:
-      painter.setCompositionMode(QPainter::CompositionMode_Screen);
+  std::stable_sort(candidates.begin(), candidates.end(),
+                   [](const Candidate &a, const Candidate &b) {
+                     return a.age > b.age;
+                   });
+
+  struct Victim {
+    Candidate candidate;
+    quint32 lastUse;
+    QImage image; // Shared with the tile while it is being stored
+    std::shared_ptr<SwappedTile> swapped;
+  };
+  std::vector<Victim> victims;
+  qint64 target = qint64(m_memoryBudget * SwapTarget);
+  qint64 tileBytes = qint64(TiledImage::TileSize) * TiledImage::TileSize * 4;
+  for (const Candidate &candidate : candidates) {
+    if (used <= target || int(victims.size()) == MaxSwapPerPass)
       break;
-    case Layer::Overlay:
-      painter.setCompositionMode(QPainter::CompositionMode_Overlay);
-      break;
-    default:
-      painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-      break;
-    }
+    TiledImage &tiles = *candidate.tiles;
+    victims.push_back({candidate, tiles.lastUse(candidate.tx, candidate.ty),
+                       candidate.cache
+                           ? QImage()
+                           : tiles.peekTile(candidate.tx, candidate.ty),
+                       nullptr});
+    used -= tileBytes;
+  }
+  m_documentLock.unlock();
+
+  // Compression runs in parallel and without the lock, so strokes carry
+  // on meanwhile. Layers are only added or removed on this thread, so the
+  // tiles pointers stay valid.
+  parallelFor(victims.size(), [&](int i) {
+    Victim &victim = victims[i];
+    if (!victim.candidate.cache)
+      victim.swapped = swap->store(victim.image);
+  });
+
+  // Tiles used or changed meanwhile stay; their copies are dropped again
+  if (!m_documentLock.tryLockForWrite())
+    return;
+  for (Victim &victim : victims) {
+    const Candidate &candidate = victim.candidate;
+    if (candidate.tiles->lastUse(candidate.tx, candidate.ty) !=
+        victim.lastUse)
+      continue;
 
-    painter.drawImage(rect, layer->image(), rect);
+    if (candidate.cache) {
+      FlattenCache &cache = *candidate.cache;
+      cache.tiles.setTile(candidate.tx, candidate.ty, QImage());
+      cache.valid[candidate.ty * cache.tiles.tileColumns() + candidate.tx] =
+          0;
+    } else if (victim.swapped) { // Otherwise the scratch file is full
+      candidate.tiles->swapOut(candidate.tx, candidate.ty, victim.image,
+                               std::move(victim.swapped));
+    }
   }
+  m_documentLock.unlock();
 }
@@ -1,14 +1,19 @@
 #ifndef LAYERMANAGER_H
 #define LAYERMANAGER_H
 
+#include "core/history.h"
 #include "core/layer.h"
+#include <QColor>
 #include <QImage>
 #include <QObject>
-#include <QPainter>
+#include <QReadWriteLock>
 #include <QRect>
+#include <QTimer>
 #include <memory>
 #include <vector>
 
+class PixelBuffer;
+
 class LayerManager : public QObject {
   Q_OBJECT
 
@@ -20,27 +25,114 @@ public:
   void duplicateLayer(int index);
   void moveLayer(int fromIndex, int toIndex);
 
+  // Raw stack edits used by undo/redo; they are not recorded in history
+  void insertLayer(int index, std::unique_ptr<Layer> layer);
+  std::unique_ptr<Layer> takeLayer(int index);
+
   int layerCount() const;
   Layer *layerAt(int index);
+  Layer *layerById(const QString &id);
   int currentLayerIndex() const;
   Layer *currentLayer();
 
   void setCurrentLayer(int index);
 
+  History *history() { return &m_history; }
+
+  // Guards layer pixels and the stack against the stroke worker thread:
+  // writers of either take it for writing, GUI-thread readers for reading
+  QReadWriteLock *documentLock() { return &m_documentLock; }
+
+  // Notifies views that pixels of layer (nullptr: unknown) inside rect
+  // changed outside of Canvas
+  void invalidateRegion(const QRect &rect, const Layer *layer = nullptr);
+  // Drops the flattened layer caches, e.g. after layer properties changed
+  void invalidateCaches();
+
+  // Once layer and cache tiles take more than this, the least recently
+  // used ones are paged out to the scratch file (see TileSwap)
+  void setMemoryBudget(qint64 bytes);
+  qint64 memoryBudget() const { return m_memoryBudget; }
+  // Half of the RAM, which leaves room for history, the display and other
+  // apps
+  static qint64 defaultMemoryBudget();
+
   QImage composite(int width, int height);
-  void render(QPainter &painter, const QRect &rect);
+  // Re-blends rect of target (ARGB32_Premultiplied, canvas-sized). Unlike
+  // composite(), the caller holds documentLock() for reading.
+  void render(QImage &target, const QRect &rect);
+
+  // Flattened colour at point, averaged over the square of pixels within
+  // radius of it that lie on the canvas. Only the layer tiles under the
+  // square are blended, so the cost grows with the layer count, not the
+  // canvas size. Invalid if point is off the canvas.
+  QColor sample(const QPoint &point, int radius = 0);
+
+  // Copy-on-write copy of the layer stack. It can be rendered on another
+  // thread with renderLayers() while the document keeps changing.
+  std::vector<std::unique_ptr<Layer>> snapshot();
+  static std::vector<std::unique_ptr<Layer>>
+  copyLayers(const std::vector<std::unique_ptr<Layer>> &layers);
+  // Flattens rect of layers onto target, whose top-left pixel sits at
+  // origin. Goes without the flatten caches, so it only reads layers.
+  static void renderLayers(const std::vector<std::unique_ptr<Layer>> &layers,
+                           QImage &target, const QPoint &origin,
+                           const QRect &rect);
+  // rect of layers flattened into a new image; the tiles read are then
+  // dropped as by TiledImage::dropTiles()
+  static QImage takeComposite(std::vector<std::unique_ptr<Layer>> &layers,
+                              const QRect &rect);
 
 signals:
   void layerAdded(int index);
   void layerRemoved(int index);
   void layerMoved(int from, int to);
   void currentLayerChanged(int index);
-  void layerContentChanged(int index); // For thumbnail updates
+  // Pixels of the layer changed (see invalidateRegion()); for thumbnails
+  void layerContentChanged(int index);
   void canvasUpdateNeeded();
+  void regionChanged(const QRect &rect);
 
 private:
+  // Layers [from, to) blended into one image per tile. Tiles are built on
+  // first use or by the idle timer; each is only written by the render
+  // part covering it, so parts can fill the cache in parallel.
+  struct FlattenCache {
+    bool enabled = false;
+    int from = 0;
+    int to = 0;
+    TiledImage tiles;
+    std::vector<quint8> valid; // Per tile; absent tiles can be valid
+  };
+
+  void renderPart(const PixelBuffer &target, const QRect &rect) const;
+  static void blendLayers(const std::vector<std::unique_ptr<Layer>> &layers,
+                          const PixelBuffer &target, const QRect &rect,
+                          int from, int to);
+  const TiledImage &flattened(FlattenCache &cache, int tx, int ty) const;
+  bool canFlattenAbove(int index) const;
+  void resetCaches();
+  void invalidateCache(FlattenCache &cache, const QRect &rect);
+
+private slots:
+  void buildCaches();
+  void trimMemory();
+
+private:
+  QReadWriteLock m_documentLock;
   std::vector<std::unique_ptr<Layer>> m_layers; // 0 is bottom, size-1 is top
   int m_currentLayerIndex;
+  History m_history;
+
+  // While painting only the current layer changes, so the rest of the
+  // stack is kept flattened below and above it
+  mutable FlattenCache m_below;
+  mutable FlattenCache m_above;
+  QTimer m_cacheTimer;
+
+  qint64 m_memoryBudget;
+  bool m_overBudget; // Caches are then only built on demand
+  QTimer m_swapTimer;
 };
 
 #endif // LAYERMANAGER_H
@@ -0,0 +1,615 @@
+#include "selectionmask.h"
+#include "rendering/parallelfor.h"
+
+#include <QHash>
+#include <QPainter>
+#include <QPolygonF>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Alpha8 rows are 32-bit aligned, so a tile's bytes are contiguous
+static_assert(SelectionMask::TileSize % 4 == 0, "tile rows must be packed");
+static const int TileBytes = SelectionMask::TileSize * SelectionMask::TileSize;
+
+static inline int div255(int x) { return (x + (x >> 8) + 0x80) >> 8; }
+
+static QImage createTile(quint8 value) {
+  QImage tile(SelectionMask::TileSize, SelectionMask::TileSize,
+              QImage::Format_Alpha8);
+  std::memset(tile.bits(), value, TileBytes);
+  return tile;
+}
+
+// Shared by every fully selected tile
+static const QImage &solidTile() {
+  static const QImage tile = createTile(255);
+  return tile;
+}
+
+static bool isSolid(const QImage &tile) {
+  return !tile.isNull() && tile.constBits() == solidTile().constBits();
+}
+
+// Null if area (tile coordinates) of tile is all 0, the solid tile if it
+// is all 255, otherwise tile itself
+static QImage normalized(const QImage &tile, const QRect &area) {
+  bool empty = true;
+  bool full = true;
+  for (int y = area.top(); y <= area.bottom() && (empty || full); ++y) {
+    const quint8 *row = tile.constScanLine(y);
+    for (int x = area.left(); x <= area.right(); ++x) {
+      empty &= row[x] == 0;
+      full &= row[x] == 255;
+    }
+  }
+  if (empty)
+    return QImage();
+  return full ? solidTile() : tile;
+}
+
+static QImage combineTiles(const QImage &a, const QImage &b,
+                           SelectionMask::Operation operation,
+                           const QRect &area) {
+  // Absent and solid tiles settle most cases without touching pixels
+  switch (operation) {
+  case SelectionMask::Replace:
+    return b;
+  case SelectionMask::Add:
+    if (b.isNull() || isSolid(a))
+      return a;
+    if (a.isNull() || isSolid(b))
+      return b;
+    break;
+  case SelectionMask::Subtract:
+    if (a.isNull() || b.isNull())
+      return a;
+    if (isSolid(b))
+      return QImage();
+    break;
+  case SelectionMask::Intersect:
+    if (a.isNull() || b.isNull())
+      return QImage();
+    if (isSolid(b))
+      return a;
+    if (isSolid(a))
+      return b;
+    break;
+  }
+
+  QImage result(SelectionMask::TileSize, SelectionMask::TileSize,
+                QImage::Format_Alpha8);
+  const quint8 *first = a.constBits();
+  const quint8 *second = b.constBits();
+  quint8 *out = result.bits();
+  if (operation == SelectionMask::Add) {
+    for (int i = 0; i < TileBytes; ++i)
+      out[i] = qMax(first[i], second[i]);
+  } else if (operation == SelectionMask::Subtract) {
+    for (int i = 0; i < TileBytes; ++i)
+      out[i] = quint8(div255(first[i] * (255 - second[i])));
+  } else {
+    for (int i = 0; i < TileBytes; ++i)
+      out[i] = quint8(div255(first[i] * second[i]));
+  }
+  return normalized(result, area);
+}
+
+// One box blur of radius over count values, repeating the end values
+static void boxBlur(const quint8 *in, quint8 *out, int count, int radius) {
+  int window = 2 * radius + 1;
+  int sum = 0;
+  for (int i = -radius; i <= radius; ++i)
+    sum += in[qBound(0, i, count - 1)];
+  for (int i = 0; i < count; ++i) {
+    out[i] = quint8((sum + window / 2) / window);
+    sum += in[qMin(i + radius + 1, count - 1)] - in[qMax(i - radius, 0)];
+  }
+}
+
+// Blurs count values stride bytes apart with each of the box radii
+static void blurLine(quint8 *data, int count, int stride,
+                     const std::vector<int> &radii) {
+  std::vector<quint8> line(count);
+  std::vector<quint8> blurred(count);
+  for (int i = 0; i < count; ++i)
+    line[i] = data[size_t(i) * stride];
+  for (int radius : radii) {
+    boxBlur(line.data(), blurred.data(), count, radius);
+    line.swap(blurred);
+  }
+  for (int i = 0; i < count; ++i)
+    data[size_t(i) * stride] = line[i];
+}
+
+// Key of the grid edge leaving corner (x, y) to the right or downwards;
+// corners run from -1 to the mask size
+static inline quint64 edgeKey(int x, int y, bool vertical) {
+  return (quint64(quint32(y + 1)) << 33) | (quint64(quint32(x + 1)) << 1) |
+         quint64(vertical);
+}
+
+// Contour piece crossing one marching squares cell. It starts on the edge
+// where the cell boundary, walked clockwise, leaves the selection, and
+// ends on the one where it enters it, so pieces chain into closed loops.
+struct ContourSegment {
+  quint64 from;
+  quint64 to;
+  QPointF point; // Where the contour crosses the from edge
+};
+
+static inline bool collinear(const QPointF &a, const QPointF &b,
+                             const QPointF &c) {
+  QPointF u = b - a;
+  QPointF v = c - b;
+  return qAbs(u.x() * v.y() - u.y() * v.x()) < 1e-9;
+}
+
+SelectionMask::SelectionMask()
+    : m_width(0), m_height(0), m_columns(0), m_rows(0), m_fill(0) {}
+
+SelectionMask::SelectionMask(int width, int height)
+    : m_width(0), m_height(0), m_columns(0), m_rows(0), m_fill(0) {
+  reset(QSize(width, height));
+}
+
+void SelectionMask::reset(const QSize &size) {
+  m_width = qMax(0, size.width());
+  m_height = qMax(0, size.height());
+  m_columns = (m_width + TileSize - 1) / TileSize;
+  m_rows = (m_height + TileSize - 1) / TileSize;
+  clear();
+}
+
+QRect SelectionMask::tileRange(const QRect &rect) const {
+  QRect area = rect.intersected(this->rect());
+  if (area.isEmpty())
+    return QRect();
+
+  return QRect(QPoint(area.left() / TileSize, area.top() / TileSize),
+               QPoint(area.right() / TileSize, area.bottom() / TileSize));
+}
+
+QRect SelectionMask::tileArea(int tx, int ty) const {
+  QRect tileRect = TiledImage::tileRect(tx, ty);
+  return tileRect.intersected(rect()).translated(-tileRect.topLeft());
+}
+
+quint8 SelectionMask::value(int x, int y) const {
+  if (x < 0 || x >= m_width || y < 0 || y >= m_height)
+    return 0;
+  if (m_tiles.empty())
+    return m_fill;
+  const QImage &tile = m_tiles[index(x / TileSize, y / TileSize)];
+  return tile.isNull() ? 0 : tile.constScanLine(y % TileSize)[x % TileSize];
+}
+
+void SelectionMask::span(int x, int y, int count, quint8 *out) const {
+  std::memset(out, 0, count);
+  if (y < 0 || y >= m_height)
+    return;
+
+  int left = qMax(x, 0);
+  int right = qMin(x + count, m_width);
+  if (m_tiles.empty()) {
+    if (left < right)
+      std::memset(out + (left - x), m_fill, right - left);
+    return;
+  }
+
+  // One copy per tile the row passes through
+  while (left < right) {
+    int tileLeft = left - left % TileSize;
+    int end = qMin(right, tileLeft + TileSize);
+    const QImage &tile = m_tiles[index(left / TileSize, y / TileSize)];
+    if (!tile.isNull()) {
+      const quint8 *row = tile.constScanLine(y % TileSize);
+      std::memcpy(out + (left - x), row + (left - tileLeft), end - left);
+    }
+    left = end;
+  }
+}
+
+const QImage &SelectionMask::tile(int tx, int ty) const {
+  static const QImage nullTile;
+  if (tx < 0 || tx >= m_columns || ty < 0 || ty >= m_rows)
+    return nullTile;
+  if (m_tiles.empty())
+    return m_fill ? solidTile() : nullTile;
+  return m_tiles[index(tx, ty)];
+}
+
+bool SelectionMask::isSolid(int tx, int ty) const {
+  return ::isSolid(tile(tx, ty));
+}
+
+void SelectionMask::clear() {
+  m_tiles.clear();
+  m_fill = 0;
+  m_bounds = QRect();
+}
+
+void SelectionMask::selectAll() {
+  m_tiles.clear();
+  m_fill = 255;
+  m_bounds = rect();
+}
+
+void SelectionMask::invert() {
+  if (m_tiles.empty()) {
+    m_fill = 255 - m_fill;
+    m_bounds = m_fill ? rect() : QRect();
+    return;
+  }
+
+  parallelFor(int(m_tiles.size()), [&](int i) {
+    QImage &tile = m_tiles[i];
+    if (tile.isNull()) {
+      tile = solidTile();
+    } else if (::isSolid(tile)) {
+      tile = QImage();
+    } else {
+      QImage inverted(TileSize, TileSize, QImage::Format_Alpha8);
+      const quint8 *in = tile.constBits();
+      quint8 *out = inverted.bits();
+      for (int j = 0; j < TileBytes; ++j)
+        out[j] = 255 - in[j];
+      tile = inverted;
+    }
+  });
+  updateBounds();
+}
+
+void SelectionMask::expand() {
+  if (!m_tiles.empty())
+    return;
+  m_tiles.assign(size_t(m_columns) * m_rows,
+                 m_fill ? solidTile() : QImage());
+  m_fill = 0;
+}
+
+void SelectionMask::combine(const QPainterPath &shape, Operation operation) {
+  SelectionMask mask(m_width, m_height);
+  mask.expand();
+  // Antialiasing reaches into the pixels around the outline
+  QRect bounds = shape.controlPointRect().toAlignedRect();
+  QRect range = tileRange(bounds.adjusted(-1, -1, 1, 1));
+  if (!range.isEmpty()) {
+    // Tiles are rasterized in parallel, each from its own copy of the path
+    int columns = range.width();
+    parallelFor(columns * range.height(), [&](int i) {
+      int tx = range.left() + i % columns;
+      int ty = range.top() + i / columns;
+      QRect area = tileArea(tx, ty);
+      QPainterPath local =
+          shape.translated(-TiledImage::tileRect(tx, ty).topLeft());
+      if (!local.intersects(QRectF(area)))
+        return;
+      if (local.contains(QRectF(area))) {
+        mask.m_tiles[index(tx, ty)] = solidTile();
+        return;
+      }
+
+      QImage canvas(TileSize, TileSize, QImage::Format_ARGB32_Premultiplied);
+      canvas.fill(Qt::transparent);
+      QPainter painter(&canvas);
+      painter.setRenderHint(QPainter::Antialiasing);
+      painter.fillPath(local, Qt::black);
+      painter.end();
+      // Alpha8 keeps the alpha channel, i.e. the coverage
+      mask.m_tiles[index(tx, ty)] =
+          normalized(canvas.convertToFormat(QImage::Format_Alpha8), area);
+    });
+  }
+  mask.updateBounds();
+  combine(mask, operation);
+}
+
+void SelectionMask::combine(const QRect &rect, Operation operation) {
+  SelectionMask mask(m_width, m_height);
+  mask.expand();
+  QRect area = rect.intersected(this->rect());
+  QRect range = tileRange(area);
+  for (int ty = range.top(); ty <= range.bottom(); ++ty) {
+    for (int tx = range.left(); tx <= range.right(); ++tx) {
+      QRect tileRect = TiledImage::tileRect(tx, ty);
+      QRect part = tileRect.intersected(area).translated(-tileRect.topLeft());
+      if (part == tileArea(tx, ty)) {
+        mask.m_tiles[index(tx, ty)] = solidTile();
+        continue;
+      }
+
+      QImage tile = createTile(0);
+      for (int y = part.top(); y <= part.bottom(); ++y)
+        std::memset(tile.scanLine(y) + part.left(), 255, part.width());
+      mask.m_tiles[index(tx, ty)] = tile;
+    }
+  }
+  mask.m_bounds = area;
+  combine(mask, operation);
+}
+
+void SelectionMask::combine(const SelectionMask &other, Operation operation) {
+  Q_ASSERT(other.size() == size());
+  if (operation == Replace) {
+    m_tiles = other.m_tiles;
+    m_fill = other.m_fill;
+    m_bounds = other.m_bounds;
+    return;
+  }
+
+  // Adding only changes tiles the other mask covers; the other operations
+  // only change tiles this one covers
+  QRect range = tileRange(operation == Add ? other.m_bounds : m_bounds);
+  if (range.isEmpty())
+    return;
+
+  expand();
+  int columns = range.width();
+  parallelFor(columns * range.height(), [&](int i) {
+    int tx = range.left() + i % columns;
+    int ty = range.top() + i / columns;
+    QImage &tile = m_tiles[index(tx, ty)];
+    tile = combineTiles(tile, other.tile(tx, ty), operation,
+                        tileArea(tx, ty));
+  });
+  updateBounds();
+}
+
+QPainterPath SelectionMask::outline() const {
+  QPainterPath path;
+  if (isEmpty())
+    return path;
+  if (m_tiles.empty()) {
+    path.addRect(QRectF(rect()));
+    return path;
+  }
+
+  // Cell (x, y) has the centres of pixels x..x+1, y..y+1 as corners. The
+  // cells are split into tile-sized blocks, block (bx, by) starting at
+  // cell (bx * TileSize - 1, by * TileSize - 1) so that its corners lie
+  // in tiles bx - 1..bx, by - 1..by.
+  QRect cells = m_bounds.adjusted(-1, -1, 0, 0);
+  auto state = [&](int tx, int ty) {
+    if (tx < 0 || tx >= m_columns || ty < 0 || ty >= m_rows)
+      return 0;
+    const QImage &tile = m_tiles[index(tx, ty)];
+    return tile.isNull() ? 0 : (::isSolid(tile) ? 1 : 2);
+  };
+  std::vector<QRect> blocks;
+  for (int by = (cells.top() + 1) / TileSize;
+       by <= (cells.bottom() + 1) / TileSize; ++by) {
+    for (int bx = (cells.left() + 1) / TileSize;
+         bx <= (cells.right() + 1) / TileSize; ++bx) {
+      QRect block(bx * TileSize - 1, by * TileSize - 1, TileSize, TileSize);
+      // A block inside one unselected or fully selected area has no edge.
+      // Pixels off the mask count as unselected.
+      bool outside = block.left() < 0 || block.top() < 0 ||
+                     block.right() + 1 >= m_width ||
+                     block.bottom() + 1 >= m_height;
+      int states[] = {state(bx - 1, by - 1), state(bx, by - 1),
+                      state(bx - 1, by), state(bx, by)};
+      bool empty = true;
+      bool full = !outside;
+      for (int value : states) {
+        empty &= value == 0;
+        full &= value == 1;
+      }
+      if (!empty && !full)
+        blocks.push_back(block.intersected(cells));
+    }
+  }
+
+  std::vector<std::vector<ContourSegment>> segments(blocks.size());
+  parallelFor(int(blocks.size()), [&](int i) {
+    const QRect &block = blocks[i];
+    int count = block.width() + 1;
+    std::vector<quint8> upper(count);
+    std::vector<quint8> lower(count);
+    span(block.left(), block.top(), count, upper.data());
+    for (int y = block.top(); y <= block.bottom(); ++y) {
+      span(block.left(), y + 1, count, lower.data());
+      for (int j = 0; j < block.width(); ++j) {
+        // Corners clockwise from the top left; edge k joins corner k to
+        // corner k + 1
+        int x = block.left() + j;
+        const int values[] = {upper[j], upper[j + 1], lower[j + 1],
+                              lower[j]};
+        int inside = 0;
+        for (int value : values)
+          inside += value >= 128;
+        if (inside == 0 || inside == 4)
+          continue;
+
+        const QPointF corners[] = {
+            QPointF(x + 0.5, y + 0.5), QPointF(x + 1.5, y + 0.5),
+            QPointF(x + 1.5, y + 1.5), QPointF(x + 0.5, y + 1.5)};
+        const quint64 edges[] = {edgeKey(x, y, false),
+                                 edgeKey(x + 1, y, true),
+                                 edgeKey(x, y + 1, false),
+                                 edgeKey(x, y, true)};
+        int exits[2];
+        int enters[2];
+        QPointF points[4];
+        int crossings = 0;
+        for (int k = 0; k < 4; ++k) {
+          int a = values[k];
+          int b = values[(k + 1) % 4];
+          if ((a >= 128) == (b >= 128))
+            continue;
+          double t = (127.5 - a) / (b - a);
+          points[k] = corners[k] + (corners[(k + 1) % 4] - corners[k]) * t;
+          if (a >= 128)
+            exits[crossings / 2] = k;
+          else
+            enters[crossings / 2] = k;
+          ++crossings;
+        }
+
+        // A saddle pairs each exit with the next entry clockwise when the
+        // centre is selected, cutting off the unselected corners, and with
+        // the previous one otherwise
+        int pairs = crossings / 2;
+        if (pairs == 2) {
+          int centre = values[0] + values[1] + values[2] + values[3];
+          bool next = centre >= 4 * 128;
+          if ((enters[0] == (exits[0] + 1) % 4) != next)
+            std::swap(enters[0], enters[1]);
+        }
+        for (int k = 0; k < pairs; ++k) {
+          segments[i].push_back(
+              {edges[exits[k]], edges[enters[k]], points[exits[k]]});
+        }
+      }
+      upper.swap(lower);
+    }
+  });
+
+  QHash<quint64, ContourSegment> links;
+  for (const std::vector<ContourSegment> &list : segments) {
+    for (const ContourSegment &segment : list)
+      links.insert(segment.from, segment);
+  }
+
+  // Follow each loop, merging runs of collinear points
+  while (!links.isEmpty()) {
+    QPolygonF polygon;
+    quint64 key = links.constBegin().key();
+    for (auto it = links.find(key); it != links.end();
+         it = links.find(key)) {
+      QPointF point = it->point;
+      key = it->to;
+      links.erase(it);
+
+      int size = polygon.size();
+      if (size >= 2 && collinear(polygon[size - 2], polygon[size - 1], point))
+        polygon.removeLast();
+      polygon << point;
+    }
+    int size = polygon.size();
+    if (size >= 3 &&
+        collinear(polygon[size - 2], polygon[size - 1], polygon[0]))
+      polygon.removeLast();
+    path.addPolygon(polygon);
+    path.closeSubpath();
+  }
+  return path;
+}
+
+void SelectionMask::feather(double radius) {
+  // A uniform mask has no edge to soften
+  if (m_tiles.empty() || isEmpty() || radius <= 0.0)
+    return;
+
+  // Widths of three box blurs whose sum approximates a Gaussian with a
+  // standard deviation of radius / 2
+  double sigma = radius / 2.0;
+  double ideal = std::sqrt(4.0 * sigma * sigma + 1.0);
+  int lower = int(std::floor(ideal));
+  if (lower % 2 == 0)
+    --lower;
+  int smaller = qRound((12.0 * sigma * sigma - 3 * lower * lower -
+                        12 * lower - 9) /
+                       (-4.0 * lower - 4.0));
+  std::vector<int> radii;
+  int reach = 0;
+  for (int i = 0; i < 3; ++i) {
+    radii.push_back(((i < smaller ? lower : lower + 2) - 1) / 2);
+    reach += radii.back();
+  }
+  if (reach == 0)
+    return;
+
+  // The blur spreads the selection by reach pixels. Repeating the values
+  // at the canvas border keeps a selection that touches it solid there.
+  QRect area = m_bounds.adjusted(-reach, -reach, reach, reach)
+                   .intersected(rect());
+  int width = area.width();
+  int height = area.height();
+  std::vector<quint8> pixels(size_t(width) * height);
+  parallelFor(height, [&](int y) {
+    span(area.left(), area.top() + y, width,
+         pixels.data() + size_t(y) * width);
+  });
+  parallelFor(height, [&](int y) {
+    blurLine(pixels.data() + size_t(y) * width, width, 1, radii);
+  });
+  parallelFor(width, [&](int x) {
+    blurLine(pixels.data() + x, height, width, radii);
+  });
+
+  QRect range = tileRange(area);
+  int columns = range.width();
+  parallelFor(columns * range.height(), [&](int i) {
+    int tx = range.left() + i % columns;
+    int ty = range.top() + i / columns;
+    QRect tileRect = TiledImage::tileRect(tx, ty);
+    QRect part = tileRect.intersected(area);
+
+    // Everything selected lies inside area, so the rest stays 0
+    QImage tile = createTile(0);
+    for (int y = part.top(); y <= part.bottom(); ++y) {
+      const quint8 *source = pixels.data() +
+                             size_t(y - area.top()) * width +
+                             (part.left() - area.left());
+      std::memcpy(tile.scanLine(y - tileRect.top()) +
+                      (part.left() - tileRect.left()),
+                  source, part.width());
+    }
+    m_tiles[index(tx, ty)] = normalized(tile, tileArea(tx, ty));
+  });
+  updateBounds();
+}
+
+void SelectionMask::updateBounds() {
+  if (m_tiles.empty()) {
+    m_bounds = m_fill ? rect() : QRect();
+    return;
+  }
+
+  // Each tile contributes the rect of its non-zero pixels
+  std::vector<QRect> rects(m_tiles.size());
+  parallelFor(int(m_tiles.size()), [&](int i) {
+    const QImage &tile = m_tiles[i];
+    if (tile.isNull())
+      return;
+
+    int tx = i % m_columns;
+    int ty = i / m_columns;
+    QRect area = tileArea(tx, ty);
+    QPoint origin = TiledImage::tileRect(tx, ty).topLeft();
+    if (::isSolid(tile)) {
+      rects[i] = area.translated(origin);
+      return;
+    }
+
+    int left = area.right() + 1;
+    int right = area.left() - 1;
+    int top = -1;
+    int bottom = -1;
+    for (int y = area.top(); y <= area.bottom(); ++y) {
+      const quint8 *row = tile.constScanLine(y);
+      int first = area.left();
+      while (first <= area.right() && row[first] == 0)
+        ++first;
+      if (first > area.right())
+        continue;
+      int last = area.right();
+      while (row[last] == 0)
+        --last;
+
+      left = qMin(left, first);
+      right = qMax(right, last);
+      if (top < 0)
+        top = y;
+      bottom = y;
+    }
+    if (top >= 0)
+      rects[i] = QRect(QPoint(left, top), QPoint(right, bottom))
+                     .translated(origin);
+  });
+
+  m_bounds = QRect();
+  for (const QRect &rect : rects)
+    m_bounds |= rect;
+}
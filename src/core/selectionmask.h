@@ -0,0 +1,95 @@
+#ifndef SELECTIONMASK_H
+#define SELECTIONMASK_H
+
+#include "core/tiledimage.h"
+#include <QImage>
+#include <QPainterPath>
+#include <QPoint>
+#include <QRect>
+#include <QSize>
+#include <vector>
+
+// Antialiased selection: one coverage byte per pixel, 0 outside and 255
+// fully selected. The mask is split into the same tiles as a TiledImage so
+// the two can be walked side by side. Tiles outside the selection are
+// absent and tiles wholly inside share one solid tile, so a selection
+// costs memory and time only along its edge. Tiles are implicitly shared
+// Alpha8 QImages, which makes copies (e.g. for the stroke worker) cheap.
+//
+// An empty mask means nothing is selected; the tools then work on the
+// whole layer. Selecting everything or nothing drops the tiles and only
+// records the coverage they all share, so neither touches pixels.
+class SelectionMask {
+public:
+  static constexpr int TileSize = TiledImage::TileSize;
+
+  enum Operation { Replace, Add, Subtract, Intersect };
+
+  SelectionMask();
+  SelectionMask(int width, int height);
+
+  // Resizes to size with nothing selected
+  void reset(const QSize &size);
+
+  QSize size() const { return QSize(m_width, m_height); }
+  QRect rect() const { return QRect(0, 0, m_width, m_height); }
+
+  bool isEmpty() const { return m_bounds.isEmpty(); }
+  // Smallest rect holding every pixel with non-zero coverage
+  QRect bounds() const { return m_bounds; }
+
+  quint8 value(int x, int y) const;
+  bool contains(const QPoint &point) const {
+    return value(point.x(), point.y()) > 0;
+  }
+  // Copies the coverage of count pixels of row y, starting at x, to out.
+  // Pixels outside the mask read as 0.
+  void span(int x, int y, int count, quint8 *out) const;
+
+  // Alpha8 coverage of a tile; null if none of it is selected
+  const QImage &tile(int tx, int ty) const;
+  // Whether every pixel of the tile is fully selected
+  bool isSolid(int tx, int ty) const;
+
+  // Selects nothing / everything in constant time
+  void clear();
+  void selectAll();
+  // Swaps selected and unselected coverage. Only partly selected tiles
+  // are rewritten; after clear() or selectAll() it is constant time.
+  void invert();
+  // Combines the antialiased shape (canvas coordinates) with the mask
+  void combine(const QPainterPath &shape, Operation operation);
+  void combine(const QRect &rect, Operation operation);
+  // other must have the same size
+  void combine(const SelectionMask &other, Operation operation);
+
+  // Closed contours where the coverage crosses 50%, found by marching
+  // squares over the pixel centres. Contours go clockwise around selected
+  // areas and counter-clockwise around holes. Only tiles along the edge
+  // are visited.
+  QPainterPath outline() const;
+
+  // Softens the edge with a Gaussian blur (three box blurs), so it fades
+  // over about radius pixels to either side. The canvas border does not
+  // count as an edge.
+  void feather(double radius);
+
+private:
+  int index(int tx, int ty) const { return ty * m_columns + tx; }
+  QRect tileRange(const QRect &rect) const;
+  // Part of the tile inside the mask, in tile coordinates
+  QRect tileArea(int tx, int ty) const;
+  // Gives every tile its own entry again after clear() or selectAll()
+  void expand();
+  void updateBounds();
+
+  int m_width;
+  int m_height;
+  int m_columns;
+  int m_rows;
+  std::vector<QImage> m_tiles; // Row-major; null where nothing is selected
+  quint8 m_fill; // Coverage of every pixel while m_tiles is empty
+  QRect m_bounds;
+};
+
+#endif // SELECTIONMASK_H
@@ -0,0 +1,96 @@
+#include "strokeinput.h"
+
+#include <QtMath>
+#include <cmath>
+
+// Smoothed moves shorter than this (in pixels) are not painted
+static const double MinStep = 0.25;
+// Samples from the last PredictionWindow ms give the pen velocity, which
+// is extrapolated PredictionTime ms ahead (about one frame at 60 Hz)
+static const qint64 PredictionWindow = 24;
+static const double PredictionTime = 16.0;
+static const double MaxPredictionLength = 64.0;
+
+StrokeInput::StrokeInput()
+    : m_active(false), m_stabilizer(0), m_predictionEnabled(true) {}
+
+void StrokeInput::setStabilizer(int strength) {
+  m_stabilizer = qBound(0, strength, 100);
+}
+
+InputSample StrokeInput::begin(const InputSample &sample) {
+  m_active = true;
+  m_raw = sample;
+  m_smoothed = sample;
+  m_recent.clear();
+  m_recent.push_back(sample);
+  return sample;
+}
+
+bool StrokeInput::add(const InputSample &sample, InputSample &smoothed) {
+  if (!m_active)
+    return false;
+
+  m_raw = sample;
+
+  // Exponential smoothing with a time constant of m_stabilizer ms; the
+  // pen's own timestamps are used, so batches of coalesced samples
+  // delivered together are weighted by when they were taken
+  InputSample next = sample;
+  if (m_stabilizer > 0) {
+    double dt = qMax(0.5, double(sample.time - m_smoothed.time));
+    double k = 1.0 - std::exp(-dt / m_stabilizer);
+    next.position =
+        m_smoothed.position + (sample.position - m_smoothed.position) * k;
+    next.pressure =
+        m_smoothed.pressure + (sample.pressure - m_smoothed.pressure) * k;
+  }
+  m_smoothed = next;
+
+  const InputSample &painted = m_recent.back();
+  if (QLineF(painted.position, next.position).length() < MinStep &&
+      qAbs(painted.pressure - next.pressure) < 0.01)
+    return false;
+
+  m_recent.push_back(next);
+  while (m_recent.size() > 2 &&
+         m_recent.front().time < next.time - PredictionWindow)
+    m_recent.pop_front();
+
+  smoothed = next;
+  return true;
+}
+
+bool StrokeInput::end(InputSample &last) {
+  if (!m_active)
+    return false;
+
+  m_active = false;
+  const InputSample painted = m_recent.back();
+  m_recent.clear();
+
+  // The stabilizer trails the pen; catch up with where it was lifted
+  if (painted.position == m_raw.position)
+    return false;
+  last = m_raw;
+  return true;
+}
+
+QLineF StrokeInput::predictedSegment() const {
+  if (!m_active || !m_predictionEnabled || m_recent.size() < 2)
+    return QLineF();
+
+  const InputSample &first = m_recent.front();
+  const InputSample &last = m_recent.back();
+  qint64 dt = last.time - first.time;
+  if (dt <= 0)
+    return QLineF();
+
+  QPointF velocity = (last.position - first.position) / double(dt);
+  QLineF segment(last.position, last.position + velocity * PredictionTime);
+  if (segment.length() < 1.0)
+    return QLineF();
+  if (segment.length() > MaxPredictionLength)
+    segment.setLength(MaxPredictionLength);
+  return segment;
+}
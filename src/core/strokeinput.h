@@ -0,0 +1,56 @@
+#ifndef STROKEINPUT_H
+#define STROKEINPUT_H
+
+#include <QLineF>
+#include <QPointF>
+#include <QtGlobal>
+#include <deque>
+
+// One pen or mouse position as delivered by Qt
+struct InputSample {
+  QPointF position; // Canvas coordinates
+  double pressure = 1.0;
+  qint64 time = 0; // Event timestamp in milliseconds
+};
+
+// Turns raw pointer samples into the path that gets painted. A stabilizer
+// smooths position and pressure over time (not per event, so it behaves
+// the same at 60 Hz and 240 Hz), and the last few samples are
+// extrapolated into a short predicted segment that the canvas draws
+// until real samples replace it.
+class StrokeInput {
+public:
+  StrokeInput();
+
+  // 0 (off) to 100; the smoothing time constant in milliseconds
+  void setStabilizer(int strength);
+  int stabilizer() const { return m_stabilizer; }
+
+  void setPredictionEnabled(bool enabled) { m_predictionEnabled = enabled; }
+  bool isPredictionEnabled() const { return m_predictionEnabled; }
+
+  // Starts a stroke; returns the first point to paint
+  InputSample begin(const InputSample &sample);
+  // Returns false when the sample does not move the smoothed path
+  bool add(const InputSample &sample, InputSample &smoothed);
+  // Ends the stroke; returns false if the path already reached the last
+  // raw sample, otherwise sets last to it so the stroke ends under the pen
+  bool end(InputSample &last);
+
+  bool isActive() const { return m_active; }
+
+  // Display-only extension of the path beyond the last smoothed sample;
+  // null while there is not enough motion to extrapolate
+  QLineF predictedSegment() const;
+  double predictedPressure() const { return m_smoothed.pressure; }
+
+private:
+  bool m_active;
+  int m_stabilizer;
+  bool m_predictionEnabled;
+  InputSample m_raw;      // Latest raw sample
+  InputSample m_smoothed; // Latest painted sample
+  std::deque<InputSample> m_recent; // Painted samples used for prediction
+};
+
+#endif // STROKEINPUT_H
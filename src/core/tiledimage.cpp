@@ -0,0 +1,368 @@
+#include "tiledimage.h"
+#include "core/tileswap.h"
+#include "rendering/parallelfor.h"
+
+#include <QRegion>
+#include <QSet>
+#include <cstring>
+
+std::atomic<quint64> TiledImage::s_revision(0);
+
+TiledImage::TiledImage() : m_width(0), m_height(0), m_columns(0), m_rows(0) {}
+
+TiledImage::TiledImage(int width, int height)
+    : m_width(0), m_height(0), m_columns(0), m_rows(0) {
+  resize(width, height);
+}
+
+QRect TiledImage::tileRect(int tx, int ty) {
+  return QRect(tx * TileSize, ty * TileSize, TileSize, TileSize);
+}
+
+QRect TiledImage::tileRange(const QRect &rect) const {
+  QRect area = rect.intersected(this->rect());
+  if (area.isEmpty())
+    return QRect();
+
+  return QRect(QPoint(area.left() / TileSize, area.top() / TileSize),
+               QPoint(area.right() / TileSize, area.bottom() / TileSize));
+}
+
+bool TiledImage::hasTile(int tx, int ty) const {
+  if (tx < 0 || tx >= m_columns || ty < 0 || ty >= m_rows)
+    return false;
+  const Tile &slot = m_tiles[index(tx, ty)];
+  return !slot.image.isNull() || slot.paged;
+}
+
+const QImage &TiledImage::tile(int tx, int ty) const {
+  static const QImage nullTile;
+  if (tx < 0 || tx >= m_columns || ty < 0 || ty >= m_rows)
+    return nullTile;
+  return resident(m_tiles[index(tx, ty)]);
+}
+
+QImage &TiledImage::tileForWrite(int tx, int ty) {
+  Tile &slot = m_tiles[index(tx, ty)];
+  slot.revision = nextRevision();
+  QImage &target = resident(slot);
+  if (target.isNull())
+    target = createTile();
+  else if (!target.isDetached())
+    target.detach(); // Tile is shared with a duplicate or snapshot
+  return target;
+}
+
+void TiledImage::setTile(int tx, int ty, const QImage &tile) {
+  if (tx < 0 || tx >= m_columns || ty < 0 || ty >= m_rows)
+    return;
+  Tile &slot = m_tiles[index(tx, ty)];
+  slot.image = tile;
+  slot.paged.reset();
+  slot.lastUse = TileSwap::instance()->epoch();
+  slot.revision = nextRevision();
+}
+
+void TiledImage::setPagedTile(int tx, int ty, std::shared_ptr<PagedTile> tile) {
+  if (tx < 0 || tx >= m_columns || ty < 0 || ty >= m_rows)
+    return;
+  Tile &slot = m_tiles[index(tx, ty)];
+  slot.image = QImage();
+  slot.paged = std::move(tile);
+}
+
+QImage TiledImage::peekTile(int tx, int ty) const {
+  if (tx < 0 || tx >= m_columns || ty < 0 || ty >= m_rows)
+    return QImage();
+  const Tile &slot = m_tiles[index(tx, ty)];
+  return slot.paged ? slot.paged->load() : slot.image;
+}
+
+int TiledImage::allocatedTileCount() const {
+  int count = 0;
+  for (const Tile &tile : m_tiles) {
+    if (!tile.image.isNull() || tile.paged)
+      ++count;
+  }
+  return count;
+}
+
+QRect TiledImage::allocatedRect() const {
+  QRect bounds;
+  for (int ty = 0; ty < m_rows; ++ty) {
+    for (int tx = 0; tx < m_columns; ++tx) {
+      if (hasTile(tx, ty))
+        bounds |= tileRect(tx, ty);
+    }
+  }
+  return bounds.intersected(rect());
+}
+
+qint64 TiledImage::allocatedBytes() const {
+  QSet<qint64> counted;
+  return allocatedBytes(counted);
+}
+
+qint64 TiledImage::allocatedBytes(QSet<qint64> &counted) const {
+  // Shared tiles (e.g. after fill()) only cost their storage once
+  qint64 bytes = 0;
+  for (const Tile &tile : m_tiles) {
+    if (tile.image.isNull() || counted.contains(tile.image.cacheKey()))
+      continue;
+    counted.insert(tile.image.cacheKey());
+    bytes += tile.image.sizeInBytes();
+  }
+  return bytes;
+}
+
+quint32 TiledImage::lastUse(int tx, int ty) const {
+  return m_tiles[index(tx, ty)].lastUse;
+}
+
+quint64 TiledImage::revision(int tx, int ty) const {
+  return m_tiles[index(tx, ty)].revision;
+}
+
+bool TiledImage::isPagedOut(int tx, int ty) const {
+  return bool(m_tiles[index(tx, ty)].paged);
+}
+
+std::shared_ptr<PagedTile> TiledImage::pagedTile(int tx, int ty) const {
+  return m_tiles[index(tx, ty)].paged;
+}
+
+bool TiledImage::canSwapOut(int tx, int ty) const {
+  const QImage &image = m_tiles[index(tx, ty)].image;
+  return !image.isNull() && image.isDetached();
+}
+
+bool TiledImage::swapOut(int tx, int ty) {
+  Tile &slot = m_tiles[index(tx, ty)];
+  if (slot.image.isNull())
+    return slot.paged != nullptr;
+
+  std::shared_ptr<SwappedTile> swapped =
+      TileSwap::instance()->store(slot.image);
+  if (!swapped)
+    return false;
+  slot.image = QImage();
+  slot.paged = std::move(swapped);
+  return true;
+}
+
+bool TiledImage::swapOut(int tx, int ty, const QImage &stored,
+                         std::shared_ptr<PagedTile> swapped) {
+  // Any write detaches the tile from stored and so changes its key
+  Tile &slot = m_tiles[index(tx, ty)];
+  if (slot.image.isNull() || slot.image.cacheKey() != stored.cacheKey())
+    return false;
+  slot.image = QImage();
+  slot.paged = std::move(swapped);
+  return true;
+}
+
+QImage &TiledImage::resident(Tile &tile) {
+  if (tile.paged) {
+    tile.image = tile.paged->load();
+    tile.paged.reset();
+  }
+  tile.lastUse = TileSwap::instance()->epoch();
+  return tile.image;
+}
+
+void TiledImage::paint(const QRect &rect,
+                       const std::function<void(QPainter &)> &fn) {
+  QRect range = tileRange(rect);
+  for (int ty = range.top(); ty <= range.bottom(); ++ty) {
+    for (int tx = range.left(); tx <= range.right(); ++tx) {
+      bool created = !hasTile(tx, ty);
+      QImage &target = tileForWrite(tx, ty);
+      {
+        QPainter painter(&target);
+        painter.translate(-tx * TileSize, -ty * TileSize);
+        fn(painter);
+      }
+      if (created && isTransparent(target))
+        target = QImage();
+    }
+  }
+}
+
+void TiledImage::fill(const QColor &color) {
+  if (color.alpha() == 0) {
+    clear();
+    return;
+  }
+
+  // One shared tile backs the whole image until something paints on it
+  QImage solid = createTile();
+  solid.fill(color);
+  for (Tile &tile : m_tiles) {
+    tile = Tile();
+    tile.image = solid;
+    tile.revision = nextRevision();
+  }
+}
+
+void TiledImage::clear() {
+  for (Tile &tile : m_tiles) {
+    if (tile.image.isNull() && !tile.paged)
+      continue;
+    tile = Tile();
+    tile.revision = nextRevision();
+  }
+}
+
+QRgb TiledImage::pixel(int x, int y) const {
+  if (x < 0 || x >= m_width || y < 0 || y >= m_height)
+    return 0;
+
+  const QImage &source = tile(x / TileSize, y / TileSize);
+  if (source.isNull())
+    return 0;
+
+  const QRgb *line =
+      reinterpret_cast<const QRgb *>(source.constScanLine(y % TileSize));
+  return line[x % TileSize];
+}
+
+void TiledImage::setImage(const QImage &image) {
+  QImage source = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+  m_tiles.clear();
+  m_width = m_height = m_columns = m_rows = 0;
+  resize(source.width(), source.height());
+
+  for (int ty = 0; ty < m_rows; ++ty) {
+    for (int tx = 0; tx < m_columns; ++tx) {
+      // copy() pads the parts beyond the source bounds with transparency
+      Tile &slot = m_tiles[index(tx, ty)];
+      QImage tile = source.copy(tileRect(tx, ty));
+      if (!isTransparent(tile))
+        slot.image = tile;
+      slot.revision = nextRevision();
+    }
+  }
+}
+
+void TiledImage::placeImage(const QImage &image, const QPoint &position) {
+  QRect area = QRect(position, image.size()).intersected(rect());
+  if (area.isEmpty())
+    return;
+
+  // Every call writes its own tile slot
+  QRect range = tileRange(area);
+  parallelFor(range.width() * range.height(), [&](int i) {
+    int tx = range.left() + i % range.width();
+    int ty = range.top() + i / range.width();
+    // copy() pads the parts beyond the image with transparency
+    QImage tile = image.copy(tileRect(tx, ty).translated(-position));
+    setTile(tx, ty, isTransparent(tile) ? QImage() : tile);
+  });
+}
+
+QImage TiledImage::toImage() const { return toImage(rect()); }
+
+QImage TiledImage::toImage(const QRect &rect) const {
+  QImage result(rect.size(), QImage::Format_ARGB32_Premultiplied);
+  result.fill(Qt::transparent);
+
+  QRect area = rect.intersected(this->rect());
+  QRect range = tileRange(area);
+  for (int ty = range.top(); ty <= range.bottom(); ++ty) {
+    for (int tx = range.left(); tx <= range.right(); ++tx) {
+      const QImage &source = tile(tx, ty);
+      if (source.isNull())
+        continue;
+
+      QRect part = tileRect(tx, ty).intersected(area);
+      int sourceX = part.left() - tx * TileSize;
+      int destX = part.left() - rect.left();
+      for (int y = part.top(); y <= part.bottom(); ++y) {
+        const QRgb *src = reinterpret_cast<const QRgb *>(
+                              source.constScanLine(y - ty * TileSize)) +
+                          sourceX;
+        QRgb *dst =
+            reinterpret_cast<QRgb *>(result.scanLine(y - rect.top())) + destX;
+        std::memcpy(dst, src, part.width() * sizeof(QRgb));
+      }
+    }
+  }
+
+  return result;
+}
+
+void TiledImage::dropTiles(const QRect &rect) {
+  QRect range = tileRange(rect);
+  for (int ty = range.top(); ty <= range.bottom(); ++ty) {
+    for (int tx = range.left(); tx <= range.right(); ++tx) {
+      if (rect.contains(tileRect(tx, ty).intersected(this->rect())))
+        setTile(tx, ty, QImage());
+    }
+  }
+}
+
+QImage TiledImage::takeImage(const QRect &rect) {
+  QImage result = toImage(rect);
+  dropTiles(rect);
+  return result;
+}
+
+void TiledImage::resize(int width, int height) {
+  width = qMax(0, width);
+  height = qMax(0, height);
+
+  int columns = (width + TileSize - 1) / TileSize;
+  int rows = (height + TileSize - 1) / TileSize;
+
+  std::vector<Tile> tiles(columns * rows);
+  for (int ty = 0; ty < qMin(rows, m_rows); ++ty) {
+    for (int tx = 0; tx < qMin(columns, m_columns); ++tx) {
+      Tile tile = m_tiles[index(tx, ty)];
+      if (tile.image.isNull() && !tile.paged)
+        continue;
+
+      // Edge tiles may hold pixels outside the old bounds; keep the newly
+      // exposed area transparent when growing
+      QRect oldBounds = tileRect(tx, ty).intersected(rect());
+      if (oldBounds != tileRect(tx, ty) &&
+          (width > m_width || height > m_height)) {
+        QPainter painter(&resident(tile));
+        painter.setCompositionMode(QPainter::CompositionMode_Clear);
+        QRegion outside =
+            QRegion(tileRect(tx, ty)).subtracted(QRegion(oldBounds));
+        painter.translate(-tx * TileSize, -ty * TileSize);
+        for (const QRect &r : outside)
+          painter.fillRect(r, Qt::transparent);
+      }
+
+      tiles[ty * columns + tx] = tile;
+    }
+  }
+
+  m_tiles.swap(tiles);
+  m_width = width;
+  m_height = height;
+  m_columns = columns;
+  m_rows = rows;
+}
+
+QImage TiledImage::createTile() {
+  QImage tile(TileSize, TileSize, QImage::Format_ARGB32_Premultiplied);
+  tile.fill(Qt::transparent);
+  return tile;
+}
+
+bool TiledImage::isTransparent(const QImage &tile) {
+  if (tile.isNull())
+    return true;
+
+  for (int y = 0; y < tile.height(); ++y) {
+    const QRgb *line = reinterpret_cast<const QRgb *>(tile.constScanLine(y));
+    for (int x = 0; x < tile.width(); ++x) {
+      if (line[x] != 0)
+        return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,138 @@
+#ifndef TILEDIMAGE_H
+#define TILEDIMAGE_H
+
+#include <QColor>
+#include <QImage>
+#include <QPainter>
+#include <QRect>
+#include <QSet>
+#include <QSize>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Pixels of a tile that are kept outside of memory, e.g. in the swap file
+// (TileSwap) or a document on disk (AriaFile). Copies of a TiledImage
+// share the handle. load() may be called from several threads at once.
+class PagedTile {
+public:
+  virtual ~PagedTile() {}
+  virtual QImage load() const = 0;
+};
+
+// Sparse ARGB32_Premultiplied pixel store split into fixed-size tiles.
+// Tiles are only allocated once something is drawn into them; an absent
+// tile reads as fully transparent. Tiles are implicitly shared QImages, so
+// copying a TiledImage is cheap and pixels are duplicated lazily on write.
+// Tiles can be paged out (see PagedTile); any access pages them back in
+// transparently.
+class TiledImage {
+public:
+  static constexpr int TileSize = 256;
+
+  TiledImage();
+  TiledImage(int width, int height);
+
+  int width() const { return m_width; }
+  int height() const { return m_height; }
+  QSize size() const { return QSize(m_width, m_height); }
+  QRect rect() const { return QRect(0, 0, m_width, m_height); }
+
+  int tileColumns() const { return m_columns; }
+  int tileRows() const { return m_rows; }
+
+  // Canvas-space rect covered by a tile (not clipped to the image bounds)
+  static QRect tileRect(int tx, int ty);
+  // Tile range (inclusive) touched by a canvas-space rect
+  QRect tileRange(const QRect &rect) const;
+
+  bool hasTile(int tx, int ty) const;
+  const QImage &tile(int tx, int ty) const; // Null image if absent
+  QImage &tileForWrite(int tx, int ty); // Allocates or un-shares on demand
+  void setTile(int tx, int ty, const QImage &tile); // Null removes the tile
+  // Installs a tile that is only loaded when first used
+  void setPagedTile(int tx, int ty, std::shared_ptr<PagedTile> tile);
+  // Like tile(), but a paged-out tile is loaded into the returned copy
+  // only and stays paged out
+  QImage peekTile(int tx, int ty) const;
+
+  int allocatedTileCount() const; // Including paged-out tiles
+  // Union of the allocated tiles, clipped to the image
+  QRect allocatedRect() const;
+  qint64 allocatedBytes() const;   // Tiles in memory only
+  // Leaves out tiles already in counted, e.g. shared with another image
+  // counted before, and adds the others to it
+  qint64 allocatedBytes(QSet<qint64> &counted) const;
+
+  // Epoch (see TileSwap) in which the tile was last read or written
+  quint32 lastUse(int tx, int ty) const;
+  // Every change to a tile stamps it with the next value of a global
+  // counter, so "changed since" is one comparison with an earlier
+  // currentRevision(). Paging a tile in or out is not a change.
+  quint64 revision(int tx, int ty) const;
+  static quint64 currentRevision() { return s_revision.load(); }
+  bool isPagedOut(int tx, int ty) const;
+  std::shared_ptr<PagedTile> pagedTile(int tx, int ty) const;
+  // Whether the tile is in memory and not shared with another image or a
+  // snapshot, so paging it out actually frees its pixels
+  bool canSwapOut(int tx, int ty) const;
+  bool swapOut(int tx, int ty);
+  // Pages the tile out to swapped, a copy of stored that was made without
+  // holding the document lock, unless the tile no longer is stored
+  bool swapOut(int tx, int ty, const QImage &stored,
+               std::shared_ptr<PagedTile> swapped);
+
+  // Runs fn once per tile intersecting rect with a painter translated to
+  // canvas coordinates. Tiles created for the call that stay transparent
+  // are dropped again.
+  void paint(const QRect &rect, const std::function<void(QPainter &)> &fn);
+
+  void fill(const QColor &color);
+  void clear();
+
+  QRgb pixel(int x, int y) const;
+
+  void setImage(const QImage &image);
+  // Splits image (ARGB32_Premultiplied) with its top-left at position
+  // into the tiles it covers, in parallel. Those tiles are replaced as a
+  // whole, so this is meant for filling an empty image.
+  void placeImage(const QImage &image, const QPoint &position);
+  QImage toImage() const;
+  QImage toImage(const QRect &rect) const;
+  // Removes the tiles lying wholly inside rect, so a copy can be consumed
+  // band by band without paging everything in. Calls with rects that
+  // share no tile can run in parallel.
+  void dropTiles(const QRect &rect);
+  // toImage() followed by dropTiles()
+  QImage takeImage(const QRect &rect);
+
+  void resize(int width, int height);
+
+  static QImage createTile();
+  static bool isTransparent(const QImage &tile);
+
+private:
+  struct Tile {
+    QImage image;                     // Null while absent or paged out
+    std::shared_ptr<PagedTile> paged; // Set while paged out
+    quint32 lastUse = 0;
+    quint64 revision = 0;
+  };
+
+  int index(int tx, int ty) const { return ty * m_columns + tx; }
+  // Pages the tile in if needed and stamps it as used. Parallel readers
+  // only ever touch disjoint tiles, so this needs no lock of its own.
+  static QImage &resident(Tile &tile);
+  static quint64 nextRevision() { return ++s_revision; }
+
+  int m_width;
+  int m_height;
+  int m_columns;
+  int m_rows;
+  mutable std::vector<Tile> m_tiles; // Row-major
+
+  static std::atomic<quint64> s_revision;
+};
+
+#endif // TILEDIMAGE_H
@@ -0,0 +1,160 @@
+#include "tileswap.h"
+#include "utils/compression/lz4block.h"
+
+#include <QDir>
+#include <QMutexLocker>
+#include <cstring>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+static const qint64 PageSize = 4096;
+// The file grows and is mapped in windows of this size
+static const qint64 SegmentSize = 64ll * 1024 * 1024;
+static const int TileBytes = TiledImage::TileSize * TiledImage::TileSize * 4;
+
+SwappedTile::~SwappedTile() { TileSwap::instance()->release(m_block); }
+
+QImage SwappedTile::load() const { return TileSwap::instance()->load(*this); }
+
+TileSwap::TileSwap()
+    : m_file(QDir::tempPath() + "/aria-swap-XXXXXX"), m_end(0),
+      m_storedBytes(0), m_epoch(0) {}
+
+TileSwap *TileSwap::instance() {
+  // Never destroyed: handles may outlive any static owner. Worker threads
+  // can get here first, so the initialisation must be thread-safe.
+  static TileSwap *instance = new TileSwap();
+  return instance;
+}
+
+std::shared_ptr<SwappedTile> TileSwap::store(const QImage &tile) {
+  Q_ASSERT(tile.format() == QImage::Format_ARGB32_Premultiplied);
+  Q_ASSERT(tile.sizeInBytes() == TileBytes);
+
+  // Compress before taking the lock; flat tiles shrink to almost nothing
+  QByteArray packed(TileBytes, Qt::Uninitialized);
+  const char *bits = reinterpret_cast<const char *>(tile.constBits());
+  int size = lz4Compress(bits, TileBytes, packed.data(), TileBytes);
+  bool compressed = size > 0;
+  const char *source = compressed ? packed.constData() : bits;
+  if (!compressed)
+    size = TileBytes;
+
+  QMutexLocker locker(&m_mutex);
+  Block block;
+  block.pages = int((size + PageSize - 1) / PageSize);
+  block.size = size;
+  block.compressed = compressed;
+  if (!allocate(block.pages, block.offset))
+    return nullptr;
+  std::memcpy(address(block.offset), source, size);
+  m_storedBytes += size;
+
+  int index;
+  if (!m_freeBlocks.empty()) {
+    index = m_freeBlocks.back();
+    m_freeBlocks.pop_back();
+    m_blocks[index] = block;
+  } else {
+    index = int(m_blocks.size());
+    m_blocks.push_back(block);
+  }
+  return std::make_shared<SwappedTile>(index);
+}
+
+QImage TileSwap::load(const SwappedTile &tile) {
+  Block block;
+  const char *source;
+  {
+    // Mapped segments stay put; only the bookkeeping needs the lock
+    QMutexLocker locker(&m_mutex);
+    block = m_blocks[tile.block()];
+    source = reinterpret_cast<const char *>(address(block.offset));
+  }
+
+  QImage result = TiledImage::createTile();
+  char *dest = reinterpret_cast<char *>(result.bits());
+  if (!block.compressed) {
+    std::memcpy(dest, source, TileBytes);
+  } else if (!lz4Decompress(source, block.size, dest, TileBytes)) {
+    result.fill(Qt::transparent); // Corrupt; better empty than garbage
+  }
+  return result;
+}
+
+qint64 TileSwap::storedBytes() const {
+  QMutexLocker locker(&m_mutex);
+  return m_storedBytes;
+}
+
+qint64 TileSwap::physicalMemory() {
+#ifdef Q_OS_WIN
+  MEMORYSTATUSEX status;
+  status.dwLength = sizeof(status);
+  if (GlobalMemoryStatusEx(&status))
+    return qint64(status.ullTotalPhys);
+  return 0;
+#else
+  long pages = sysconf(_SC_PHYS_PAGES);
+  long pageSize = sysconf(_SC_PAGESIZE);
+  if (pages <= 0 || pageSize <= 0)
+    return 0;
+  return qint64(pages) * pageSize;
+#endif
+}
+
+bool TileSwap::allocate(int pages, qint64 &offset) {
+  // Smallest free run that fits; the rest of it goes back on its list
+  auto it = m_free.lower_bound(pages);
+  if (it != m_free.end()) {
+    offset = it->second.back();
+    int spare = it->first - pages;
+    it->second.pop_back();
+    if (it->second.empty())
+      m_free.erase(it);
+    if (spare > 0)
+      m_free[spare].push_back(offset + pages * PageSize);
+    return true;
+  }
+
+  qint64 bytes = pages * PageSize;
+  qint64 segmentEnd = qint64(m_segments.size()) * SegmentSize;
+  if (m_segments.empty() || m_end + bytes > segmentEnd) {
+    if (!m_file.isOpen() && !m_file.open())
+      return false;
+
+    // Blocks never straddle segments; recycle the unused tail
+    if (!m_segments.empty() && m_end < segmentEnd)
+      m_free[int((segmentEnd - m_end) / PageSize)].push_back(m_end);
+
+    uchar *segment = nullptr;
+    if (m_file.resize(segmentEnd + SegmentSize))
+      segment = m_file.map(segmentEnd, SegmentSize);
+    if (!segment) {
+      m_end = segmentEnd; // Out of disk space
+      return false;
+    }
+    m_segments.push_back(segment);
+    m_end = segmentEnd;
+  }
+
+  offset = m_end;
+  m_end += bytes;
+  return true;
+}
+
+void TileSwap::release(int index) {
+  QMutexLocker locker(&m_mutex);
+  const Block &block = m_blocks[index];
+  m_free[block.pages].push_back(block.offset);
+  m_storedBytes -= block.size;
+  m_freeBlocks.push_back(index);
+}
+
+uchar *TileSwap::address(qint64 offset) const {
+  return m_segments[offset / SegmentSize] + offset % SegmentSize;
+}
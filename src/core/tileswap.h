@@ -0,0 +1,82 @@
+#ifndef TILESWAP_H
+#define TILESWAP_H
+
+#include "core/tiledimage.h"
+#include <QImage>
+#include <QMutex>
+#include <QTemporaryFile>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <vector>
+
+// Tile paged out to the scratch file; the space is released with the
+// last handle
+class SwappedTile : public PagedTile {
+public:
+  explicit SwappedTile(int block) : m_block(block) {}
+  ~SwappedTile();
+
+  int block() const { return m_block; }
+  QImage load() const override;
+
+private:
+  Q_DISABLE_COPY(SwappedTile)
+
+  int m_block;
+};
+
+// Scratch store for tiles evicted from memory. Tiles are LZ4-compressed
+// (or kept raw when that does not pay off) into a temporary file that is
+// mapped in large segments, so paging a tile in or out is a memcpy plus
+// the codec and the OS decides when the pages actually hit the disk.
+// Space is handed out in 4 KB pages and recycled through free lists.
+// Thread-safe: tiles are paged in by parallel compositing.
+class TileSwap {
+public:
+  static TileSwap *instance();
+
+  // Copies a TileSize x TileSize tile into the scratch file. Returns null
+  // if the file cannot grow, in which case the tile stays in memory.
+  std::shared_ptr<SwappedTile> store(const QImage &tile);
+  // Reads a stored tile back; the handle stays valid
+  QImage load(const SwappedTile &tile);
+
+  // Coarse clock for tile recency. Tiles stamp the current epoch whenever
+  // they are used; the eviction policy advances it on every pass.
+  quint32 epoch() const { return m_epoch.load(std::memory_order_relaxed); }
+  void advanceEpoch() { m_epoch.fetch_add(1, std::memory_order_relaxed); }
+
+  qint64 storedBytes() const; // Compressed bytes currently in use
+
+  // Installed RAM, or 0 if it cannot be determined
+  static qint64 physicalMemory();
+
+private:
+  friend class SwappedTile;
+
+  struct Block {
+    qint64 offset = 0;
+    int pages = 0;
+    int size = 0; // Stored bytes
+    bool compressed = false;
+  };
+
+  TileSwap();
+
+  bool allocate(int pages, qint64 &offset);
+  void release(int block);
+  uchar *address(qint64 offset) const;
+
+  mutable QMutex m_mutex;
+  QTemporaryFile m_file;
+  std::vector<uchar *> m_segments; // Mapped windows of the file, in order
+  qint64 m_end;                    // Allocation front in the last segment
+  std::map<int, std::vector<qint64>> m_free; // Page count -> offsets
+  std::vector<Block> m_blocks;
+  std::vector<int> m_freeBlocks; // Reusable m_blocks indices
+  qint64 m_storedBytes;
+  std::atomic<quint32> m_epoch;
+};
+
+#endif // TILESWAP_H
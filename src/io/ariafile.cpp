@@ -0,0 +1,192 @@
+#include "ariafile.h"
+#include "chunkfile.h"
+#include "core/layermanager.h"
+#include "rendering/parallelfor.h"
+
+#include <QDataStream>
+#include <QFileInfo>
+#include <QReadLocker>
+#include <QSaveFile>
+#include <QThreadPool>
+
+static const quint32 Magic = chunkType("ARIA");
+static const quint32 HeadChunk = chunkType("HEAD");
+static const quint32 LayerChunk = chunkType("LAYR");
+static const quint32 TileChunk = chunkType("TILE");
+static const quint32 EndChunk = chunkType("END ");
+
+bool AriaFile::write(const QString &fileName, LayerManager &manager,
+                     QString *error, quint64 *revision) {
+#ifdef Q_OS_WIN
+  // Windows cannot replace a file that is still open, so tiles that were
+  // never loaded from the file being overwritten are loaded now
+  {
+    QReadLocker locker(manager.documentLock());
+    QFileInfo target(fileName);
+    for (int i = 0; i < manager.layerCount(); ++i) {
+      const TiledImage &tiles = manager.layerAt(i)->tiles();
+      for (int ty = 0; ty < tiles.tileRows(); ++ty) {
+        for (int tx = 0; tx < tiles.tileColumns(); ++tx) {
+          std::shared_ptr<PagedTile> paged = tiles.pagedTile(tx, ty);
+          auto *tile = dynamic_cast<const ChunkTile *>(paged.get());
+          if (tile && QFileInfo(tile->source()->file().fileName()) == target)
+            tiles.tile(tx, ty);
+        }
+      }
+    }
+  }
+#endif
+
+  QSaveFile file(fileName);
+  if (!file.open(QIODevice::WriteOnly)) {
+    if (error)
+      *error = file.errorString();
+    return false;
+  }
+
+  QDataStream stream(&file);
+  setupStream(stream);
+  stream << Magic << Version;
+
+  // The stroke worker waits until the document is on disk
+  QReadLocker locker(manager.documentLock());
+  quint64 written = TiledImage::currentRevision();
+
+  QByteArray head;
+  {
+    QDataStream payload(&head, QIODevice::WriteOnly);
+    setupStream(payload);
+    Layer *base = manager.layerAt(0);
+    payload << qint32(base ? base->width() : 0)
+            << qint32(base ? base->height() : 0)
+            << qint32(manager.currentLayerIndex());
+  }
+  writeChunk(stream, HeadChunk, head);
+
+  for (int i = 0; i < manager.layerCount(); ++i) {
+    QByteArray properties;
+    QDataStream payload(&properties, QIODevice::WriteOnly);
+    setupStream(payload);
+    writeLayerProperties(payload, *manager.layerAt(i));
+    writeChunk(stream, LayerChunk, properties);
+  }
+
+  // A batch of tiles is compressed in parallel, then appended in order;
+  // only one batch is ever held in memory. Paged-out tiles are read
+  // without being brought back into the document.
+  size_t batch = QThreadPool::globalInstance()->maxThreadCount() * 4;
+  for (int i = 0; i < manager.layerCount(); ++i) {
+    const TiledImage &tiles = manager.layerAt(i)->tiles();
+    std::vector<QPoint> present;
+    for (int ty = 0; ty < tiles.tileRows(); ++ty) {
+      for (int tx = 0; tx < tiles.tileColumns(); ++tx) {
+        if (tiles.hasTile(tx, ty))
+          present.push_back(QPoint(tx, ty));
+      }
+    }
+
+    for (size_t first = 0; first < present.size(); first += batch) {
+      std::vector<QByteArray> packed(qMin(batch, present.size() - first));
+      parallelFor(packed.size(), [&](int j) {
+        QPoint tile = present[first + j];
+        packed[j] = packTile(i, tile.x(), tile.y(),
+                             tiles.peekTile(tile.x(), tile.y()));
+      });
+      for (const QByteArray &payload : packed) {
+        if (payload.size() > TileRecordBytes) // Transparent tiles are left out
+          writeChunk(stream, TileChunk, payload);
+      }
+    }
+  }
+
+  writeChunk(stream, EndChunk, QByteArray());
+  locker.unlock();
+
+  if (stream.status() != QDataStream::Ok || !file.commit()) {
+    if (error)
+      *error = file.errorString();
+    return false;
+  }
+  if (revision)
+    *revision = written;
+  return true;
+}
+
+bool AriaFile::read(const QString &fileName, Document &document,
+                    QString *error) {
+  auto fail = [error](const QString &message) {
+    if (error)
+      *error = message;
+    return false;
+  };
+
+  auto source = std::make_shared<ChunkSource>(fileName);
+  QFile &file = source->file();
+  if (!file.open(QIODevice::ReadOnly))
+    return fail(file.errorString());
+
+  QDataStream stream(&file);
+  setupStream(stream);
+
+  quint32 magic, version;
+  stream >> magic >> version;
+  if (stream.status() != QDataStream::Ok || magic != Magic)
+    return fail("Not an Aria document.");
+  if (version > Version)
+    return fail("The document was saved by a newer version of Aria.");
+
+  document = Document();
+  bool complete = false;
+  while (!complete) {
+    quint32 type;
+    quint64 size;
+    stream >> type >> size;
+    if (stream.status() != QDataStream::Ok)
+      break;
+    qint64 start = file.pos();
+    if (qint64(size) > file.size() - start)
+      break;
+
+    if (type == HeadChunk) {
+      qint32 width, height, current;
+      stream >> width >> height >> current;
+      if (width <= 0 || height <= 0)
+        return fail("The document has no valid canvas size.");
+      document.size = QSize(width, height);
+      document.currentLayer = current;
+    } else if (type == LayerChunk) {
+      if (document.size.isEmpty())
+        return fail("The document is damaged.");
+      auto layer = std::make_unique<Layer>(QString(), document.size.width(),
+                                           document.size.height());
+      readLayerProperties(stream, *layer);
+      document.layers.push_back(std::move(layer));
+    } else if (type == TileChunk) {
+      quint32 index;
+      qint32 tx, ty;
+      quint8 codec;
+      stream >> index >> tx >> ty >> codec;
+      if (index < document.layers.size() && codec < EmptyCodec &&
+          size > TileRecordBytes) {
+        // Only indexed here; ChunkTile reads it on first use
+        document.layers[index]->tiles().setPagedTile(
+            tx, ty,
+            std::make_shared<ChunkTile>(source, start + TileRecordBytes,
+                                        int(size - TileRecordBytes), codec));
+      }
+    } else if (type == EndChunk) {
+      complete = true;
+    }
+
+    if (!file.seek(start + qint64(size)))
+      break;
+  }
+
+  if (!complete || document.layers.empty()) {
+    document = Document();
+    return fail("The document is incomplete or damaged.");
+  }
+  document.currentLayer =
+      qBound(0, document.currentLayer, int(document.layers.size()) - 1);
+  return true;
+}
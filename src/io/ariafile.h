@@ -0,0 +1,49 @@
+#ifndef ARIAFILE_H
+#define ARIAFILE_H
+
+#include "core/layer.h"
+#include <QSize>
+#include <QString>
+#include <memory>
+#include <vector>
+
+class LayerManager;
+
+// Native layered document (.aria). The file is a run of chunks, each a
+// four-character type and a 64-bit payload size followed by the payload:
+//
+//   "ARIA", version     file header
+//   HEAD                canvas size and current layer
+//   LAYR                one per layer, bottom to top: name, opacity,
+//                       blend mode, visibility, clipping flag
+//   TILE                layer index, tile column and row, codec, pixels
+//   END                 marks a complete file
+//
+// Numbers are little-endian. Tile pixels are TileSize x TileSize
+// premultiplied ARGB32, LZ4-compressed or raw; absent tiles are
+// transparent. Readers skip chunk types they do not know.
+class AriaFile {
+public:
+  static constexpr quint32 Version = 1;
+
+  struct Document {
+    QSize size;
+    int currentLayer = 0;
+    std::vector<std::unique_ptr<Layer>> layers; // Bottom to top
+  };
+
+  // Streams the document to fileName. Tiles are compressed in parallel
+  // batches and written as they are ready; the file replaces the old one
+  // only once it is complete. revision receives the tile revision the file
+  // is a snapshot of (TiledImage::currentRevision() while it was written).
+  static bool write(const QString &fileName, LayerManager &manager,
+                    QString *error = nullptr, quint64 *revision = nullptr);
+
+  // Reads the layer stack. Tile chunks are only indexed: their pixels are
+  // decoded when a tile is first used, so opening costs a scan of the
+  // chunk headers and the file stays open while tiles still refer to it.
+  static bool read(const QString &fileName, Document &document,
+                   QString *error = nullptr);
+};
+
+#endif // ARIAFILE_H
@@ -0,0 +1,536 @@
+#include "autosave.h"
+#include "core/layermanager.h"
+#include "io/chunkfile.h"
+#include "rendering/parallelfor.h"
+
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QReadWriteLock>
+#include <QSaveFile>
+#include <QSettings>
+#include <QStandardPaths>
+#include <map>
+#include <tuple>
+#include <vector>
+
+static const quint32 Magic = chunkType("ARJL");
+static const quint32 BaseChunk = chunkType("BASE");
+static const quint32 CheckpointChunk = chunkType("CKPT");
+static const quint32 LayerChunk = chunkType("LAYR");
+static const quint32 TileChunk = chunkType("TILE");
+static const quint32 DoneChunk = chunkType("DONE");
+
+static const char *JournalsKey = "autosave/journals";
+
+struct AutoSave::Snapshot {
+  struct Tile {
+    int layer;
+    int tx;
+    int ty;
+    QImage image;                     // Shared with the layer
+    std::shared_ptr<PagedTile> paged; // Or, if paged out, its handle
+  };
+
+  QString documentPath;
+  QByteArray header;              // CKPT payload
+  std::vector<QByteArray> layers; // LAYR payloads
+  std::vector<Tile> tiles;
+};
+
+namespace {
+
+// The last complete checkpoint of a journal, with the latest record of
+// every tile written up to it
+struct JournalIndex {
+  struct TileRecord {
+    qint64 offset; // Of the pixels
+    int size;
+    quint8 codec;
+  };
+  using TileKey = std::tuple<QString, int, int>; // Layer id, column, row
+
+  QString documentPath;
+  QByteArray header;
+  std::vector<QByteArray> layers;
+  std::map<TileKey, TileRecord> tiles;
+};
+
+} // namespace
+
+static QString layerId(const QByteArray &layerPayload) {
+  QDataStream stream(layerPayload);
+  setupStream(stream);
+  QString id;
+  stream >> id;
+  return id;
+}
+
+static bool readJournal(QFile &file, JournalIndex &index) {
+  QDataStream stream(&file);
+  setupStream(stream);
+
+  quint32 magic, version;
+  stream >> magic >> version;
+  if (stream.status() != QDataStream::Ok || magic != Magic ||
+      version > AutoSave::Version)
+    return false;
+
+  // Records of the checkpoint being read only count once it is complete
+  bool open = false;
+  bool complete = false;
+  QByteArray header;
+  std::vector<QByteArray> layers;
+  QStringList ids;
+  std::vector<std::pair<JournalIndex::TileKey, JournalIndex::TileRecord>> tiles;
+
+  while (true) {
+    quint32 type;
+    quint64 size;
+    stream >> type >> size;
+    if (stream.status() != QDataStream::Ok)
+      break;
+    qint64 start = file.pos();
+    if (qint64(size) > file.size() - start)
+      break; // Cut off by the crash
+
+    if (type == TileChunk) {
+      quint32 layer;
+      qint32 tx, ty;
+      quint8 codec;
+      stream >> layer >> tx >> ty >> codec;
+      if (open && layer < quint32(ids.size()) && size >= TileRecordBytes) {
+        tiles.push_back({{ids[layer], tx, ty},
+                         {start + TileRecordBytes,
+                          int(size - TileRecordBytes), codec}});
+      }
+    } else {
+      QByteArray payload = file.read(qint64(size));
+      if (type == BaseChunk) {
+        QDataStream base(payload);
+        setupStream(base);
+        base >> index.documentPath;
+      } else if (type == CheckpointChunk) {
+        open = true;
+        header = payload;
+        layers.clear();
+        ids.clear();
+        tiles.clear();
+      } else if (type == LayerChunk && open) {
+        layers.push_back(payload);
+        ids << layerId(payload);
+      } else if (type == DoneChunk && open) {
+        index.header = header;
+        index.layers = layers;
+        for (const auto &tile : tiles)
+          index.tiles[tile.first] = tile.second;
+        open = false;
+        complete = true;
+      }
+    }
+
+    if (!file.seek(start + qint64(size)))
+      break;
+  }
+  return complete;
+}
+
+AutoSave::AutoSave(LayerManager *manager, QObject *parent)
+    : QObject(parent), m_manager(manager), m_busy(false), m_generation(0),
+      m_replaceJournal(false), m_checkpoint(0), m_checkpoints(0) {
+  m_pool.setMaxThreadCount(1);
+  m_timer.setInterval(DefaultInterval * 1000);
+  connect(&m_timer, &QTimer::timeout, this, &AutoSave::checkpoint);
+  m_timer.start();
+}
+
+AutoSave::~AutoSave() {
+  m_pool.waitForDone();
+  if (!m_journal.isEmpty())
+    discard(m_journal);
+  if (!m_recovered.isEmpty())
+    discard(m_recovered);
+}
+
+void AutoSave::reset(const QString &documentPath, bool baseline) {
+  begin(documentPath, baseline, TiledImage::currentRevision(), QString());
+}
+
+void AutoSave::reset(const QString &documentPath, quint64 revision) {
+  begin(documentPath, true, revision, QString());
+}
+
+void AutoSave::resetRecovered(const QString &documentPath,
+                              const QString &journal) {
+  begin(documentPath, false, TiledImage::currentRevision(), journal);
+}
+
+void AutoSave::begin(const QString &documentPath, bool baseline,
+                     quint64 revision, const QString &recovered) {
+  m_pool.waitForDone();
+  m_busy = false;
+  ++m_generation;
+
+  if (!m_journal.isEmpty() && m_journal != recovered)
+    discard(m_journal);
+  if (!m_recovered.isEmpty() && m_recovered != recovered)
+    discard(m_recovered);
+  m_documentPath = documentPath;
+  m_journal = journalPath(documentPath);
+  m_recovered = recovered;
+  // A recovered journal at the same path is replaced by the first
+  // checkpoint as a whole, never truncated before it
+  m_replaceJournal = m_journal == recovered;
+  if (!m_replaceJournal)
+    discard(m_journal); // Left over from an earlier session
+
+  m_checkpoint = revision;
+  m_baseLayers.clear();
+  m_journaledLayers.clear();
+  m_writtenLayers.clear();
+  m_stack.clear();
+  m_checkpoints = 0;
+
+  if (baseline && !documentPath.isEmpty()) {
+    for (int i = 0; i < m_manager->layerCount(); ++i)
+      m_baseLayers.insert(m_manager->layerAt(i)->id(), i);
+  }
+}
+
+void AutoSave::setInterval(int seconds) {
+  m_timer.setInterval(qMax(1, seconds) * 1000);
+}
+
+QString AutoSave::journalPath(const QString &documentPath) {
+  if (!documentPath.isEmpty())
+    return documentPath + ".journal";
+
+  QString directory =
+      QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation);
+  return directory + "/autosave/untitled-" +
+         QString::number(QCoreApplication::applicationPid()) + ".journal";
+}
+
+QStringList AutoSave::pendingJournals() {
+  QSettings settings("Aria", "Aria");
+  QStringList journals;
+  for (const QString &journal : settings.value(JournalsKey).toStringList()) {
+    if (QFile::exists(journal))
+      journals << journal;
+  }
+  return journals;
+}
+
+void AutoSave::discard(const QString &journal) {
+  QFile::remove(journal);
+
+  QSettings settings("Aria", "Aria");
+  QStringList journals = settings.value(JournalsKey).toStringList();
+  if (journals.removeAll(journal) > 0)
+    settings.setValue(JournalsKey, journals);
+}
+
+void AutoSave::checkpoint() {
+  // One checkpoint at a time; a slow disk only makes them less frequent
+  if (m_busy || m_manager->layerCount() == 0)
+    return;
+
+  // Never wait for the stroke worker; the next tick tries again
+  QReadWriteLock *lock = m_manager->documentLock();
+  if (!lock->tryLockForRead())
+    return;
+
+  quint64 revision = TiledImage::currentRevision();
+  auto snapshot = std::make_shared<Snapshot>();
+  snapshot->documentPath = m_documentPath;
+
+  Layer *base = m_manager->layerAt(0);
+  {
+    QDataStream stream(&snapshot->header, QIODevice::WriteOnly);
+    setupStream(stream);
+    stream << qint32(base->width()) << qint32(base->height())
+           << qint32(m_manager->currentLayerIndex());
+  }
+
+  QStringList ids;
+  QByteArray stack = snapshot->header;
+  for (int i = 0; i < m_manager->layerCount(); ++i) {
+    Layer *layer = m_manager->layerAt(i);
+    QString id = layer->id();
+    ids << id;
+
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    setupStream(stream);
+    stream << id << qint32(m_baseLayers.value(id, -1));
+    writeLayerProperties(stream, *layer);
+    snapshot->layers.push_back(payload);
+    stack += payload;
+
+    // A layer neither in the journal nor in the document file yet is
+    // written in full, the others only where they changed. Recovery merges
+    // records per layer across checkpoints, so a layer that comes back
+    // (undoing its deletion) also clears the tiles it had before.
+    bool full = !m_journaledLayers.contains(id) && !m_baseLayers.contains(id);
+    bool clearAbsent = full && m_writtenLayers.contains(id);
+    const TiledImage &tiles = layer->tiles();
+    for (int ty = 0; ty < tiles.tileRows(); ++ty) {
+      for (int tx = 0; tx < tiles.tileColumns(); ++tx) {
+        if (full ? !tiles.hasTile(tx, ty) && !clearAbsent
+                 : tiles.revision(tx, ty) <= m_checkpoint)
+          continue;
+
+        Snapshot::Tile tile{i, tx, ty, QImage(), tiles.pagedTile(tx, ty)};
+        if (!tile.paged)
+          tile.image = tiles.tile(tx, ty);
+        snapshot->tiles.push_back(std::move(tile));
+      }
+    }
+  }
+  lock->unlock();
+
+  if (snapshot->tiles.empty() && stack == m_stack)
+    return; // Nothing changed
+
+  m_busy = true;
+  QString journal = m_journal;
+  bool replace = m_replaceJournal;
+  int generation = m_generation;
+  bool compactAfter = m_checkpoints + 1 >= CompactionInterval;
+  m_pool.start([=] {
+    bool written = append(journal, *snapshot, replace);
+    bool compacted = written && compactAfter && compact(journal);
+    QMetaObject::invokeMethod(
+        this,
+        [=] {
+          finished(generation, written, compacted, revision, ids, stack);
+        },
+        Qt::QueuedConnection);
+  });
+}
+
+void AutoSave::finished(int generation, bool written, bool compacted,
+                        quint64 revision, const QStringList &layers,
+                        const QByteArray &stack) {
+  if (generation != m_generation)
+    return; // reset() started another journal meanwhile
+  m_busy = false;
+  if (!written)
+    return; // Everything since the last checkpoint is tried again
+
+  m_checkpoint = revision;
+  m_journaledLayers = QSet<QString>(layers.begin(), layers.end());
+  m_writtenLayers.unite(m_journaledLayers);
+  m_stack = stack;
+  m_checkpoints = compacted ? 0 : m_checkpoints + 1;
+
+  // The new journal now holds everything that was recovered
+  m_replaceJournal = false;
+  if (!m_recovered.isEmpty()) {
+    if (m_recovered != m_journal)
+      discard(m_recovered);
+    m_recovered.clear();
+  }
+
+  // Compaction drops the tiles of deleted layers, so if one comes back
+  // (undo) it has to be written in full again
+  for (auto it = m_baseLayers.begin(); it != m_baseLayers.end();) {
+    if (m_journaledLayers.contains(it.key()))
+      ++it;
+    else
+      it = m_baseLayers.erase(it);
+  }
+
+  QSettings settings("Aria", "Aria");
+  QStringList journals = settings.value(JournalsKey).toStringList();
+  if (!journals.contains(m_journal)) {
+    journals << m_journal;
+    settings.setValue(JournalsKey, journals);
+  }
+}
+
+bool AutoSave::append(const QString &journal, const Snapshot &snapshot,
+                      bool replace) {
+  QDir().mkpath(QFileInfo(journal).absolutePath());
+  // A replaced journal stays intact until its successor is complete
+  QFile appended(journal);
+  QSaveFile replacement(journal);
+  QFileDevice &file = replace ? static_cast<QFileDevice &>(replacement)
+                              : appended;
+  if (!file.open(replace ? QIODevice::WriteOnly
+                         : QIODevice::WriteOnly | QIODevice::Append))
+    return false;
+
+  QDataStream stream(&file);
+  setupStream(stream);
+  if (file.size() == 0) {
+    QByteArray base;
+    QDataStream payload(&base, QIODevice::WriteOnly);
+    setupStream(payload);
+    payload << snapshot.documentPath;
+    stream << Magic << Version;
+    writeChunk(stream, BaseChunk, base);
+  }
+
+  writeChunk(stream, CheckpointChunk, snapshot.header);
+  for (const QByteArray &layer : snapshot.layers)
+    writeChunk(stream, LayerChunk, layer);
+
+  // Compressed in parallel a batch at a time, like a full save
+  size_t batch = QThreadPool::globalInstance()->maxThreadCount() * 4;
+  for (size_t first = 0; first < snapshot.tiles.size(); first += batch) {
+    std::vector<QByteArray> packed(qMin(batch, snapshot.tiles.size() - first));
+    parallelFor(packed.size(), [&](int j) {
+      const Snapshot::Tile &tile = snapshot.tiles[first + j];
+      packed[j] = packTile(tile.layer, tile.tx, tile.ty,
+                           tile.paged ? tile.paged->load() : tile.image);
+    });
+    for (const QByteArray &payload : packed)
+      writeChunk(stream, TileChunk, payload);
+  }
+
+  writeChunk(stream, DoneChunk, QByteArray());
+  if (stream.status() != QDataStream::Ok || !file.flush())
+    return false;
+  return !replace || replacement.commit();
+}
+
+bool AutoSave::compact(const QString &journal) {
+  QFile file(journal);
+  JournalIndex index;
+  if (!file.open(QIODevice::ReadOnly) || !readJournal(file, index))
+    return false;
+
+  QSaveFile output(journal);
+  if (!output.open(QIODevice::WriteOnly))
+    return false;
+  QDataStream stream(&output);
+  setupStream(stream);
+
+  QByteArray base;
+  QDataStream basePayload(&base, QIODevice::WriteOnly);
+  setupStream(basePayload);
+  basePayload << index.documentPath;
+  stream << Magic << Version;
+  writeChunk(stream, BaseChunk, base);
+
+  // One checkpoint holding the latest version of each tile that still
+  // belongs to a layer; the pixels are copied without decoding
+  writeChunk(stream, CheckpointChunk, index.header);
+  QHash<QString, int> positions;
+  for (const QByteArray &layer : index.layers) {
+    positions.insert(layerId(layer), positions.size());
+    writeChunk(stream, LayerChunk, layer);
+  }
+
+  for (const auto &tile : index.tiles) {
+    auto position = positions.constFind(std::get<0>(tile.first));
+    if (position == positions.constEnd())
+      continue;
+
+    const JournalIndex::TileRecord &record = tile.second;
+    if (!file.seek(record.offset))
+      return false;
+    QByteArray pixels = file.read(record.size);
+    if (pixels.size() != record.size)
+      return false;
+
+    QByteArray payload;
+    QDataStream tileStream(&payload, QIODevice::WriteOnly);
+    setupStream(tileStream);
+    tileStream << quint32(position.value()) << qint32(std::get<1>(tile.first))
+               << qint32(std::get<2>(tile.first)) << record.codec;
+    tileStream.writeRawData(pixels.constData(), pixels.size());
+    writeChunk(stream, TileChunk, payload);
+  }
+
+  writeChunk(stream, DoneChunk, QByteArray());
+  file.close();
+  return stream.status() == QDataStream::Ok && output.commit();
+}
+
+bool AutoSave::recover(const QString &journal, AriaFile::Document &document,
+                       QString *documentPath, QString *error) {
+  auto fail = [error](const QString &message) {
+    if (error)
+      *error = message;
+    return false;
+  };
+
+  QFile file(journal);
+  if (!file.open(QIODevice::ReadOnly))
+    return fail(file.errorString());
+  JournalIndex index;
+  if (!readJournal(file, index))
+    return fail("The autosave holds no complete checkpoint.");
+
+  qint32 width, height, current;
+  QDataStream header(index.header);
+  setupStream(header);
+  header >> width >> height >> current;
+  if (width <= 0 || height <= 0)
+    return fail("The autosave is damaged.");
+
+  // Layers that were saved before start from the document file; the
+  // journal has only their changes
+  AriaFile::Document base;
+  bool needsBase = false;
+  for (const QByteArray &layer : index.layers) {
+    QDataStream stream(layer);
+    setupStream(stream);
+    QString id;
+    qint32 baseIndex;
+    stream >> id >> baseIndex;
+    needsBase |= baseIndex >= 0;
+  }
+  if (needsBase && !AriaFile::read(index.documentPath, base, error))
+    return false;
+
+  document = AriaFile::Document();
+  document.size = QSize(width, height);
+  QHash<QString, Layer *> layers;
+  for (const QByteArray &payload : index.layers) {
+    QDataStream stream(payload);
+    setupStream(stream);
+    QString id;
+    qint32 baseIndex;
+    stream >> id >> baseIndex;
+
+    std::unique_ptr<Layer> layer;
+    if (baseIndex >= 0 && baseIndex < int(base.layers.size()))
+      layer = std::make_unique<Layer>(QString(),
+                                      base.layers[baseIndex]->tiles());
+    else
+      layer = std::make_unique<Layer>(QString(), width, height);
+    readLayerProperties(stream, *layer);
+    layers.insert(id, layer.get());
+    document.layers.push_back(std::move(layer));
+  }
+
+  // Journal tiles are decoded now, so the journal can be replaced by the
+  // next session's right away
+  for (const auto &tile : index.tiles) {
+    Layer *layer = layers.value(std::get<0>(tile.first));
+    if (!layer)
+      continue;
+
+    const JournalIndex::TileRecord &record = tile.second;
+    QByteArray pixels;
+    if (file.seek(record.offset))
+      pixels = file.read(record.size);
+    QImage image;
+    unpackTile(pixels.constData(), pixels.size(), record.codec, image);
+    layer->tiles().setTile(std::get<1>(tile.first), std::get<2>(tile.first),
+                           image);
+  }
+
+  if (document.layers.empty())
+    return fail("The autosave is damaged.");
+  document.currentLayer =
+      qBound(0, int(current), int(document.layers.size()) - 1);
+  if (documentPath)
+    *documentPath = index.documentPath;
+  return true;
+}
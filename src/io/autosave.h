@@ -0,0 +1,101 @@
+#ifndef AUTOSAVE_H
+#define AUTOSAVE_H
+
+#include "io/ariafile.h"
+#include <QByteArray>
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+#include <QTimer>
+
+class LayerManager;
+
+// Background autosave into an append-only journal next to the document
+// (untitled documents: in the app data directory). A checkpoint appends
+// the layer stack and only the tiles changed since the previous one;
+// replaying the journal over the saved document recovers the work after
+// a crash. Changed tiles are captured on the GUI thread as copy-on-write
+// references, so painting carries on while one background thread
+// compresses and writes them. Every CompactionInterval checkpoints the
+// journal is rewritten with only the latest version of each tile.
+//
+// Journal layout, in chunks like an .aria file:
+//   "ARJL", version
+//   BASE      path of the document it applies to (empty: untitled)
+//   CKPT      canvas size and current layer; starts a checkpoint
+//   LAYR      one per layer: id, index in the document file or -1, and
+//             the properties
+//   TILE      as in .aria, layer index into this checkpoint's LAYR list;
+//             an empty record means the tile was cleared
+//   DONE      ends the checkpoint; an unfinished one is ignored
+class AutoSave : public QObject {
+  Q_OBJECT
+
+public:
+  static constexpr quint32 Version = 1;
+  static constexpr int DefaultInterval = 60;    // s
+  static constexpr int CompactionInterval = 10; // Checkpoints
+
+  explicit AutoSave(LayerManager *manager, QObject *parent = nullptr);
+  // Removes the journal: nothing needs recovering after a clean exit
+  ~AutoSave();
+
+  // Starts a fresh journal for the document stored at documentPath
+  // (empty: untitled). With baseline, the layers are what that file holds
+  // and only later changes are journaled; otherwise the first checkpoint
+  // writes everything.
+  void reset(const QString &documentPath, bool baseline = true);
+  // After a save: the file holds the tiles as of revision (as reported by
+  // AriaFile::write), so changes made while it was written are journaled
+  void reset(const QString &documentPath, quint64 revision);
+  // After a recovery from journal: the first checkpoint writes everything,
+  // and journal is only removed once that checkpoint is on disk
+  void resetRecovered(const QString &documentPath, const QString &journal);
+  void setInterval(int seconds);
+
+  static QString journalPath(const QString &documentPath);
+  // Journals of sessions that did not exit cleanly
+  static QStringList pendingJournals();
+  static void discard(const QString &journal);
+  // Rebuilds the document from a journal and the file it is based on,
+  // whose path is stored in documentPath
+  static bool recover(const QString &journal, AriaFile::Document &document,
+                      QString *documentPath, QString *error = nullptr);
+
+public slots:
+  void checkpoint();
+
+private:
+  struct Snapshot;
+
+  void begin(const QString &documentPath, bool baseline, quint64 revision,
+             const QString &recovered);
+  static bool append(const QString &journal, const Snapshot &snapshot,
+                     bool replace);
+  static bool compact(const QString &journal);
+  void finished(int generation, bool written, bool compacted,
+                quint64 revision, const QStringList &layers,
+                const QByteArray &stack);
+
+  LayerManager *m_manager;
+  QTimer m_timer;
+  QThreadPool m_pool; // One thread, so checkpoints are written in order
+  bool m_busy;
+  int m_generation; // Bumped by reset(); stale results are dropped
+
+  QString m_documentPath;
+  QString m_journal;
+  QString m_recovered;   // Journal recovered from, until a checkpoint
+  bool m_replaceJournal; // m_journal still is that journal
+  quint64 m_checkpoint;             // Tile revision of the last checkpoint
+  QHash<QString, int> m_baseLayers; // Layer id -> index in the document
+  QSet<QString> m_journaledLayers;  // Layers of the last checkpoint
+  QSet<QString> m_writtenLayers;    // Layers of any checkpoint so far
+  QByteArray m_stack;               // Its CKPT and LAYR payloads
+  int m_checkpoints;                // Since the journal was (re)written
+};
+
+#endif // AUTOSAVE_H
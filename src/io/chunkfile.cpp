@@ -0,0 +1,93 @@
+#include "chunkfile.h"
+#include "core/layer.h"
+#include "utils/compression/lz4block.h"
+
+#include <QMutexLocker>
+#include <cstring>
+
+void setupStream(QDataStream &stream) {
+  stream.setByteOrder(QDataStream::LittleEndian);
+  stream.setVersion(QDataStream::Qt_6_0);
+}
+
+void writeChunk(QDataStream &stream, quint32 type, const QByteArray &payload) {
+  stream << type << quint64(payload.size());
+  stream.writeRawData(payload.constData(), payload.size());
+}
+
+QByteArray packTile(int layer, int tx, int ty, const QImage &tile) {
+  QByteArray payload;
+  QDataStream stream(&payload, QIODevice::WriteOnly);
+  setupStream(stream);
+  stream << quint32(layer) << qint32(tx) << qint32(ty);
+  if (TiledImage::isTransparent(tile)) {
+    stream << quint8(EmptyCodec);
+    return payload;
+  }
+
+  const char *bits = reinterpret_cast<const char *>(tile.constBits());
+  QByteArray compressed(TileBytes, Qt::Uninitialized);
+  int size = lz4Compress(bits, TileBytes, compressed.data(), TileBytes);
+  if (size > 0) {
+    stream << quint8(Lz4Codec);
+    stream.writeRawData(compressed.constData(), size);
+  } else {
+    stream << quint8(RawCodec);
+    stream.writeRawData(bits, TileBytes);
+  }
+  return payload;
+}
+
+bool unpackTile(const char *data, int size, quint8 codec, QImage &tile) {
+  if (codec == EmptyCodec) {
+    tile = QImage();
+    return size == 0;
+  }
+
+  tile = TiledImage::createTile();
+  char *pixels = reinterpret_cast<char *>(tile.bits());
+  if (codec == RawCodec && size == TileBytes) {
+    std::memcpy(pixels, data, TileBytes);
+    return true;
+  }
+  if (codec == Lz4Codec && lz4Decompress(data, size, pixels, TileBytes))
+    return true;
+
+  tile.fill(Qt::transparent); // Damaged; better empty than garbage
+  return false;
+}
+
+void writeLayerProperties(QDataStream &stream, const Layer &layer) {
+  stream << layer.name() << layer.opacity() << qint32(layer.blendMode())
+         << layer.isVisible() << layer.isClippingMask();
+}
+
+void readLayerProperties(QDataStream &stream, Layer &layer) {
+  QString name;
+  double opacity;
+  qint32 mode;
+  bool visible, clipping;
+  stream >> name >> opacity >> mode >> visible >> clipping;
+
+  layer.setName(name);
+  layer.setOpacity(qBound(0.0, opacity, 1.0));
+  layer.setBlendMode(
+      Layer::BlendMode(qBound<qint32>(Layer::Normal, mode, Layer::Overlay)));
+  layer.setVisible(visible);
+  layer.setClippingMask(clipping);
+}
+
+bool ChunkSource::read(qint64 offset, char *data, int size) {
+  QMutexLocker locker(&m_mutex);
+  return m_file.seek(offset) && m_file.read(data, size) == size;
+}
+
+QImage ChunkTile::load() const {
+  // Only the read is serialized; tiles decompress in parallel
+  QByteArray data(m_size, Qt::Uninitialized);
+  QImage tile;
+  if (!m_source->read(m_offset, data.data(), m_size))
+    data.clear();
+  unpackTile(data.constData(), data.size(), m_codec, tile);
+  return tile;
+}
@@ -0,0 +1,77 @@
+#ifndef CHUNKFILE_H
+#define CHUNKFILE_H
+
+#include "core/tiledimage.h"
+#include <QByteArray>
+#include <QDataStream>
+#include <QFile>
+#include <QImage>
+#include <QMutex>
+#include <memory>
+
+class Layer;
+
+// Pieces shared by .aria documents and autosave journals. Both are a run
+// of chunks (a four-character type, a 64-bit payload size, the payload),
+// little-endian, with pixels stored one tile per TILE chunk.
+
+constexpr quint32 chunkType(const char (&name)[5]) {
+  return quint32(quint8(name[0])) | quint32(quint8(name[1])) << 8 |
+         quint32(quint8(name[2])) << 16 | quint32(quint8(name[3])) << 24;
+}
+
+enum TileCodec : quint8 {
+  RawCodec,
+  Lz4Codec,
+  EmptyCodec // No pixels: the tile was cleared
+};
+
+// Layer index, tile column and row, codec
+constexpr int TileRecordBytes = 13;
+constexpr int TileBytes = TiledImage::TileSize * TiledImage::TileSize * 4;
+
+void setupStream(QDataStream &stream);
+void writeChunk(QDataStream &stream, quint32 type, const QByteArray &payload);
+
+// TILE payload; transparent or null tiles give an EmptyCodec record
+QByteArray packTile(int layer, int tx, int ty, const QImage &tile);
+// Decodes a TILE payload's pixels; false if they are damaged
+bool unpackTile(const char *data, int size, quint8 codec, QImage &tile);
+
+// Name, opacity, blend mode, visibility and clipping flag
+void writeLayerProperties(QDataStream &stream, const Layer &layer);
+void readLayerProperties(QDataStream &stream, Layer &layer);
+
+// An open chunk file that tiles are paged in from
+class ChunkSource {
+public:
+  explicit ChunkSource(const QString &fileName) : m_file(fileName) {}
+
+  QFile &file() { return m_file; }
+  // Thread-safe positioned read
+  bool read(qint64 offset, char *data, int size);
+
+private:
+  QFile m_file;
+  QMutex m_mutex;
+};
+
+// Tile whose pixels stay in a chunk file until first used
+class ChunkTile : public PagedTile {
+public:
+  ChunkTile(std::shared_ptr<ChunkSource> source, qint64 offset, int size,
+            quint8 codec)
+      : m_source(std::move(source)), m_offset(offset), m_size(size),
+        m_codec(codec) {}
+
+  ChunkSource *source() const { return m_source.get(); }
+  QImage load() const override;
+
+private:
+  std::shared_ptr<ChunkSource> m_source;
+  qint64 m_offset; // Of the pixels, past the tile record
+  int m_size;
+  quint8 m_codec;
+};
+
+#endif // CHUNKFILE_H
@@ -0,0 +1,107 @@
+#include "imageexport.h"
+#include "core/layermanager.h"
+#include "io/orafile.h"
+#include "io/pngwriter.h"
+#include "io/psdfile.h"
+
+#include <QFileInfo>
+#include <QMetaObject>
+#include <QSaveFile>
+
+ImageExport::ImageExport(QObject *parent)
+    : QObject(parent), m_cancelled(false), m_running(false) {
+  m_pool.setMaxThreadCount(1);
+}
+
+ImageExport::~ImageExport() {
+  cancel();
+  m_pool.waitForDone();
+}
+
+bool ImageExport::canWrite(const QString &suffix) {
+  QString format = suffix.toLower();
+  return format == "png" || format == "ora" || format == "psd" ||
+         format == "psb";
+}
+
+void ImageExport::start(const QString &fileName, LayerManager &manager) {
+  Q_ASSERT(!m_running);
+  m_cancelled = false;
+  m_running = true;
+
+  auto layers = std::make_shared<Layers>(manager.snapshot());
+  int currentLayer = manager.currentLayerIndex();
+  m_pool.start([=] {
+    QString error;
+    bool ok = write(fileName, *layers, currentLayer, &error);
+    QMetaObject::invokeMethod(
+        this,
+        [=] {
+          m_running = false;
+          emit finished(ok, error);
+        },
+        Qt::QueuedConnection);
+  });
+}
+
+void ImageExport::cancel() { m_cancelled = true; }
+
+bool ImageExport::write(const QString &fileName, Layers &layers,
+                        int currentLayer, QString *error) {
+  if (layers.empty()) {
+    if (error)
+      *error = "The document has no layers.";
+    return false;
+  }
+
+  Progress progress = [this](int done, int total) {
+    emit this->progress(done, total);
+    return !m_cancelled;
+  };
+
+  QString format = QFileInfo(fileName).suffix().toLower();
+  if (format == "ora")
+    return OraFile::write(fileName, layers, currentLayer, progress, error);
+  if (format == "psd" || format == "psb") {
+    return PsdFile::write(fileName, layers, format == "psb", progress,
+                          error);
+  }
+  return writePng(fileName, layers, progress, error);
+}
+
+bool ImageExport::writePng(const QString &fileName, Layers &layers,
+                           const Progress &progress, QString *error) {
+  QSaveFile file(fileName);
+  if (!file.open(QIODevice::WriteOnly)) {
+    if (error)
+      *error = file.errorString();
+    return false;
+  }
+
+  // The composite lies on the opaque background, so alpha is dropped. The
+  // snapshot is only read once, so bands consume its tiles as they go.
+  QSize size = layers.front()->tiles().size();
+  bool written = PngWriter::write(
+      [&](const QByteArray &data) {
+        if (file.write(data) == data.size())
+          return true;
+        if (error)
+          *error = file.errorString();
+        return false;
+      },
+      size, false,
+      [&](const QRect &rect) {
+        return LayerManager::takeComposite(layers, rect);
+      },
+      progress, error);
+
+  // An unfinished file is dropped by QSaveFile
+  if (!written)
+    return false;
+  if (!file.commit()) {
+    if (error)
+      *error = file.errorString();
+    return false;
+  }
+  return true;
+}
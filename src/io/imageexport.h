@@ -0,0 +1,55 @@
+#ifndef IMAGEEXPORT_H
+#define IMAGEEXPORT_H
+
+#include "core/layer.h"
+#include "io/progress.h"
+#include <QObject>
+#include <QString>
+#include <QThreadPool>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+class LayerManager;
+
+// Writes the document to another format on a background thread: a
+// flattened PNG, or the layers as OpenRaster or PSD/PSB, by the file's
+// suffix. The layers are snapshotted copy-on-write, so painting goes on
+// meanwhile. Pixels are composited and compressed band by band in
+// parallel, and tiles of finished bands are dropped from the snapshot, so
+// neither the composite nor paged-in layers pile up in memory.
+class ImageExport : public QObject {
+  Q_OBJECT
+
+public:
+  explicit ImageExport(QObject *parent = nullptr);
+  // Cancels a running export and waits for it
+  ~ImageExport();
+
+  static bool canWrite(const QString &suffix);
+
+  // Starts writing the current layers of manager to fileName; the file is
+  // only replaced once it is complete. Must not be running.
+  void start(const QString &fileName, LayerManager &manager);
+  void cancel();
+  bool isRunning() const { return m_running; }
+
+signals:
+  void progress(int done, int total);
+  // error is empty if the export was cancelled
+  void finished(bool ok, const QString &error);
+
+private:
+  using Layers = std::vector<std::unique_ptr<Layer>>;
+
+  bool write(const QString &fileName, Layers &layers, int currentLayer,
+             QString *error);
+  static bool writePng(const QString &fileName, Layers &layers,
+                       const Progress &progress, QString *error);
+
+  QThreadPool m_pool; // One thread
+  std::atomic<bool> m_cancelled;
+  bool m_running;
+};
+
+#endif // IMAGEEXPORT_H
@@ -0,0 +1,181 @@
+#include "imageimport.h"
+#include "core/layermanager.h"
+#include "io/orafile.h"
+#include "io/psdfile.h"
+#include "rendering/parallelfor.h"
+
+#include <QFileInfo>
+#include <QImageReader>
+#include <QMetaObject>
+#include <QPoint>
+#include <QRect>
+#include <memory>
+
+// Clip-rect reads are split into bands of about this many bytes. Each band
+// is decoded by a fresh reader that has to skip everything above it, so
+// smaller bands save memory at the cost of decoding time.
+static const qint64 BandBytes = 128ll * 1024 * 1024;
+
+ImageImport::ImageImport(QObject *parent)
+    : QObject(parent), m_cancelled(false), m_running(false), m_generation(0),
+      m_ok(false) {
+  m_pool.setMaxThreadCount(1);
+}
+
+ImageImport::~ImageImport() {
+  cancel();
+  m_pool.waitForDone();
+}
+
+void ImageImport::start(const QString &fileName) {
+  cancel();
+  m_pool.waitForDone();
+  m_cancelled = false;
+  m_running = true;
+  int generation = ++m_generation;
+
+  m_pool.start([=] {
+    auto document = std::make_shared<AriaFile::Document>();
+    auto error = std::make_shared<QString>();
+    bool ok = read(fileName, *document, error.get());
+    QMetaObject::invokeMethod(
+        this,
+        [=] {
+          if (generation != m_generation)
+            return; // start() was called again meanwhile
+          m_running = false;
+          m_ok = ok;
+          m_document = std::move(*document);
+          m_error = *error;
+          emit finished();
+        },
+        Qt::QueuedConnection);
+  });
+}
+
+void ImageImport::cancel() { m_cancelled = true; }
+
+bool ImageImport::takeDocument(AriaFile::Document &document, QString *error) {
+  document = std::move(m_document);
+  m_document = AriaFile::Document();
+  if (error)
+    *error = m_error;
+  return m_ok;
+}
+
+// Once the layers read so far pass the budget the document will get, their
+// tiles are paged out, so a file larger than the RAM can still be opened
+static void pageOut(const AriaFile::Document &document) {
+  const qint64 TileBytes =
+      qint64(TiledImage::TileSize) * TiledImage::TileSize * 4;
+
+  qint64 used = 0;
+  for (const auto &layer : document.layers)
+    used += layer->tiles().allocatedBytes();
+  qint64 budget = LayerManager::defaultMemoryBudget();
+
+  for (const auto &layer : document.layers) {
+    TiledImage &tiles = layer->tiles();
+    for (int ty = 0; ty < tiles.tileRows(); ++ty) {
+      for (int tx = 0; tx < tiles.tileColumns(); ++tx) {
+        if (used <= budget)
+          return;
+        if (tiles.canSwapOut(tx, ty) && tiles.swapOut(tx, ty))
+          used -= TileBytes;
+      }
+    }
+  }
+}
+
+bool ImageImport::read(const QString &fileName, AriaFile::Document &document,
+                       QString *error) {
+  QString suffix = QFileInfo(fileName).suffix().toLower();
+  if (suffix != "ora" && suffix != "psd" && suffix != "psb")
+    return readImage(fileName, document, error);
+
+  emit progress(0, 0);
+  auto proceed = [&](int done, int total) {
+    emit progress(done, total);
+    pageOut(document);
+    return !m_cancelled;
+  };
+  if (suffix == "ora")
+    return OraFile::read(fileName, document, proceed, error);
+  return PsdFile::read(fileName, document, proceed, error);
+}
+
+bool ImageImport::readImage(const QString &fileName,
+                            AriaFile::Document &document, QString *error) {
+  const int TileSize = TiledImage::TileSize;
+
+  QImageReader reader(fileName);
+  emit progress(0, 0);
+
+  // Without clip rect support (or a size in the header) the whole image is
+  // decoded at once, in place of the bands
+  QImage image;
+  QSize size = reader.size();
+  if (!size.isValid() || !reader.supportsOption(QImageIOHandler::ClipRect)) {
+    image = reader.read();
+    if (image.isNull()) {
+      if (error)
+        *error = reader.errorString();
+      return false;
+    }
+    image.convertTo(QImage::Format_ARGB32_Premultiplied);
+    size = image.size();
+  }
+  if (m_cancelled)
+    return false;
+
+  auto layer =
+      std::make_unique<Layer>("Background", size.width(), size.height());
+  TiledImage &tiles = layer->tiles();
+  int columns = tiles.tileColumns();
+  int rows = tiles.tileRows();
+  int bandRows = int(qBound<qint64>(
+      1, BandBytes / (qint64(size.width()) * TileSize * 4), rows));
+  emit progress(0, rows);
+
+  for (int row = 0; row < rows; row += bandRows) {
+    if (m_cancelled)
+      return false;
+
+    int count = qMin(bandRows, rows - row);
+    QRect bandRect =
+        QRect(0, row * TileSize, size.width(), count * TileSize)
+            .intersected(QRect(QPoint(0, 0), size));
+
+    QImage band = image;
+    QPoint origin;
+    if (image.isNull()) {
+      QImageReader bandReader(fileName);
+      bandReader.setClipRect(bandRect);
+      band = bandReader.read();
+      if (band.isNull()) {
+        if (error)
+          *error = bandReader.errorString();
+        return false;
+      }
+      band.convertTo(QImage::Format_ARGB32_Premultiplied);
+      origin = bandRect.topLeft();
+    }
+
+    // Tiles are disjoint slots of a layer nobody else sees yet
+    parallelFor(count * columns, [&](int i) {
+      int tx = i % columns;
+      int ty = row + i / columns;
+      // copy() pads the parts beyond the source bounds with transparency
+      QImage tile = band.copy(TiledImage::tileRect(tx, ty).translated(-origin));
+      if (!TiledImage::isTransparent(tile))
+        tiles.setTile(tx, ty, tile);
+    });
+    emit progress(row + count, rows);
+  }
+
+  document.size = size;
+  document.currentLayer = 0;
+  document.layers.clear();
+  document.layers.push_back(std::move(layer));
+  return true;
+}
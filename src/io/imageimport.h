@@ -0,0 +1,57 @@
+#ifndef IMAGEIMPORT_H
+#define IMAGEIMPORT_H
+
+#include "io/ariafile.h"
+#include <QObject>
+#include <QString>
+#include <QThreadPool>
+#include <atomic>
+
+// Opens a flat image (PNG, JPEG, ...) as a one-layer document, or an
+// OpenRaster or Photoshop file with its layers, on a background thread, so
+// the window stays responsive while a large file is decoded. Pixels go
+// straight into the layers' tiles: formats whose reader can decode a clip
+// rect are read in bands of tile rows, so only one band is ever held in
+// full; the others are decoded whole and split into tiles in parallel.
+// Layers past the memory budget are paged out while the rest are read.
+class ImageImport : public QObject {
+  Q_OBJECT
+
+public:
+  explicit ImageImport(QObject *parent = nullptr);
+  // Cancels a running import and waits for it
+  ~ImageImport();
+
+  // Starts reading fileName; finished() follows. A running import is
+  // cancelled first.
+  void start(const QString &fileName);
+  void cancel();
+  bool isRunning() const { return m_running; }
+
+  // The result of the last import; ok is false if it failed or was
+  // cancelled (error is then empty)
+  bool takeDocument(AriaFile::Document &document, QString *error = nullptr);
+
+signals:
+  // Tile rows (layers for layered files) done out of total; total is 0
+  // until the size is known
+  void progress(int done, int total);
+  void finished();
+
+private:
+  bool read(const QString &fileName, AriaFile::Document &document,
+            QString *error);
+  bool readImage(const QString &fileName, AriaFile::Document &document,
+                 QString *error);
+
+  QThreadPool m_pool; // One thread
+  std::atomic<bool> m_cancelled;
+  bool m_running;
+  int m_generation; // Bumped by start(); stale results are dropped
+
+  bool m_ok;
+  AriaFile::Document m_document;
+  QString m_error;
+};
+
+#endif // IMAGEIMPORT_H
@@ -0,0 +1,305 @@
+#include "orafile.h"
+#include "core/layermanager.h"
+#include "io/pngwriter.h"
+#include "io/zipfile.h"
+
+#include <QBuffer>
+#include <QFile>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QMutex>
+#include <QPainter>
+#include <QSaveFile>
+#include <QXmlStreamReader>
+#include <QXmlStreamWriter>
+
+static const char *const MimeType = "image/openraster";
+static const char *const AriaNamespace = "urn:aria:openraster";
+static const int ThumbnailSize = 256;
+
+static const char *const CompositeOps[] = {"svg:src-over", "svg:multiply",
+                                           "svg:screen", "svg:overlay"};
+
+static QString compositeOp(Layer::BlendMode mode) {
+  return CompositeOps[mode];
+}
+
+static Layer::BlendMode blendMode(QStringView op) {
+  for (int mode = Layer::Normal; mode <= Layer::Overlay; ++mode) {
+    if (op == QLatin1String(CompositeOps[mode]))
+      return Layer::BlendMode(mode);
+  }
+  return Layer::Normal; // Modes Aria does not have
+}
+
+static QString layerEntry(int index) {
+  return QString("data/layer%1.png").arg(index);
+}
+
+static QByteArray stackXml(const std::vector<std::unique_ptr<Layer>> &layers,
+                           const std::vector<QRect> &bounds,
+                           int currentLayer) {
+  QSize size = layers.front()->tiles().size();
+  QByteArray xml;
+  QXmlStreamWriter writer(&xml);
+  writer.setAutoFormatting(true);
+  writer.writeStartDocument();
+  writer.writeNamespace(AriaNamespace, "aria");
+  writer.writeStartElement("image");
+  writer.writeAttribute("version", "0.0.5");
+  writer.writeAttribute("w", QString::number(size.width()));
+  writer.writeAttribute("h", QString::number(size.height()));
+  writer.writeStartElement("stack");
+
+  // The stack lists the top layer first
+  for (int i = int(layers.size()) - 1; i >= 0; --i) {
+    const Layer &layer = *layers[i];
+    writer.writeStartElement("layer");
+    writer.writeAttribute("name", layer.name());
+    writer.writeAttribute("src", layerEntry(i));
+    writer.writeAttribute("x", QString::number(bounds[i].x()));
+    writer.writeAttribute("y", QString::number(bounds[i].y()));
+    writer.writeAttribute("opacity", QString::number(layer.opacity(), 'f', 3));
+    writer.writeAttribute("visibility",
+                          layer.isVisible() ? "visible" : "hidden");
+    writer.writeAttribute("composite-op", compositeOp(layer.blendMode()));
+    if (i == currentLayer)
+      writer.writeAttribute("selected", "true");
+    if (layer.isClippingMask())
+      writer.writeAttribute(AriaNamespace, "clipping", "true");
+    writer.writeEndElement();
+  }
+
+  writer.writeEndElement();
+  writer.writeEndElement();
+  writer.writeEndDocument();
+  return xml;
+}
+
+bool OraFile::write(const QString &fileName,
+                    std::vector<std::unique_ptr<Layer>> &layers,
+                    int currentLayer, const Progress &progress,
+                    QString *error) {
+  auto fail = [&](const QString &message) {
+    if (error)
+      *error = message;
+    return false;
+  };
+
+  QSaveFile file(fileName);
+  if (!file.open(QIODevice::WriteOnly))
+    return fail(file.errorString());
+  ZipWriter zip(&file);
+
+  // Entries are written while PngWriter produces them. A failed write
+  // leaves its message in error; cancelling leaves error empty.
+  bool zipFailed = false;
+  auto output = [&](const QByteArray &data) {
+    zipFailed = !zip.write(data);
+    return !zipFailed;
+  };
+  auto writeEntry = [&](const QString &name, const QByteArray &data) {
+    return zip.beginEntry(name) && zip.write(data) && zip.endEntry();
+  };
+
+  // Readers look for the mime type as the first, uncompressed entry
+  if (!writeEntry("mimetype", MimeType))
+    return fail(zip.errorString());
+
+  // Empty layers still need a PNG; they get a single transparent pixel
+  std::vector<QRect> bounds;
+  for (const auto &layer : layers) {
+    QRect rect = layer->tiles().allocatedRect();
+    bounds.push_back(rect.isEmpty() ? QRect(0, 0, 1, 1) : rect);
+  }
+  if (!writeEntry("stack.xml", stackXml(layers, bounds, currentLayer)))
+    return fail(zip.errorString());
+
+  int steps = int(layers.size()) + 1;
+  int step = 0;
+  auto layerProgress = [&](int, int) {
+    return !progress || progress(step, steps);
+  };
+
+  for (int i = 0; i < int(layers.size()); ++i) {
+    // The flattened image still needs the layers, so a copy is consumed
+    TiledImage tiles = layers[i]->tiles();
+    QPoint origin = bounds[i].topLeft();
+    if (!zip.beginEntry(layerEntry(i)))
+      return fail(zip.errorString());
+    bool written = PngWriter::write(
+        output, bounds[i].size(), true,
+        [&](const QRect &rect) {
+          return tiles.takeImage(rect.translated(origin));
+        },
+        layerProgress, error);
+    if (!written)
+      return zipFailed ? fail(zip.errorString()) : false;
+    if (!zip.endEntry())
+      return fail(zip.errorString());
+    ++step;
+  }
+
+  // The flattened image is the last pass over the layers; the thumbnail
+  // is scaled down from its bands as they go by
+  QSize size = layers.front()->tiles().size();
+  QSize thumbnailSize = size.scaled(ThumbnailSize, ThumbnailSize,
+                                    Qt::KeepAspectRatio)
+                            .boundedTo(size)
+                            .expandedTo(QSize(1, 1));
+  std::vector<QImage> slices(
+      (size.height() + PngWriter::BandRows - 1) / PngWriter::BandRows);
+
+  if (!zip.beginEntry("mergedimage.png"))
+    return fail(zip.errorString());
+  bool written = PngWriter::write(
+      output, size, false,
+      [&](const QRect &rect) {
+        QImage band = LayerManager::takeComposite(layers, rect);
+        int top = rect.top() * thumbnailSize.height() / size.height();
+        int bottom = (rect.bottom() + 1) * thumbnailSize.height() /
+                     size.height();
+        if (bottom > top && !band.isNull()) {
+          slices[rect.top() / PngWriter::BandRows] =
+              band.scaled(thumbnailSize.width(), bottom - top,
+                          Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+        }
+        return band;
+      },
+      layerProgress, error);
+  if (!written)
+    return zipFailed ? fail(zip.errorString()) : false;
+  if (!zip.endEntry())
+    return fail(zip.errorString());
+
+  QImage thumbnail(thumbnailSize, QImage::Format_RGB32);
+  thumbnail.fill(Qt::white);
+  {
+    QPainter painter(&thumbnail);
+    int top = 0;
+    for (const QImage &slice : slices) {
+      painter.drawImage(0, top, slice);
+      top += slice.height();
+    }
+  }
+  QByteArray png;
+  QBuffer buffer(&png);
+  buffer.open(QIODevice::WriteOnly);
+  QImageWriter(&buffer, "png").write(thumbnail);
+  if (!writeEntry("Thumbnails/thumbnail.png", png) || !zip.finish())
+    return fail(zip.errorString());
+
+  if (!file.commit())
+    return fail(file.errorString());
+  if (progress)
+    progress(steps, steps);
+  return true;
+}
+
+namespace {
+struct LayerEntry {
+  QString name;
+  QString source;
+  QPoint position;
+  double opacity = 1.0;
+  bool visible = true;
+  Layer::BlendMode mode = Layer::Normal;
+  bool clipping = false;
+  bool selected = false;
+};
+} // namespace
+
+bool OraFile::read(const QString &fileName, AriaFile::Document &document,
+                   const Progress &progress, QString *error) {
+  auto fail = [&](const QString &message) {
+    if (error)
+      *error = message;
+    return false;
+  };
+
+  QFile file(fileName);
+  if (!file.open(QIODevice::ReadOnly))
+    return fail(file.errorString());
+  ZipReader zip(&file);
+  QByteArray xml;
+  if (!zip.open() || !zip.read("stack.xml", xml))
+    return fail(zip.errorString());
+
+  // Layers come top first; groups only contribute their layers
+  QSize size;
+  std::vector<LayerEntry> entries;
+  QXmlStreamReader reader(xml);
+  while (!reader.atEnd()) {
+    if (reader.readNext() != QXmlStreamReader::StartElement)
+      continue;
+    QXmlStreamAttributes attributes = reader.attributes();
+    if (reader.name() == QLatin1String("image")) {
+      size = QSize(attributes.value("w").toInt(),
+                   attributes.value("h").toInt());
+    } else if (reader.name() == QLatin1String("layer")) {
+      LayerEntry entry;
+      entry.name = attributes.value("name").toString();
+      entry.source = attributes.value("src").toString();
+      entry.position = QPoint(attributes.value("x").toInt(),
+                              attributes.value("y").toInt());
+      if (attributes.hasAttribute("opacity"))
+        entry.opacity = qBound(0.0, attributes.value("opacity").toDouble(),
+                               1.0);
+      entry.visible =
+          attributes.value("visibility") != QLatin1String("hidden");
+      entry.mode = blendMode(attributes.value("composite-op"));
+      entry.clipping =
+          attributes.value(AriaNamespace, "clipping") == QLatin1String("true");
+      entry.selected = attributes.value("selected") == QLatin1String("true");
+      entries.push_back(entry);
+    }
+  }
+  if (reader.hasError())
+    return fail("stack.xml is damaged: " + reader.errorString());
+  if (size.isEmpty())
+    return fail("stack.xml has no image size.");
+
+  document.size = size;
+  document.currentLayer = 0;
+  document.layers.clear();
+  int count = int(entries.size());
+  for (int i = count - 1; i >= 0; --i) {
+    if (progress && !progress(count - 1 - i, count))
+      return false;
+
+    const LayerEntry &entry = entries[i];
+    QByteArray png;
+    if (!zip.read(entry.source, png))
+      return fail(zip.errorString());
+    QImage image;
+    {
+      QBuffer buffer(&png);
+      QImageReader imageReader(&buffer);
+      image = imageReader.read();
+      if (image.isNull())
+        return fail(entry.source + ": " + imageReader.errorString());
+    }
+    png.clear();
+    image.convertTo(QImage::Format_ARGB32_Premultiplied);
+
+    auto layer = std::make_unique<Layer>(entry.name, size.width(),
+                                         size.height());
+    layer->setOpacity(entry.opacity);
+    layer->setVisible(entry.visible);
+    layer->setBlendMode(entry.mode);
+    layer->setClippingMask(entry.clipping);
+    layer->tiles().placeImage(image, entry.position);
+    if (entry.selected)
+      document.currentLayer = int(document.layers.size());
+    document.layers.push_back(std::move(layer));
+  }
+
+  // Every document has at least one layer
+  if (document.layers.empty()) {
+    document.layers.push_back(
+        std::make_unique<Layer>("Background", size.width(), size.height()));
+  }
+  if (progress)
+    progress(count, count);
+  return true;
+}
@@ -0,0 +1,34 @@
+#ifndef ORAFILE_H
+#define ORAFILE_H
+
+#include "io/ariafile.h"
+#include "io/progress.h"
+#include <QString>
+#include <memory>
+#include <vector>
+
+// OpenRaster (.ora) layered images, as exchanged with Krita, GIMP and
+// MyPaint: a zip archive holding the layer stack in stack.xml, each layer
+// as a PNG, and a flattened copy with a thumbnail. Name, opacity,
+// visibility and the four blend modes map directly. Clipping masks have
+// no OpenRaster equivalent and go in an aria:clipping attribute that
+// other applications ignore. Nested stacks (groups) are flattened into
+// the layer list when reading.
+class OraFile {
+public:
+  // Each layer is cropped to its painted tiles and encoded band by band
+  // with PngWriter, so only a batch of bands is in memory. The layers are
+  // consumed: tiles are dropped once written.
+  static bool write(const QString &fileName,
+                    std::vector<std::unique_ptr<Layer>> &layers,
+                    int currentLayer, const Progress &progress = Progress(),
+                    QString *error = nullptr);
+
+  // Layers are decoded one at a time straight into their tiles and added
+  // to document as they are done; progress counts layers
+  static bool read(const QString &fileName, AriaFile::Document &document,
+                   const Progress &progress = Progress(),
+                   QString *error = nullptr);
+};
+
+#endif // ORAFILE_H
@@ -0,0 +1,216 @@
+#include "pngwriter.h"
+#include "rendering/parallelfor.h"
+
+#include <QThreadPool>
+#include <QtEndian>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <zlib.h>
+
+// Zlib stream header for deflate with a 32 KB window at the default level
+static const char ZlibHeader[] = "\x78\x9c";
+
+namespace {
+struct Band {
+  bool ok = false;
+  QByteArray data;   // Raw deflate, ending on a sync flush or the last block
+  quint32 adler = 1; // Of the filtered rows
+  qint64 length = 0; // Filtered bytes
+};
+} // namespace
+
+static int paethPredictor(int a, int b, int c) {
+  int p = a + b - c;
+  int pa = std::abs(p - a);
+  int pb = std::abs(p - b);
+  int pc = std::abs(p - c);
+  if (pa <= pb && pa <= pc)
+    return a;
+  return pb <= pc ? b : c;
+}
+
+// Writes the filter type byte and the filtered row to out, picking the
+// filter with the smallest sum of absolute differences. Without previous
+// (the first row of a band, whose row above is another band's) only None
+// and Sub are tried.
+static void filterRow(const quint8 *row, const quint8 *previous, int bytes,
+                      int pixelBytes, quint8 *out,
+                      std::vector<quint8> &scratch) {
+  scratch.resize(4 * size_t(bytes));
+  quint8 *sub = scratch.data();
+  quint8 *up = sub + bytes;
+  quint8 *average = up + bytes;
+  quint8 *paeth = average + bytes;
+
+  for (int i = 0; i < bytes; ++i) {
+    int a = i >= pixelBytes ? row[i - pixelBytes] : 0;
+    sub[i] = quint8(row[i] - a);
+    if (previous) {
+      int b = previous[i];
+      int c = i >= pixelBytes ? previous[i - pixelBytes] : 0;
+      up[i] = quint8(row[i] - b);
+      average[i] = quint8(row[i] - ((a + b) >> 1));
+      paeth[i] = quint8(row[i] - paethPredictor(a, b, c));
+    }
+  }
+
+  const quint8 *candidates[] = {row, sub, up, average, paeth};
+  int count = previous ? 5 : 2;
+  int best = 0;
+  quint64 bestCost = ~quint64(0);
+  for (int filter = 0; filter < count; ++filter) {
+    quint64 cost = 0;
+    for (int i = 0; i < bytes; ++i)
+      cost += std::abs(int(qint8(candidates[filter][i])));
+    if (cost < bestCost) {
+      best = filter;
+      bestCost = cost;
+    }
+  }
+
+  out[0] = quint8(best);
+  std::memcpy(out + 1, candidates[best], bytes);
+}
+
+static Band packBand(const QImage &source, bool alpha, bool last) {
+  Band band;
+  if (source.isNull())
+    return band;
+  QImage image = source.convertToFormat(QImage::Format_ARGB32);
+
+  int width = image.width();
+  int rows = image.height();
+  int pixelBytes = alpha ? 4 : 3;
+  int bytes = width * pixelBytes;
+  qsizetype stride = bytes + 1;
+  QByteArray filtered(stride * rows, Qt::Uninitialized);
+  std::vector<quint8> current(bytes);
+  std::vector<quint8> previous(bytes);
+  std::vector<quint8> scratch;
+  for (int y = 0; y < rows; ++y) {
+    const QRgb *pixels = reinterpret_cast<const QRgb *>(image.constScanLine(y));
+    quint8 *out = current.data();
+    for (int x = 0; x < width; ++x) {
+      *out++ = quint8(qRed(pixels[x]));
+      *out++ = quint8(qGreen(pixels[x]));
+      *out++ = quint8(qBlue(pixels[x]));
+      if (alpha)
+        *out++ = quint8(qAlpha(pixels[x]));
+    }
+    filterRow(current.data(), y > 0 ? previous.data() : nullptr, bytes,
+              pixelBytes,
+              reinterpret_cast<quint8 *>(filtered.data()) + y * stride,
+              scratch);
+    std::swap(current, previous);
+  }
+  image = QImage();
+
+  band.length = filtered.size();
+  band.adler = adler32(adler32(0, Z_NULL, 0),
+                       reinterpret_cast<const Bytef *>(filtered.constData()),
+                       uInt(band.length));
+
+  z_stream stream = {};
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+                   Z_FILTERED) != Z_OK)
+    return band;
+
+  // Room for the sync flush's empty stored block on top of the bound
+  band.data.resize(qsizetype(deflateBound(&stream, uLong(band.length))) + 64);
+  stream.next_in = reinterpret_cast<Bytef *>(filtered.data());
+  stream.avail_in = uInt(band.length);
+  stream.next_out = reinterpret_cast<Bytef *>(band.data.data());
+  stream.avail_out = uInt(band.data.size());
+
+  // A sync flush ends the band on a byte boundary without marking the
+  // last block, so the next band's stream can follow it directly
+  int result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+  band.ok = last ? result == Z_STREAM_END
+                 : result == Z_OK && stream.avail_in == 0 &&
+                       stream.avail_out > 0;
+  band.data.resize(qsizetype(stream.total_out));
+  deflateEnd(&stream);
+  return band;
+}
+
+static QByteArray chunk(const char *type, const QByteArray &data) {
+  QByteArray result(8, Qt::Uninitialized);
+  qToBigEndian(quint32(data.size()), result.data());
+  std::memcpy(result.data() + 4, type, 4);
+  result += data;
+
+  // The CRC covers the type and the data
+  const Bytef *typed = reinterpret_cast<const Bytef *>(result.constData());
+  quint32 crc = crc32(0, typed + 4, uInt(data.size() + 4));
+  uchar check[4];
+  qToBigEndian(crc, check);
+  result.append(reinterpret_cast<const char *>(check), 4);
+  return result;
+}
+
+bool PngWriter::write(const Output &output, const QSize &size, bool alpha,
+                      const RenderBand &render, const Progress &progress,
+                      QString *error) {
+  int width = size.width();
+  int height = size.height();
+  if (width <= 0 || height <= 0) {
+    if (error)
+      *error = "The image is empty.";
+    return false;
+  }
+
+  // 8-bit RGB(A), deflate, adaptive filtering, no interlacing
+  QByteArray header(13, 0);
+  qToBigEndian(quint32(width), header.data());
+  qToBigEndian(quint32(height), header.data() + 4);
+  header[8] = 8;
+  header[9] = alpha ? 6 : 2;
+  if (!output(QByteArray("\x89PNG\r\n\x1a\n", 8)) ||
+      !output(chunk("IHDR", header)))
+    return false;
+
+  // A batch keeps every thread busy; only its bands are in memory
+  int bands = (height + BandRows - 1) / BandRows;
+  int batch = QThreadPool::globalInstance()->maxThreadCount();
+  quint32 adler = adler32(0, Z_NULL, 0);
+  if (progress && !progress(0, bands))
+    return false;
+
+  for (int first = 0; first < bands; first += batch) {
+    int count = qMin(batch, bands - first);
+    std::vector<Band> packed(count);
+    parallelFor(count, [&](int i) {
+      int top = (first + i) * BandRows;
+      QRect rect(0, top, width, qMin(BandRows, height - top));
+      packed[i] = packBand(render(rect), alpha, first + i == bands - 1);
+    });
+
+    for (int i = 0; i < count; ++i) {
+      const Band &band = packed[i];
+      if (!band.ok) {
+        if (error)
+          *error = "Not enough memory to compress the image.";
+        return false;
+      }
+
+      QByteArray data;
+      if (first + i == 0)
+        data += ZlibHeader;
+      data += band.data;
+      adler = adler32_combine(adler, band.adler, z_off_t(band.length));
+      if (first + i == bands - 1) {
+        uchar check[4];
+        qToBigEndian(adler, check);
+        data.append(reinterpret_cast<const char *>(check), 4);
+      }
+      if (!output(chunk("IDAT", data)))
+        return false;
+    }
+
+    if (progress && !progress(first + count, bands))
+      return false;
+  }
+
+  return output(chunk("IEND", QByteArray()));
+}
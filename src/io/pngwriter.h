@@ -0,0 +1,37 @@
+#ifndef PNGWRITER_H
+#define PNGWRITER_H
+
+#include "io/progress.h"
+#include <QByteArray>
+#include <QImage>
+#include <QRect>
+#include <QSize>
+#include <QString>
+#include <functional>
+
+// PNG encoder that never holds the whole image. Rows are requested in
+// bands, and each band is filtered (adaptively, as libpng does) and
+// deflated on its own thread. A band's raw deflate stream ends on a sync
+// flush, so the streams join into one zlib stream once concatenated; the
+// Adler-32 checksums are combined. Only a batch of bands is in memory,
+// and IDAT chunks go out in order as each batch completes.
+class PngWriter {
+public:
+  static constexpr int BandRows = 256;
+
+  // Returns the pixels of rect (image coordinates) as ARGB32 or
+  // ARGB32_Premultiplied. Called for several bands at once from different
+  // threads; rects are BandRows high, only the last one may be shorter.
+  using RenderBand = std::function<QImage(const QRect &rect)>;
+  // Receives the file in order; returning false aborts the write
+  using Output = std::function<bool(const QByteArray &data)>;
+
+  // Writes an RGBA PNG with alpha, otherwise RGB. Progress counts bands.
+  // When output fails or the write is cancelled, error is left as is.
+  static bool write(const Output &output, const QSize &size, bool alpha,
+                    const RenderBand &render,
+                    const Progress &progress = Progress(),
+                    QString *error = nullptr);
+};
+
+#endif // PNGWRITER_H
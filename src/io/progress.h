@@ -0,0 +1,10 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <functional>
+
+// Told how many of total steps a long file operation has done; returning
+// false cancels it. May be called from a worker thread.
+using Progress = std::function<bool(int done, int total)>;
+
+#endif // PROGRESS_H
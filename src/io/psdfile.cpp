@@ -0,0 +1,781 @@
+#include "psdfile.h"
+#include "core/layermanager.h"
+#include "rendering/parallelfor.h"
+
+#include <QFile>
+#include <QSaveFile>
+#include <QTemporaryFile>
+#include <QThreadPool>
+#include <QtEndian>
+#include <cstring>
+#include <functional>
+#include <zlib.h>
+
+static const int BandRows = TiledImage::TileSize;
+static const qint64 CopyChunk = 4 * 1024 * 1024;
+
+// Channel data compression
+static const quint16 RawData = 0;
+static const quint16 RleData = 1;
+static const quint16 ZipData = 2;
+static const quint16 ZipPredictedData = 3;
+
+namespace {
+// A channel id and the shift of its byte in a QRgb
+struct Channel {
+  qint16 id;
+  int shift;
+};
+
+struct LayerRecord {
+  QRect rect;
+  std::vector<std::pair<qint16, quint64>> channels; // Id, data length
+  QString name;
+  Layer::BlendMode mode = Layer::Normal;
+  double opacity = 1.0;
+  bool visible = true;
+  bool clipping = false;
+  bool divider = false; // Marks where a group starts or ends
+};
+
+// One band's PackBits rows, per channel
+struct PackedBand {
+  bool ok = false;
+  std::vector<QByteArray> data;
+  std::vector<std::vector<quint32>> counts;
+};
+} // namespace
+
+static const Channel LayerChannels[] = {{-1, 24}, {0, 16}, {1, 8}, {2, 0}};
+static const Channel MergedChannels[] = {{0, 16}, {1, 8}, {2, 0}};
+static const char *const BlendKeys[] = {"norm", "mul ", "scrn", "over"};
+
+// Additional layer information whose length is 64-bit in a PSB
+static const char *const LongBlocks[] = {"LMsk", "Lr16", "Lr32", "Layr",
+                                         "Mt16", "Mt32", "Mtrn", "Alph",
+                                         "FMsk", "lnk2", "FEid", "FXid",
+                                         "PxSD"};
+
+template <typename T> static void put(QByteArray &data, T value) {
+  char bytes[sizeof(T)];
+  qToBigEndian(value, bytes);
+  data.append(bytes, sizeof(T));
+}
+
+// Section and channel lengths are 64-bit in a PSB
+static void putLength(QByteArray &data, quint64 value, bool large) {
+  if (large)
+    put<quint64>(data, value);
+  else
+    put<quint32>(data, quint32(value));
+}
+
+// PackBits: runs of three or more equal bytes are stored as a count and
+// the byte, everything else as literal stretches of up to 128
+static void packBits(const quint8 *data, int size, QByteArray &out) {
+  int i = 0;
+  while (i < size) {
+    int run = 1;
+    while (i + run < size && run < 128 && data[i + run] == data[i])
+      ++run;
+    if (run >= 3) {
+      out.append(char(1 - run));
+      out.append(char(data[i]));
+      i += run;
+      continue;
+    }
+
+    int start = i;
+    while (i < size && i - start < 128) {
+      if (i + 2 < size && data[i] == data[i + 1] && data[i] == data[i + 2])
+        break;
+      ++i;
+    }
+    out.append(char(i - start - 1));
+    out.append(reinterpret_cast<const char *>(data + start), i - start);
+  }
+}
+
+static bool unpackBits(const quint8 *data, qint64 size, quint8 *out,
+                       int width) {
+  int x = 0;
+  qint64 i = 0;
+  while (x < width && i < size) {
+    int header = qint8(data[i++]);
+    if (header >= 0) {
+      int count = header + 1;
+      if (i + count > size || x + count > width)
+        return false;
+      std::memcpy(out + x, data + i, count);
+      i += count;
+      x += count;
+    } else if (header != -128) {
+      int count = 1 - header;
+      if (i >= size || x + count > width)
+        return false;
+      std::memset(out + x, data[i++], count);
+      x += count;
+    }
+  }
+  return x == width;
+}
+
+static PackedBand packBand(const QImage &source, const Channel *channels,
+                           int count) {
+  PackedBand band;
+  if (source.isNull())
+    return band;
+  QImage image = source.convertToFormat(QImage::Format_ARGB32);
+
+  band.data.resize(count);
+  band.counts.resize(count);
+  std::vector<quint8> plane(image.width());
+  for (int c = 0; c < count; ++c) {
+    for (int y = 0; y < image.height(); ++y) {
+      const QRgb *row = reinterpret_cast<const QRgb *>(image.constScanLine(y));
+      for (int x = 0; x < image.width(); ++x)
+        plane[x] = quint8(row[x] >> channels[c].shift);
+      qsizetype before = band.data[c].size();
+      packBits(plane.data(), image.width(), band.data[c]);
+      band.counts[c].push_back(quint32(band.data[c].size() - before));
+    }
+  }
+  band.ok = true;
+  return band;
+}
+
+namespace {
+class Output {
+public:
+  Output(QFileDevice &file, bool large, QString *error)
+      : m_file(file), m_large(large), m_error(error) {}
+
+  bool large() const { return m_large; }
+  qint64 pos() const { return m_file.pos(); }
+
+  bool write(const QByteArray &data) {
+    return m_file.write(data) == data.size() || fail(m_file.errorString());
+  }
+
+  // Overwrites data at an earlier position, then returns to the end
+  bool patch(qint64 position, const QByteArray &data) {
+    qint64 end = m_file.pos();
+    return (m_file.seek(position) && m_file.write(data) == data.size() &&
+            m_file.seek(end)) ||
+           fail(m_file.errorString());
+  }
+
+  bool append(QFileDevice &source) {
+    if (!source.seek(0))
+      return fail(source.errorString());
+    while (!source.atEnd()) {
+      QByteArray data = source.read(CopyChunk);
+      if (data.isEmpty())
+        return fail(source.errorString());
+      if (!write(data))
+        return false;
+    }
+    return true;
+  }
+
+  bool fail(const QString &error) {
+    if (m_error)
+      *m_error = error;
+    return false;
+  }
+
+private:
+  QFileDevice &m_file;
+  bool m_large;
+  QString *m_error;
+};
+} // namespace
+
+// Writes the PackBits planes of an image of size, which render() returns
+// band by band. A layer stores each channel with its own compression tag
+// and row lengths (lengths receives each one's size); the merged image
+// has one tag and all row lengths up front.
+static bool writeChannels(Output &out, const QSize &size,
+                          const Channel *channels, int count, bool merged,
+                          const std::function<QImage(const QRect &)> &render,
+                          const std::function<bool()> &proceed,
+                          std::vector<quint64> *lengths) {
+  int width = size.width();
+  int height = size.height();
+  if (size.isEmpty()) {
+    // An empty layer has a bare tag per channel
+    QByteArray tags;
+    for (int c = 0; c < count; ++c) {
+      put<quint16>(tags, RawData);
+      if (lengths)
+        lengths->push_back(2);
+    }
+    return out.write(tags);
+  }
+
+  // Row lengths are filled in once known
+  int countBytes = out.large() ? 4 : 2;
+  qint64 start = out.pos();
+  QByteArray header;
+  put<quint16>(header, RleData);
+  int tables = merged ? count : 1;
+  header.append(QByteArray(qsizetype(countBytes) * height * tables, 0));
+  if (!out.write(header))
+    return false;
+
+  std::vector<std::unique_ptr<QTemporaryFile>> spills(count);
+  for (int c = 1; c < count; ++c) {
+    spills[c] = std::make_unique<QTemporaryFile>();
+    if (!spills[c]->open())
+      return out.fail(spills[c]->errorString());
+  }
+
+  std::vector<std::vector<quint32>> counts(count);
+  std::vector<quint64> sizes(count, 0);
+  int bands = (height + BandRows - 1) / BandRows;
+  int batch = QThreadPool::globalInstance()->maxThreadCount();
+  for (int first = 0; first < bands; first += batch) {
+    if (!proceed())
+      return false;
+
+    int pending = qMin(batch, bands - first);
+    std::vector<PackedBand> packed(pending);
+    parallelFor(pending, [&](int i) {
+      int top = (first + i) * BandRows;
+      QRect rect(0, top, width, qMin(BandRows, height - top));
+      packed[i] = packBand(render(rect), channels, count);
+    });
+
+    for (const PackedBand &band : packed) {
+      if (!band.ok)
+        return out.fail("Not enough memory to compress the image.");
+      for (int c = 0; c < count; ++c) {
+        if (c == 0 ? !out.write(band.data[c])
+                   : spills[c]->write(band.data[c]) != band.data[c].size())
+          return out.fail(c == 0 ? QString() : spills[c]->errorString());
+        counts[c].insert(counts[c].end(), band.counts[c].begin(),
+                         band.counts[c].end());
+        sizes[c] += band.data[c].size();
+      }
+    }
+  }
+
+  auto rowCounts = [&](int c) {
+    QByteArray table;
+    for (quint32 bytes : counts[c]) {
+      if (out.large())
+        put<quint32>(table, bytes);
+      else
+        put<quint16>(table, quint16(bytes));
+    }
+    return table;
+  };
+
+  if (merged) {
+    QByteArray table;
+    for (int c = 0; c < count; ++c) {
+      table += rowCounts(c);
+      if (c > 0 && !out.append(*spills[c]))
+        return false;
+    }
+    return out.patch(start + 2, table);
+  }
+
+  if (!out.patch(start + 2, rowCounts(0)))
+    return false;
+  for (int c = 0; c < count; ++c) {
+    if (c > 0) {
+      QByteArray tag;
+      put<quint16>(tag, RleData);
+      if (!out.write(tag + rowCounts(c)) || !out.append(*spills[c]))
+        return false;
+    }
+    if (lengths)
+      lengths->push_back(2 + quint64(countBytes) * height + sizes[c]);
+  }
+  return true;
+}
+
+static QByteArray layerRecord(const Layer &layer, const QRect &rect,
+                              bool large, std::vector<int> &lengthOffsets) {
+  QByteArray record;
+  put<qint32>(record, rect.isEmpty() ? 0 : rect.top());
+  put<qint32>(record, rect.isEmpty() ? 0 : rect.left());
+  put<qint32>(record, rect.isEmpty() ? 0 : rect.bottom() + 1);
+  put<qint32>(record, rect.isEmpty() ? 0 : rect.right() + 1);
+  put<quint16>(record, 4);
+  for (const Channel &channel : LayerChannels) {
+    put<qint16>(record, channel.id);
+    lengthOffsets.push_back(record.size());
+    putLength(record, 0, large); // Filled in after the data
+  }
+
+  record += "8BIM";
+  record += BlendKeys[layer.blendMode()];
+  put<quint8>(record, quint8(qRound(layer.opacity() * 255)));
+  put<quint8>(record, layer.isClippingMask() ? 1 : 0);
+  put<quint8>(record, layer.isVisible() ? 0 : 2); // Bit 1: hidden
+  put<quint8>(record, 0);
+
+  // No mask or blending ranges; the name as a Pascal string padded to 4
+  // bytes, and in full as Unicode
+  QByteArray extra;
+  put<quint32>(extra, 0);
+  put<quint32>(extra, 0);
+  QByteArray name = layer.name().toLatin1().left(255);
+  put<quint8>(extra, quint8(name.size()));
+  extra += name;
+  extra.append(QByteArray((4 - (name.size() + 1) % 4) % 4, 0));
+
+  QByteArray unicode;
+  put<quint32>(unicode, quint32(layer.name().size()));
+  for (QChar ch : layer.name())
+    put<quint16>(unicode, ch.unicode());
+  unicode.append(QByteArray((4 - unicode.size() % 4) % 4, 0));
+  extra += "8BIMluni";
+  put<quint32>(extra, quint32(unicode.size()));
+  extra += unicode;
+
+  put<quint32>(record, quint32(extra.size()));
+  record += extra;
+  return record;
+}
+
+bool PsdFile::write(const QString &fileName,
+                    std::vector<std::unique_ptr<Layer>> &layers, bool large,
+                    const Progress &progress, QString *error) {
+  auto fail = [&](const QString &message) {
+    if (error)
+      *error = message;
+    return false;
+  };
+
+  if (layers.empty())
+    return fail("The document has no layers.");
+  QSize size = layers.front()->tiles().size();
+  if (qMax(size.width(), size.height()) > (large ? MaxPsbSize : MaxPsdSize)) {
+    return fail(large ? "The image is too large for a PSB file."
+                      : "Images past 30000 pixels need to be saved as PSB.");
+  }
+
+  QSaveFile file(fileName);
+  if (!file.open(QIODevice::WriteOnly))
+    return fail(file.errorString());
+  Output out(file, large, error);
+  int lengthBytes = large ? 8 : 4;
+
+  // Header, then empty color mode data and image resources
+  QByteArray header("8BPS");
+  put<quint16>(header, large ? 2 : 1);
+  header.append(QByteArray(6, 0));
+  put<quint16>(header, 3); // Channels
+  put<quint32>(header, quint32(size.height()));
+  put<quint32>(header, quint32(size.width()));
+  put<quint16>(header, 8); // Bits per channel
+  put<quint16>(header, 3); // RGB
+  put<quint32>(header, 0);
+  put<quint32>(header, 0);
+
+  // Layer and mask information, then layer information, whose lengths
+  // are filled in at the end
+  qint64 layerMaskStart = header.size();
+  qint64 layerInfoStart = layerMaskStart + lengthBytes;
+  putLength(header, 0, large);
+  putLength(header, 0, large);
+  put<qint16>(header, qint16(layers.size()));
+  if (!out.write(header))
+    return false;
+
+  std::vector<QRect> bounds;
+  std::vector<int> lengthOffsets;
+  QByteArray records;
+  for (const auto &layer : layers) {
+    bounds.push_back(layer->tiles().allocatedRect());
+    std::vector<int> offsets;
+    QByteArray record = layerRecord(*layer, bounds.back(), large, offsets);
+    for (int offset : offsets)
+      lengthOffsets.push_back(int(records.size()) + offset);
+    records += record;
+  }
+  qint64 recordsStart = out.pos();
+  if (!out.write(records))
+    return false;
+
+  int steps = int(layers.size()) + 1;
+  int step = 0;
+  auto proceed = [&] { return !progress || progress(step, steps); };
+
+  for (int i = 0; i < int(layers.size()); ++i) {
+    // The merged image still needs the layers, so a copy is consumed
+    TiledImage tiles = layers[i]->tiles();
+    QPoint origin = bounds[i].topLeft();
+    std::vector<quint64> lengths;
+    if (!writeChannels(
+            out, bounds[i].size(), LayerChannels, 4, false,
+            [&](const QRect &rect) {
+              return tiles.takeImage(rect.translated(origin));
+            },
+            proceed, &lengths))
+      return false;
+
+    for (int c = 0; c < 4; ++c) {
+      QByteArray length;
+      putLength(length, lengths[c], large);
+      if (!out.patch(recordsStart + lengthOffsets[i * 4 + c], length))
+        return false;
+    }
+    ++step;
+  }
+
+  // Section lengths are padded to an even count (4 in a PSB)
+  int align = large ? 4 : 2;
+  qint64 layerInfoLength = out.pos() - layerInfoStart - lengthBytes;
+  QByteArray padding((align - layerInfoLength % align) % align, 0);
+  layerInfoLength += padding.size();
+  put<quint32>(padding, 0); // No global layer mask
+  if (!out.write(padding))
+    return false;
+  qint64 layerMaskLength = out.pos() - layerMaskStart - lengthBytes;
+  if (!large && layerMaskLength > 0xffffffffll)
+    return fail("The layers are too large for a PSD file; save as PSB.");
+
+  QByteArray lengths;
+  putLength(lengths, quint64(layerMaskLength), large);
+  putLength(lengths, quint64(layerInfoLength), large);
+  if (!out.patch(layerMaskStart, lengths))
+    return false;
+
+  // The merged image is the last pass over the layers
+  if (!writeChannels(
+          out, size, MergedChannels, 3, true,
+          [&](const QRect &rect) {
+            return LayerManager::takeComposite(layers, rect);
+          },
+          proceed, nullptr))
+    return false;
+
+  if (!file.commit())
+    return fail(file.errorString());
+  if (progress)
+    progress(steps, steps);
+  return true;
+}
+
+namespace {
+// Big-endian reads; a short read clears ok()
+class Input {
+public:
+  explicit Input(QFileDevice &file) : m_file(file), m_ok(true) {}
+
+  bool ok() const { return m_ok; }
+  bool large = false;
+
+  template <typename T> T get() {
+    char bytes[sizeof(T)];
+    if (m_file.read(bytes, sizeof(T)) != qint64(sizeof(T))) {
+      m_ok = false;
+      return T(0);
+    }
+    return qFromBigEndian<T>(bytes);
+  }
+
+  quint64 length() { return large ? get<quint64>() : get<quint32>(); }
+
+  QByteArray bytes(quint64 size) {
+    QByteArray data = m_file.read(qint64(size));
+    if (quint64(data.size()) != size)
+      m_ok = false;
+    return data;
+  }
+
+  qint64 pos() const { return m_file.pos(); }
+  void seek(qint64 position) {
+    if (!m_file.seek(position))
+      m_ok = false;
+  }
+  void skip(quint64 size) { seek(pos() + qint64(size)); }
+
+private:
+  QFileDevice &m_file;
+  bool m_ok;
+};
+} // namespace
+
+// Decodes one channel block (compression tag and data) into a width x
+// height plane
+static bool decodeChannel(const QByteArray &block, int width, int height,
+                          bool large, std::vector<quint8> &plane) {
+  if (block.size() < 2)
+    return false;
+  quint16 compression = qFromBigEndian<quint16>(block.constData());
+  const quint8 *data = reinterpret_cast<const quint8 *>(block.constData()) + 2;
+  qint64 size = block.size() - 2;
+  qint64 planeSize = qint64(width) * height;
+  plane.assign(size_t(planeSize), 0);
+
+  switch (compression) {
+  case RawData:
+    if (size < planeSize)
+      return false;
+    std::memcpy(plane.data(), data, size_t(planeSize));
+    return true;
+
+  case RleData: {
+    int countBytes = large ? 4 : 2;
+    qint64 offset = qint64(countBytes) * height;
+    if (size < offset)
+      return false;
+    for (int y = 0; y < height; ++y) {
+      qint64 count = large ? qFromBigEndian<quint32>(data + 4 * y)
+                           : qFromBigEndian<quint16>(data + 2 * y);
+      if (offset + count > size ||
+          !unpackBits(data + offset, count, plane.data() + qint64(y) * width,
+                      width))
+        return false;
+      offset += count;
+    }
+    return true;
+  }
+
+  case ZipData:
+  case ZipPredictedData: {
+    uLongf unpacked = uLongf(planeSize);
+    if (uncompress(plane.data(), &unpacked, data, uLong(size)) != Z_OK ||
+        qint64(unpacked) != planeSize)
+      return false;
+    // Prediction stores each byte as the difference to the one before
+    if (compression == ZipPredictedData) {
+      for (int y = 0; y < height; ++y) {
+        quint8 *row = plane.data() + qint64(y) * width;
+        for (int x = 1; x < width; ++x)
+          row[x] = quint8(row[x] + row[x - 1]);
+      }
+    }
+    return true;
+  }
+  }
+  return false;
+}
+
+// Stores plane as the byte at shift of every pixel of image (ARGB32)
+static void mergeChannel(QImage &image, const std::vector<quint8> &plane,
+                         int shift) {
+  int width = image.width();
+  QRgb mask = ~(QRgb(0xff) << shift);
+  parallelFor(image.height(), [&](int y) {
+    QRgb *row = reinterpret_cast<QRgb *>(image.scanLine(y));
+    const quint8 *source = plane.data() + qint64(y) * width;
+    for (int x = 0; x < width; ++x)
+      row[x] = (row[x] & mask) | (QRgb(source[x]) << shift);
+  });
+}
+
+static bool readRecord(Input &in, LayerRecord &record) {
+  qint32 top = in.get<qint32>();
+  qint32 left = in.get<qint32>();
+  qint32 bottom = in.get<qint32>();
+  qint32 right = in.get<qint32>();
+  record.rect = QRect(QPoint(left, top), QPoint(right - 1, bottom - 1));
+
+  int channels = in.get<quint16>();
+  for (int c = 0; c < channels && in.ok(); ++c) {
+    qint16 id = in.get<qint16>();
+    record.channels.push_back({id, in.length()});
+  }
+
+  if (in.bytes(4) != "8BIM")
+    return false;
+  QByteArray key = in.bytes(4);
+  for (int mode = Layer::Normal; mode <= Layer::Overlay; ++mode) {
+    if (key == BlendKeys[mode])
+      record.mode = Layer::BlendMode(mode);
+  }
+  record.opacity = in.get<quint8>() / 255.0;
+  record.clipping = in.get<quint8>() != 0;
+  record.visible = !(in.get<quint8>() & 2);
+  in.get<quint8>();
+
+  quint32 extraLength = in.get<quint32>();
+  qint64 extraEnd = in.pos() + extraLength;
+  in.skip(in.get<quint32>()); // Layer mask
+  in.skip(in.get<quint32>()); // Blending ranges
+  int nameLength = in.get<quint8>();
+  record.name = QString::fromLatin1(in.bytes(nameLength));
+  in.skip((4 - (nameLength + 1) % 4) % 4);
+
+  // Additional information blocks fill the rest
+  while (in.ok() && in.pos() + 12 <= extraEnd) {
+    QByteArray signature = in.bytes(4);
+    if (signature != "8BIM" && signature != "8B64")
+      break;
+    QByteArray key = in.bytes(4);
+    bool longLength = false;
+    for (const char *block : LongBlocks)
+      longLength |= in.large && key == block;
+    quint64 length = longLength ? in.get<quint64>() : in.get<quint32>();
+    qint64 next = in.pos() + qint64(length + (length & 1));
+
+    if (key == "luni" && length >= 4) {
+      quint32 count = in.get<quint32>();
+      QString name;
+      for (quint32 i = 0; i < count && in.ok(); ++i)
+        name += QChar(in.get<quint16>());
+      record.name = name;
+    } else if ((key == "lsct" || key == "lsdk") && length >= 4) {
+      quint32 type = in.get<quint32>();
+      record.divider = type >= 1 && type <= 3;
+    }
+    in.seek(next);
+  }
+  in.seek(extraEnd);
+  return in.ok();
+}
+
+bool PsdFile::read(const QString &fileName, AriaFile::Document &document,
+                   const Progress &progress, QString *error) {
+  auto fail = [&](const QString &message) {
+    if (error)
+      *error = message;
+    return false;
+  };
+  const QString damaged = "The file is damaged or truncated.";
+
+  QFile file(fileName);
+  if (!file.open(QIODevice::ReadOnly))
+    return fail(file.errorString());
+  Input in(file);
+
+  if (in.bytes(4) != "8BPS")
+    return fail("Not a Photoshop file.");
+  quint16 version = in.get<quint16>();
+  if (version != 1 && version != 2)
+    return fail("Unsupported Photoshop file version.");
+  in.large = version == 2;
+  in.bytes(6);
+  int channels = in.get<quint16>();
+  int height = int(in.get<quint32>());
+  int width = int(in.get<quint32>());
+  int depth = in.get<quint16>();
+  int mode = in.get<quint16>();
+  if (!in.ok() || width <= 0 || height <= 0 || width > MaxPsbSize ||
+      height > MaxPsbSize)
+    return fail(damaged);
+  if (depth != 8 || mode != 3)
+    return fail("Only 8-bit RGB Photoshop files are supported.");
+
+  in.skip(in.get<quint32>()); // Color mode data
+  in.skip(in.get<quint32>()); // Image resources
+  quint64 layerMaskLength = in.length();
+  qint64 layerMaskEnd = in.pos() + qint64(layerMaskLength);
+
+  std::vector<LayerRecord> records;
+  if (layerMaskLength > 0 && in.length() > 0) {
+    // A negative count only says the merged image has transparency
+    int count = qAbs(in.get<qint16>());
+    for (int i = 0; i < count; ++i) {
+      LayerRecord record;
+      if (!readRecord(in, record))
+        return fail(damaged);
+      records.push_back(record);
+    }
+  }
+  if (!in.ok())
+    return fail(damaged);
+
+  document.size = QSize(width, height);
+  document.currentLayer = 0;
+  document.layers.clear();
+
+  // Channel data follows the records in the same order, bottom layer
+  // first; each layer is decoded on its own and dropped into its tiles
+  int count = int(records.size());
+  std::vector<quint8> plane;
+  for (int i = 0; i < count; ++i) {
+    if (progress && !progress(i, count))
+      return false;
+
+    const LayerRecord &record = records[i];
+    QImage image;
+    if (!record.divider && !record.rect.isEmpty()) {
+      image = QImage(record.rect.size(), QImage::Format_ARGB32);
+      if (image.isNull())
+        return fail("Not enough memory to read the layers.");
+      image.fill(0xff000000); // Opaque unless there is an alpha channel
+    }
+
+    for (const auto &[id, length] : record.channels) {
+      QByteArray block = in.bytes(length);
+      if (!in.ok())
+        return fail(damaged);
+      if (image.isNull() || id < -1 || id > 2)
+        continue; // Masks
+      if (!decodeChannel(block, image.width(), image.height(), in.large,
+                         plane))
+        return fail(damaged);
+      mergeChannel(image, plane, id < 0 ? 24 : 16 - 8 * id);
+    }
+    if (record.divider)
+      continue;
+
+    auto layer = std::make_unique<Layer>(record.name, width, height);
+    layer->setOpacity(record.opacity);
+    layer->setVisible(record.visible);
+    layer->setBlendMode(record.mode);
+    layer->setClippingMask(record.clipping);
+    if (!image.isNull()) {
+      image.convertTo(QImage::Format_ARGB32_Premultiplied);
+      layer->tiles().placeImage(image, record.rect.topLeft());
+    }
+    document.layers.push_back(std::move(layer));
+  }
+
+  if (document.layers.empty()) {
+    // A flat file: the merged image is planar, RLE row lengths for all
+    // channels first
+    in.seek(layerMaskEnd);
+    quint16 compression = in.get<quint16>();
+    if (!in.ok() || (compression != RawData && compression != RleData) ||
+        channels < 3)
+      return fail(damaged);
+
+    int countBytes = in.large ? 4 : 2;
+    QByteArray table;
+    if (compression == RleData)
+      table = in.bytes(quint64(countBytes) * height * channels);
+
+    QImage image(width, height, QImage::Format_ARGB32);
+    if (image.isNull())
+      return fail("Not enough memory to read the image.");
+    image.fill(0xff000000);
+    for (int c = 0; c < 3; ++c) {
+      QByteArray block;
+      put<quint16>(block, compression);
+      quint64 size = quint64(width) * height;
+      if (compression == RleData) {
+        QByteArray counts = table.mid(qsizetype(countBytes) * height * c,
+                                      qsizetype(countBytes) * height);
+        size = 0;
+        for (int y = 0; y < height; ++y) {
+          const char *entry = counts.constData() + countBytes * y;
+          size += in.large ? qFromBigEndian<quint32>(entry)
+                           : qFromBigEndian<quint16>(entry);
+        }
+        block += counts;
+      }
+      block += in.bytes(size);
+      if (!in.ok() ||
+          !decodeChannel(block, width, height, in.large, plane))
+        return fail(damaged);
+      mergeChannel(image, plane, MergedChannels[c].shift);
+    }
+
+    auto layer = std::make_unique<Layer>("Background", width, height);
+    image.convertTo(QImage::Format_ARGB32_Premultiplied);
+    layer->tiles().placeImage(image, QPoint(0, 0));
+    document.layers.push_back(std::move(layer));
+  }
+
+  if (progress)
+    progress(count, count);
+  return true;
+}
@@ -0,0 +1,38 @@
+#ifndef PSDFILE_H
+#define PSDFILE_H
+
+#include "io/ariafile.h"
+#include "io/progress.h"
+#include <QString>
+#include <memory>
+#include <vector>
+
+// Adobe Photoshop documents in 8-bit RGB: .psd, and .psb (the large
+// document format) for images past 30000 px. Name, opacity, visibility,
+// clipping and the Normal, Multiply, Screen and Overlay blend modes
+// round-trip. Other blend modes read as Normal, group folders are
+// flattened into the layer list, and layer masks and adjustment layers
+// are skipped.
+class PsdFile {
+public:
+  static constexpr int MaxPsdSize = 30000;
+  static constexpr int MaxPsbSize = 300000;
+
+  // Channels are PackBits-compressed band by band in parallel. PSD keeps
+  // each channel in one piece, so all but the first are spilled to
+  // temporary files until their turn, and only a batch of bands is ever
+  // in memory. The layers are consumed: tiles are dropped once written.
+  static bool write(const QString &fileName,
+                    std::vector<std::unique_ptr<Layer>> &layers, bool large,
+                    const Progress &progress = Progress(),
+                    QString *error = nullptr);
+
+  // Layers are decoded one at a time straight into their tiles and added
+  // to document as they are done; progress counts layers. A file without
+  // layers gives its merged image as the only one.
+  static bool read(const QString &fileName, AriaFile::Document &document,
+                   const Progress &progress = Progress(),
+                   QString *error = nullptr);
+};
+
+#endif // PSDFILE_H
@@ -0,0 +1,254 @@
+#include "zipfile.h"
+
+#include <QDateTime>
+#include <QFileDevice>
+#include <QtEndian>
+#include <zlib.h>
+
+static const quint32 LocalHeaderSignature = 0x04034b50;
+static const quint32 CentralHeaderSignature = 0x02014b50;
+static const quint32 EndSignature = 0x06054b50;
+static const int LocalHeaderSize = 30;
+static const int CentralHeaderSize = 46;
+static const int EndSize = 22;
+static const quint16 ZipVersion = 20; // 2.0: what stored entries need
+static const quint16 Utf8Names = 0x0800;
+static const quint16 Stored = 0;
+static const quint16 Deflated = 8;
+static const qint64 MaxOffset = 0xffffffffll;
+
+static void put16(QByteArray &data, quint16 value) {
+  char bytes[2];
+  qToLittleEndian(value, bytes);
+  data.append(bytes, 2);
+}
+
+static void put32(QByteArray &data, quint32 value) {
+  char bytes[4];
+  qToLittleEndian(value, bytes);
+  data.append(bytes, 4);
+}
+
+static quint16 get16(const QByteArray &data, int offset) {
+  return qFromLittleEndian<quint16>(data.constData() + offset);
+}
+
+static quint32 get32(const QByteArray &data, int offset) {
+  return qFromLittleEndian<quint32>(data.constData() + offset);
+}
+
+ZipWriter::ZipWriter(QFileDevice *file) : m_file(file), m_entry() {
+  QDateTime now = QDateTime::currentDateTime();
+  QDate date = now.date();
+  QTime time = now.time();
+  m_time = quint16((time.hour() << 11) | (time.minute() << 5) |
+                   (time.second() / 2));
+  m_date = quint16(((qMax(date.year(), 1980) - 1980) << 9) |
+                   (date.month() << 5) | date.day());
+}
+
+bool ZipWriter::beginEntry(const QString &name) {
+  m_entry = Entry();
+  m_entry.name = name.toUtf8();
+  qint64 offset = m_file->pos();
+  if (offset > MaxOffset)
+    return fail("The archive is too large.");
+  m_entry.offset = quint32(offset);
+  m_entry.crc = crc32(0, Z_NULL, 0);
+
+  // CRC and sizes are filled in by endEntry()
+  QByteArray header;
+  put32(header, LocalHeaderSignature);
+  put16(header, ZipVersion);
+  put16(header, Utf8Names);
+  put16(header, Stored);
+  put16(header, m_time);
+  put16(header, m_date);
+  put32(header, 0);
+  put32(header, 0);
+  put32(header, 0);
+  put16(header, quint16(m_entry.name.size()));
+  put16(header, 0);
+  header += m_entry.name;
+  if (m_file->write(header) != header.size())
+    return fail(m_file->errorString());
+  return true;
+}
+
+bool ZipWriter::write(const QByteArray &data) {
+  if (qint64(m_entry.size) + data.size() > MaxOffset)
+    return fail("An entry is too large for the archive.");
+  m_entry.crc = crc32(m_entry.crc,
+                      reinterpret_cast<const Bytef *>(data.constData()),
+                      uInt(data.size()));
+  m_entry.size += quint32(data.size());
+  if (m_file->write(data) != data.size())
+    return fail(m_file->errorString());
+  return true;
+}
+
+bool ZipWriter::endEntry() {
+  QByteArray sizes;
+  put32(sizes, m_entry.crc);
+  put32(sizes, m_entry.size); // Compressed
+  put32(sizes, m_entry.size);
+
+  qint64 end = m_file->pos();
+  if (!m_file->seek(m_entry.offset + 14) ||
+      m_file->write(sizes) != sizes.size() || !m_file->seek(end))
+    return fail(m_file->errorString());
+  m_entries.push_back(m_entry);
+  return true;
+}
+
+bool ZipWriter::finish() {
+  qint64 start = m_file->pos();
+  QByteArray directory;
+  for (const Entry &entry : m_entries) {
+    put32(directory, CentralHeaderSignature);
+    put16(directory, ZipVersion); // Made by
+    put16(directory, ZipVersion); // Needed
+    put16(directory, Utf8Names);
+    put16(directory, Stored);
+    put16(directory, m_time);
+    put16(directory, m_date);
+    put32(directory, entry.crc);
+    put32(directory, entry.size);
+    put32(directory, entry.size);
+    put16(directory, quint16(entry.name.size()));
+    put16(directory, 0); // Extra field
+    put16(directory, 0); // Comment
+    put16(directory, 0); // Disk
+    put16(directory, 0); // Internal attributes
+    put32(directory, 0); // External attributes
+    put32(directory, entry.offset);
+    directory += entry.name;
+  }
+  quint32 directorySize = quint32(directory.size());
+  if (start + directorySize > MaxOffset || m_entries.size() > 0xffff)
+    return fail("The archive is too large.");
+
+  put32(directory, EndSignature);
+  put16(directory, 0); // Disk
+  put16(directory, 0); // Disk with the directory
+  put16(directory, quint16(m_entries.size()));
+  put16(directory, quint16(m_entries.size()));
+  put32(directory, directorySize);
+  put32(directory, quint32(start));
+  put16(directory, 0); // Comment
+  if (m_file->write(directory) != directory.size())
+    return fail(m_file->errorString());
+  return true;
+}
+
+bool ZipWriter::fail(const QString &error) {
+  m_error = error;
+  return false;
+}
+
+ZipReader::ZipReader(QFileDevice *file) : m_file(file) {}
+
+bool ZipReader::open() {
+  // The end record sits within the last 64 KB (its comment) of the file
+  qint64 size = m_file->size();
+  qint64 tail = qMin<qint64>(size, EndSize + 0xffff);
+  if (!m_file->seek(size - tail))
+    return fail(m_file->errorString());
+  QByteArray end = m_file->read(tail);
+
+  int found = -1;
+  for (int i = end.size() - EndSize; i >= 0 && found < 0; --i) {
+    if (get32(end, i) == EndSignature)
+      found = i;
+  }
+  if (found < 0)
+    return fail("Not a zip archive.");
+
+  int count = get16(end, found + 10);
+  quint32 directorySize = get32(end, found + 12);
+  quint32 directoryOffset = get32(end, found + 16);
+  if (!m_file->seek(directoryOffset))
+    return fail(m_file->errorString());
+  QByteArray directory = m_file->read(directorySize);
+  if (directory.size() != qint64(directorySize))
+    return fail("The archive is truncated.");
+
+  int offset = 0;
+  for (int i = 0; i < count; ++i) {
+    if (offset + CentralHeaderSize > directory.size() ||
+        get32(directory, offset) != CentralHeaderSignature)
+      return fail("The archive directory is damaged.");
+
+    Entry entry;
+    entry.method = get16(directory, offset + 10);
+    entry.crc = get32(directory, offset + 16);
+    entry.compressedSize = get32(directory, offset + 20);
+    entry.size = get32(directory, offset + 24);
+    int nameSize = get16(directory, offset + 28);
+    int extraSize = get16(directory, offset + 30);
+    int commentSize = get16(directory, offset + 32);
+    entry.offset = get32(directory, offset + 42);
+    QString name = QString::fromUtf8(
+        directory.mid(offset + CentralHeaderSize, nameSize));
+    m_entries.insert(name, entry);
+    offset += CentralHeaderSize + nameSize + extraSize + commentSize;
+  }
+  return true;
+}
+
+bool ZipReader::contains(const QString &name) const {
+  return m_entries.contains(name);
+}
+
+bool ZipReader::read(const QString &name, QByteArray &data) {
+  auto it = m_entries.constFind(name);
+  if (it == m_entries.constEnd())
+    return fail("The archive has no " + name + ".");
+  const Entry &entry = *it;
+
+  // The local header repeats the name and may have its own extra field
+  if (!m_file->seek(entry.offset))
+    return fail(m_file->errorString());
+  QByteArray header = m_file->read(LocalHeaderSize);
+  if (header.size() != LocalHeaderSize ||
+      get32(header, 0) != LocalHeaderSignature)
+    return fail("The archive entry " + name + " is damaged.");
+  qint64 start = qint64(entry.offset) + LocalHeaderSize +
+                 get16(header, 26) + get16(header, 28);
+  if (!m_file->seek(start))
+    return fail(m_file->errorString());
+  QByteArray stored = m_file->read(entry.compressedSize);
+  if (stored.size() != qint64(entry.compressedSize))
+    return fail("The archive is truncated.");
+
+  if (entry.method == Stored) {
+    data = stored;
+  } else if (entry.method == Deflated) {
+    data = QByteArray(qsizetype(entry.size), Qt::Uninitialized);
+    z_stream stream = {};
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+      return fail("Not enough memory.");
+    stream.next_in = reinterpret_cast<Bytef *>(stored.data());
+    stream.avail_in = uInt(stored.size());
+    stream.next_out = reinterpret_cast<Bytef *>(data.data());
+    stream.avail_out = uInt(data.size());
+    int result = inflate(&stream, Z_FINISH);
+    inflateEnd(&stream);
+    if (result != Z_STREAM_END || stream.total_out != entry.size)
+      return fail("The archive entry " + name + " is damaged.");
+  } else {
+    return fail("The archive uses an unsupported compression method.");
+  }
+
+  quint32 crc = crc32(crc32(0, Z_NULL, 0),
+                      reinterpret_cast<const Bytef *>(data.constData()),
+                      uInt(data.size()));
+  if (crc != entry.crc)
+    return fail("The archive entry " + name + " is damaged.");
+  return true;
+}
+
+bool ZipReader::fail(const QString &error) {
+  m_error = error;
+  return false;
+}
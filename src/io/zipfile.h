@@ -0,0 +1,73 @@
+#ifndef ZIPFILE_H
+#define ZIPFILE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <vector>
+
+class QFileDevice;
+
+// Just enough of the zip format for OpenRaster. The writer stores entries
+// uncompressed, since they are PNGs and a little XML; each one is
+// streamed and its header patched afterwards, so the file must be
+// seekable. The reader takes stored and deflated entries. Archives past
+// 4 GB (zip64) are not supported.
+class ZipWriter {
+public:
+  explicit ZipWriter(QFileDevice *file);
+
+  bool beginEntry(const QString &name);
+  bool write(const QByteArray &data);
+  bool endEntry();
+  // Writes the central directory, which completes the archive
+  bool finish();
+
+  QString errorString() const { return m_error; }
+
+private:
+  struct Entry {
+    QByteArray name; // UTF-8
+    quint32 crc;
+    quint32 size;
+    quint32 offset; // Of the local header
+  };
+
+  bool fail(const QString &error);
+
+  QFileDevice *m_file;
+  std::vector<Entry> m_entries;
+  Entry m_entry; // Being written
+  quint16 m_time; // DOS format
+  quint16 m_date;
+  QString m_error;
+};
+
+class ZipReader {
+public:
+  explicit ZipReader(QFileDevice *file);
+
+  // Reads the central directory
+  bool open();
+  bool contains(const QString &name) const;
+  bool read(const QString &name, QByteArray &data);
+
+  QString errorString() const { return m_error; }
+
+private:
+  struct Entry {
+    quint16 method;
+    quint32 crc;
+    quint32 compressedSize;
+    quint32 size;
+    quint32 offset; // Of the local header
+  };
+
+  bool fail(const QString &error);
+
+  QFileDevice *m_file;
+  QHash<QString, Entry> m_entries;
+  QString m_error;
+};
+
+#endif // ZIPFILE_H
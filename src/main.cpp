@@ -1,11 +1,33 @@
 #include "core/canvas.h"
+#include "core/tileswap.h"
 #include "ui/dialogs/welcomedialog.h"
 #include "ui/mainwindow.h"
 #include <QApplication>
 #include <QFile>
+#include <QImageReader>
 #include <QTextStream>
 
 int main(int argc, char *argv[]) {
+  // Deliver every mouse and pen sample instead of merging moves that
+  // arrive within one frame; the canvas smooths and paints all of them
+  QCoreApplication::setAttribute(Qt::AA_CompressHighFrequencyEvents, false);
+  QCoreApplication::setAttribute(Qt::AA_CompressTabletEvents, false);
+
+  // ARIA_CANVAS_BACKEND=software presents the canvas through a software
+  // OpenGL rasterizer (llvmpipe, or opengl32sw on Windows), e.g. on
+  // machines without a GPU; =raster skips OpenGL altogether
+  if (qgetenv("ARIA_CANVAS_BACKEND") == "software") {
+    qputenv("LIBGL_ALWAYS_SOFTWARE", "1");
+    QCoreApplication::setAttribute(Qt::AA_UseSoftwareOpenGL);
+  }
+
+  // Qt refuses to decode images over 256 MB by default, and scans are
+  // often larger. Allow up to half the RAM instead, which still stops
+  // decompression bombs.
+  qint64 memory = TileSwap::physicalMemory();
+  if (memory > 0)
+    QImageReader::setAllocationLimit(int(memory / 2 / (1024 * 1024)));
+
   QApplication app(argc, argv);
 
   // Set application metadata
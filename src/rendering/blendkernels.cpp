@@ -0,0 +1,130 @@
+#include "blendkernels.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#define ARIA_X86_DISPATCH
+#if defined(_MSC_VER)
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+#endif
+
+// Scalar reference kernels. They mirror the integer formulas of Qt's raster
+// composition functions so the vector variants and QPainter agree bit for
+// bit on premultiplied input.
+
+static inline int div255(int x) { return (x + (x >> 8) + 0x80) >> 8; }
+
+static inline int mixAlpha(int da, int sa) {
+  return 255 - div255((255 - sa) * (255 - da));
+}
+
+static inline QRgb interpolate(QRgb result, QRgb dest, int ca) {
+  int cia = 255 - ca;
+  return qRgba(div255(qRed(result) * ca + qRed(dest) * cia),
+               div255(qGreen(result) * ca + qGreen(dest) * cia),
+               div255(qBlue(result) * ca + qBlue(dest) * cia),
+               div255(qAlpha(result) * ca + qAlpha(dest) * cia));
+}
+
+static inline QRgb byteMul(QRgb pixel, int a) {
+  return qRgba(div255(qRed(pixel) * a), div255(qGreen(pixel) * a),
+               div255(qBlue(pixel) * a), div255(qAlpha(pixel) * a));
+}
+
+static void sourceOver(QRgb *dest, const QRgb *src, int count,
+                       int constAlpha) {
+  for (int i = 0; i < count; ++i) {
+    QRgb s = constAlpha == 255 ? src[i] : byteMul(src[i], constAlpha);
+    int sa = qAlpha(s);
+    if (sa == 255) {
+      dest[i] = s;
+    } else if (s != 0) {
+      QRgb d = byteMul(dest[i], 255 - sa);
+      dest[i] = qRgba(qRed(s) + qRed(d), qGreen(s) + qGreen(d),
+                      qBlue(s) + qBlue(d), sa + qAlpha(d));
+    }
+  }
+}
+
+static inline int multiplyOp(int d, int s, int da, int sa) {
+  return div255(s * d + s * (255 - da) + d * (255 - sa));
+}
+
+static inline int screenOp(int d, int s, int, int) {
+  return s + d - div255(s * d);
+}
+
+static inline int overlayOp(int d, int s, int da, int sa) {
+  int temp = s * (255 - da) + d * (255 - sa);
+  if (2 * d < da)
+    return div255(2 * s * d + temp);
+  return div255(sa * da - 2 * (da - d) * (sa - s) + temp);
+}
+
+template <int (*Op)(int, int, int, int)>
+static void separable(QRgb *dest, const QRgb *src, int count,
+                      int constAlpha) {
+  for (int i = 0; i < count; ++i) {
+    QRgb d = dest[i];
+    QRgb s = src[i];
+    int da = qAlpha(d);
+    int sa = qAlpha(s);
+
+    QRgb result = qRgba(Op(qRed(d), qRed(s), da, sa),
+                        Op(qGreen(d), qGreen(s), da, sa),
+                        Op(qBlue(d), qBlue(s), da, sa), mixAlpha(da, sa));
+    dest[i] = constAlpha == 255 ? result : interpolate(result, d, constAlpha);
+  }
+}
+
+static void clipToAlpha(QRgb *dest, const QRgb *src, const QRgb *mask,
+                        int count) {
+  for (int i = 0; i < count; ++i)
+    dest[i] = byteMul(src[i], qAlpha(mask[i]));
+}
+
+const BlendKernels *scalarBlendKernels() {
+  static const BlendKernels kernels = {
+      "scalar", sourceOver, separable<multiplyOp>, separable<screenOp>,
+      separable<overlayOp>, clipToAlpha};
+  return &kernels;
+}
+
+#ifdef ARIA_X86_DISPATCH
+static bool cpuHasSse41() {
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  return info[2] & (1 << 19);
+#else
+  return __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+static bool cpuHasAvx2() {
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  // The OS must also save the YMM registers (OSXSAVE + XCR0 bits 1 and 2)
+  bool osSupport = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) &&
+                   (_xgetbv(0) & 6) == 6;
+  __cpuidex(info, 7, 0);
+  return osSupport && (info[1] & (1 << 5));
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+std::vector<const BlendKernels *> availableBlendKernels() {
+  std::vector<const BlendKernels *> sets = {scalarBlendKernels()};
+#ifdef ARIA_X86_DISPATCH
+  if (cpuHasSse41() && sse41BlendKernels())
+    sets.push_back(sse41BlendKernels());
+  if (cpuHasAvx2() && avx2BlendKernels())
+    sets.push_back(avx2BlendKernels());
+#endif
+  if (neonBlendKernels())
+    sets.push_back(neonBlendKernels());
+  return sets;
+}
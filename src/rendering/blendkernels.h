@@ -0,0 +1,44 @@
+#ifndef BLENDKERNELS_H
+#define BLENDKERNELS_H
+
+#include <QColor>
+#include <QtGlobal>
+#include <vector>
+
+// Row kernels blending premultiplied ARGB32 src onto dest. constAlpha is
+// the layer opacity in 0-255 (255 = opaque). Each instruction set fills in
+// one table; entries follow the formulas of Qt's raster engine so results
+// match QPainter's composition modes.
+typedef void (*BlendRowFunc)(QRgb *dest, const QRgb *src, int count,
+                             int constAlpha);
+// dest = src scaled by the alpha of mask (clipping masks)
+typedef void (*MaskRowFunc)(QRgb *dest, const QRgb *src, const QRgb *mask,
+                            int count);
+
+struct BlendKernels {
+  const char *name;
+  BlendRowFunc sourceOver;
+  BlendRowFunc multiply;
+  BlendRowFunc screen;
+  BlendRowFunc overlay;
+  MaskRowFunc clipToAlpha;
+};
+
+// Always available reference implementation
+const BlendKernels *scalarBlendKernels();
+
+// Return nullptr when the kernels were not compiled for this target
+const BlendKernels *sse41BlendKernels();
+const BlendKernels *avx2BlendKernels();
+const BlendKernels *neonBlendKernels();
+
+// The kernel sets that were compiled in and that the running CPU supports,
+// scalar first and the fastest last
+std::vector<const BlendKernels *> availableBlendKernels();
+
+// The constAlpha a raster blend uses after QPainter::setOpacity(opacity)
+inline int blendConstAlpha(double opacity) {
+  return (qRound(qBound(0.0, opacity, 1.0) * 256) * 255) >> 8;
+}
+
+#endif // BLENDKERNELS_H
@@ -0,0 +1,49 @@
+#include "blendkernels.h"
+
+#if defined(__AVX2__)
+#include "blendkernels_impl.h"
+#include <immintrin.h>
+
+// Built with -mavx2 (/arch:AVX2); only called after the runtime CPU check
+struct Avx2Ops {
+  typedef __m256i Vec;
+  static constexpr int Lanes = 8;
+
+  static Vec load(const QRgb *p) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+  }
+  static void store(QRgb *p, Vec v) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v);
+  }
+  static Vec set1(int v) { return _mm256_set1_epi32(v); }
+  static Vec add(Vec a, Vec b) { return _mm256_add_epi32(a, b); }
+  static Vec sub(Vec a, Vec b) { return _mm256_sub_epi32(a, b); }
+  static Vec mul(Vec a, Vec b) { return _mm256_mullo_epi32(a, b); }
+  template <int N> static Vec shiftLeft(Vec v) {
+    return _mm256_slli_epi32(v, N);
+  }
+  template <int N> static Vec shiftRight(Vec v) {
+    return _mm256_srai_epi32(v, N);
+  }
+  static Vec bitAnd(Vec a, Vec b) { return _mm256_and_si256(a, b); }
+  static Vec bitOr(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+  static Vec lessThan(Vec a, Vec b) { return _mm256_cmpgt_epi32(b, a); }
+  static Vec select(Vec mask, Vec a, Vec b) {
+    return _mm256_blendv_epi8(b, a, mask);
+  }
+};
+
+typedef VectorBlend<Avx2Ops> Avx2Blend;
+
+const BlendKernels *avx2BlendKernels() {
+  static const BlendKernels kernels = {
+      "avx2", Avx2Blend::sourceOver, Avx2Blend::multiply, Avx2Blend::screen,
+      Avx2Blend::overlay, Avx2Blend::clipToAlpha};
+  return &kernels;
+}
+
+#else
+
+const BlendKernels *avx2BlendKernels() { return nullptr; }
+
+#endif
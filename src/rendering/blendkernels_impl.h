@@ -0,0 +1,177 @@
+#ifndef BLENDKERNELS_IMPL_H
+#define BLENDKERNELS_IMPL_H
+
+#include "rendering/blendkernels.h"
+
+// Shared body of the vector kernels. Pixels are split into one 32-bit lane
+// per channel, so every formula is the exact integer expression of the
+// scalar reference and the results are bit-identical to it. Ops supplies
+// the instruction set: Vec, Lanes, load/store, set1, add/sub/mul, shifts
+// (arithmetic right shift), and/or, lessThan and select. The unaligned tail goes through the scalar
+// kernel.
+template <typename Ops> struct VectorBlend {
+  typedef typename Ops::Vec Vec;
+
+  static Vec div255(Vec x) {
+    return Ops::template shiftRight<8>(
+        Ops::add(Ops::add(x, Ops::template shiftRight<8>(x)),
+                 Ops::set1(0x80)));
+  }
+
+  template <int Shift> static Vec channel(Vec pixels) {
+    return Ops::bitAnd(Ops::template shiftRight<Shift>(pixels),
+                       Ops::set1(0xff));
+  }
+
+  // Channels are masked like qRgba() does, so out-of-range values from
+  // invalid premultiplied input wrap the same way as in the scalar code
+  static Vec pack(Vec a, Vec r, Vec g, Vec b) {
+    Vec mask = Ops::set1(0xff);
+    a = Ops::bitAnd(a, mask);
+    r = Ops::bitAnd(r, mask);
+    g = Ops::bitAnd(g, mask);
+    b = Ops::bitAnd(b, mask);
+    return Ops::bitOr(
+        Ops::bitOr(Ops::template shiftLeft<24>(a),
+                   Ops::template shiftLeft<16>(r)),
+        Ops::bitOr(Ops::template shiftLeft<8>(g), b));
+  }
+
+  // 255 - (255 - sa) * (255 - da) / 255
+  static Vec mixAlpha(Vec da, Vec sa) {
+    Vec full = Ops::set1(255);
+    return Ops::sub(full, div255(Ops::mul(Ops::sub(full, sa),
+                                          Ops::sub(full, da))));
+  }
+
+  // result * ca + dest * (255 - ca), per channel
+  static Vec interpolate(Vec result, Vec dest, Vec ca, Vec cia) {
+    return div255(Ops::add(Ops::mul(result, ca), Ops::mul(dest, cia)));
+  }
+
+  static void sourceOver(QRgb *dest, const QRgb *src, int count,
+                         int constAlpha) {
+    Vec ca = Ops::set1(constAlpha);
+    Vec full = Ops::set1(255);
+    int i = 0;
+    for (; i + Ops::Lanes <= count; i += Ops::Lanes) {
+      Vec s = Ops::load(src + i);
+      Vec d = Ops::load(dest + i);
+
+      Vec sa = channel<24>(s), sr = channel<16>(s), sg = channel<8>(s),
+          sb = channel<0>(s);
+      if (constAlpha != 255) {
+        sa = div255(Ops::mul(sa, ca));
+        sr = div255(Ops::mul(sr, ca));
+        sg = div255(Ops::mul(sg, ca));
+        sb = div255(Ops::mul(sb, ca));
+      }
+
+      Vec inv = Ops::sub(full, sa);
+      Vec a = Ops::add(sa, div255(Ops::mul(channel<24>(d), inv)));
+      Vec r = Ops::add(sr, div255(Ops::mul(channel<16>(d), inv)));
+      Vec g = Ops::add(sg, div255(Ops::mul(channel<8>(d), inv)));
+      Vec b = Ops::add(sb, div255(Ops::mul(channel<0>(d), inv)));
+      Ops::store(dest + i, pack(a, r, g, b));
+    }
+    scalarBlendKernels()->sourceOver(dest + i, src + i, count - i,
+                                     constAlpha);
+  }
+
+  static void clipToAlpha(QRgb *dest, const QRgb *src, const QRgb *mask,
+                          int count) {
+    int i = 0;
+    for (; i + Ops::Lanes <= count; i += Ops::Lanes) {
+      Vec s = Ops::load(src + i);
+      Vec ma = channel<24>(Ops::load(mask + i));
+      Ops::store(dest + i, pack(div255(Ops::mul(channel<24>(s), ma)),
+                                div255(Ops::mul(channel<16>(s), ma)),
+                                div255(Ops::mul(channel<8>(s), ma)),
+                                div255(Ops::mul(channel<0>(s), ma))));
+    }
+    scalarBlendKernels()->clipToAlpha(dest + i, src + i, mask + i, count - i);
+  }
+
+  // Separable modes: Op::apply(d, s, da, sa) returns one colour channel
+  template <typename Op>
+  static void separable(QRgb *dest, const QRgb *src, int count,
+                        int constAlpha, BlendRowFunc tail) {
+    Vec ca = Ops::set1(constAlpha);
+    Vec cia = Ops::set1(255 - constAlpha);
+    int i = 0;
+    for (; i + Ops::Lanes <= count; i += Ops::Lanes) {
+      Vec s = Ops::load(src + i);
+      Vec d = Ops::load(dest + i);
+
+      Vec da = channel<24>(d), dr = channel<16>(d), dg = channel<8>(d),
+          db = channel<0>(d);
+      Vec sa = channel<24>(s);
+
+      Vec a = mixAlpha(da, sa);
+      Vec r = Op::apply(dr, channel<16>(s), da, sa);
+      Vec g = Op::apply(dg, channel<8>(s), da, sa);
+      Vec b = Op::apply(db, channel<0>(s), da, sa);
+
+      if (constAlpha != 255) {
+        a = interpolate(a, da, ca, cia);
+        r = interpolate(r, dr, ca, cia);
+        g = interpolate(g, dg, ca, cia);
+        b = interpolate(b, db, ca, cia);
+      }
+      Ops::store(dest + i, pack(a, r, g, b));
+    }
+    tail(dest + i, src + i, count - i, constAlpha);
+  }
+
+  struct MultiplyOp {
+    // (s * d + s * (255 - da) + d * (255 - sa)) / 255
+    static Vec apply(Vec d, Vec s, Vec da, Vec sa) {
+      Vec full = Ops::set1(255);
+      return div255(Ops::add(Ops::mul(s, Ops::add(d, Ops::sub(full, da))),
+                             Ops::mul(d, Ops::sub(full, sa))));
+    }
+  };
+
+  struct ScreenOp {
+    // s + d - s * d / 255
+    static Vec apply(Vec d, Vec s, Vec, Vec) {
+      return Ops::sub(Ops::add(s, d), div255(Ops::mul(s, d)));
+    }
+  };
+
+  struct OverlayOp {
+    static Vec apply(Vec d, Vec s, Vec da, Vec sa) {
+      Vec full = Ops::set1(255);
+      Vec temp = Ops::add(Ops::mul(s, Ops::sub(full, da)),
+                          Ops::mul(d, Ops::sub(full, sa)));
+      // 2d < da: multiply, otherwise screen
+      Vec dark = Ops::add(Ops::mul(Ops::add(s, s), d), temp);
+      Vec light = Ops::add(
+          Ops::sub(Ops::mul(sa, da),
+                   Ops::mul(Ops::add(Ops::sub(da, d), Ops::sub(da, d)),
+                            Ops::sub(sa, s))),
+          temp);
+      return div255(Ops::select(Ops::lessThan(Ops::add(d, d), da), dark,
+                                light));
+    }
+  };
+
+  static void multiply(QRgb *dest, const QRgb *src, int count,
+                       int constAlpha) {
+    separable<MultiplyOp>(dest, src, count, constAlpha,
+                          scalarBlendKernels()->multiply);
+  }
+
+  static void screen(QRgb *dest, const QRgb *src, int count, int constAlpha) {
+    separable<ScreenOp>(dest, src, count, constAlpha,
+                        scalarBlendKernels()->screen);
+  }
+
+  static void overlay(QRgb *dest, const QRgb *src, int count,
+                      int constAlpha) {
+    separable<OverlayOp>(dest, src, count, constAlpha,
+                         scalarBlendKernels()->overlay);
+  }
+};
+
+#endif // BLENDKERNELS_IMPL_H
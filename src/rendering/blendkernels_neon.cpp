@@ -0,0 +1,45 @@
+#include "blendkernels.h"
+
+#if defined(__ARM_NEON) || defined(_M_ARM64)
+#include "blendkernels_impl.h"
+#include <arm_neon.h>
+
+// NEON is part of the AArch64 baseline, so no runtime check is needed
+struct NeonOps {
+  typedef int32x4_t Vec;
+  static constexpr int Lanes = 4;
+
+  static Vec load(const QRgb *p) {
+    return vreinterpretq_s32_u32(vld1q_u32(p));
+  }
+  static void store(QRgb *p, Vec v) { vst1q_u32(p, vreinterpretq_u32_s32(v)); }
+  static Vec set1(int v) { return vdupq_n_s32(v); }
+  static Vec add(Vec a, Vec b) { return vaddq_s32(a, b); }
+  static Vec sub(Vec a, Vec b) { return vsubq_s32(a, b); }
+  static Vec mul(Vec a, Vec b) { return vmulq_s32(a, b); }
+  template <int N> static Vec shiftLeft(Vec v) { return vshlq_n_s32(v, N); }
+  template <int N> static Vec shiftRight(Vec v) { return vshrq_n_s32(v, N); }
+  static Vec bitAnd(Vec a, Vec b) { return vandq_s32(a, b); }
+  static Vec bitOr(Vec a, Vec b) { return vorrq_s32(a, b); }
+  static Vec lessThan(Vec a, Vec b) {
+    return vreinterpretq_s32_u32(vcltq_s32(a, b));
+  }
+  static Vec select(Vec mask, Vec a, Vec b) {
+    return vbslq_s32(vreinterpretq_u32_s32(mask), a, b);
+  }
+};
+
+typedef VectorBlend<NeonOps> NeonBlend;
+
+const BlendKernels *neonBlendKernels() {
+  static const BlendKernels kernels = {
+      "neon", NeonBlend::sourceOver, NeonBlend::multiply, NeonBlend::screen,
+      NeonBlend::overlay, NeonBlend::clipToAlpha};
+  return &kernels;
+}
+
+#else
+
+const BlendKernels *neonBlendKernels() { return nullptr; }
+
+#endif
@@ -0,0 +1,47 @@
+#include "blendkernels.h"
+
+#if defined(__SSE4_1__) || (defined(_MSC_VER) && defined(_M_X64))
+#include "blendkernels_impl.h"
+#include <smmintrin.h>
+
+// Built with -msse4.1; only called after the runtime CPU check
+struct Sse41Ops {
+  typedef __m128i Vec;
+  static constexpr int Lanes = 4;
+
+  static Vec load(const QRgb *p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+  }
+  static void store(QRgb *p, Vec v) {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(p), v);
+  }
+  static Vec set1(int v) { return _mm_set1_epi32(v); }
+  static Vec add(Vec a, Vec b) { return _mm_add_epi32(a, b); }
+  static Vec sub(Vec a, Vec b) { return _mm_sub_epi32(a, b); }
+  static Vec mul(Vec a, Vec b) { return _mm_mullo_epi32(a, b); }
+  template <int N> static Vec shiftLeft(Vec v) { return _mm_slli_epi32(v, N); }
+  template <int N> static Vec shiftRight(Vec v) {
+    return _mm_srai_epi32(v, N);
+  }
+  static Vec bitAnd(Vec a, Vec b) { return _mm_and_si128(a, b); }
+  static Vec bitOr(Vec a, Vec b) { return _mm_or_si128(a, b); }
+  static Vec lessThan(Vec a, Vec b) { return _mm_cmplt_epi32(a, b); }
+  static Vec select(Vec mask, Vec a, Vec b) {
+    return _mm_blendv_epi8(b, a, mask);
+  }
+};
+
+typedef VectorBlend<Sse41Ops> Sse41Blend;
+
+const BlendKernels *sse41BlendKernels() {
+  static const BlendKernels kernels = {
+      "sse4.1", Sse41Blend::sourceOver, Sse41Blend::multiply,
+      Sse41Blend::screen, Sse41Blend::overlay, Sse41Blend::clipToAlpha};
+  return &kernels;
+}
+
+#else
+
+const BlendKernels *sse41BlendKernels() { return nullptr; }
+
+#endif
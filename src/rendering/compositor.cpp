@@ -0,0 +1,129 @@
+#include "compositor.h"
+#include "rendering/blendkernels.h"
+
+#include <QByteArray>
+#include <algorithm>
+#include <cstring>
+
+PixelBuffer::PixelBuffer(QImage &image, const QPoint &origin)
+    : m_bits(image.bits()), m_bytesPerLine(image.bytesPerLine()),
+      m_rect(image.rect().translated(origin)) {
+  Q_ASSERT(image.format() == QImage::Format_ARGB32_Premultiplied);
+}
+
+static const BlendKernels *selectKernels() {
+  // ARIA_BLEND_KERNELS=scalar forces the reference kernels, e.g. to compare
+  // output while debugging
+  if (qgetenv("ARIA_BLEND_KERNELS") == "scalar")
+    return scalarBlendKernels();
+  return availableBlendKernels().back();
+}
+
+const BlendKernels &Compositor::kernels() {
+  static const BlendKernels *selected = selectKernels();
+  return *selected;
+}
+
+const char *Compositor::instructionSet() { return kernels().name; }
+
+void Compositor::blendRow(Layer::BlendMode mode, QRgb *dest, const QRgb *src,
+                          int count, double opacity) {
+  int alpha = blendConstAlpha(opacity);
+  if (alpha == 0 || count <= 0)
+    return;
+
+  const BlendKernels &k = kernels();
+  switch (mode) {
+  case Layer::Multiply:
+    k.multiply(dest, src, count, alpha);
+    break;
+  case Layer::Screen:
+    k.screen(dest, src, count, alpha);
+    break;
+  case Layer::Overlay:
+    k.overlay(dest, src, count, alpha);
+    break;
+  default:
+    k.sourceOver(dest, src, count, alpha);
+    break;
+  }
+}
+
+void Compositor::blendTiles(const PixelBuffer &target, const QRect &rect,
+                            const TiledImage &tiles, Layer::BlendMode mode,
+                            double opacity, const TiledImage *clip) {
+  QRect area = rect.intersected(target.rect()).intersected(tiles.rect());
+  if (area.isEmpty() || blendConstAlpha(opacity) == 0)
+    return;
+
+  // Clipped rows are masked into one tile-wide scratch row, never into a
+  // full-size temporary
+  QRgb clipped[TiledImage::TileSize];
+
+  // Absent tiles are transparent and leave the target untouched
+  QRect range = tiles.tileRange(area);
+  for (int ty = range.top(); ty <= range.bottom(); ++ty) {
+    for (int tx = range.left(); tx <= range.right(); ++tx) {
+      const QImage &tile = tiles.tile(tx, ty);
+      if (tile.isNull())
+        continue;
+
+      const QImage *clipTile = clip ? &clip->tile(tx, ty) : nullptr;
+      if (clipTile && clipTile->isNull())
+        continue;
+
+      QRect tileRect = TiledImage::tileRect(tx, ty);
+      QRect part = tileRect.intersected(area);
+      int offset = part.left() - tileRect.left();
+      for (int y = part.top(); y <= part.bottom(); ++y) {
+        const QRgb *src = reinterpret_cast<const QRgb *>(
+                              tile.constScanLine(y - tileRect.top())) +
+                          offset;
+        if (clipTile) {
+          const QRgb *mask = reinterpret_cast<const QRgb *>(
+                                 clipTile->constScanLine(y - tileRect.top())) +
+                             offset;
+          kernels().clipToAlpha(clipped, src, mask, part.width());
+          src = clipped;
+        }
+
+        QRgb *dest = target.pixels(part.left(), y);
+        blendRow(mode, dest, src, part.width(), opacity);
+      }
+    }
+  }
+}
+
+void Compositor::copyTiles(const PixelBuffer &target, const QRect &rect,
+                           const TiledImage &tiles) {
+  QRect area = rect.intersected(target.rect()).intersected(tiles.rect());
+  QRect range = tiles.tileRange(area);
+  for (int ty = range.top(); ty <= range.bottom(); ++ty) {
+    for (int tx = range.left(); tx <= range.right(); ++tx) {
+      const QImage &tile = tiles.tile(tx, ty);
+      QRect tileRect = TiledImage::tileRect(tx, ty);
+      QRect part = tileRect.intersected(area);
+      if (tile.isNull()) {
+        fill(target, part, 0);
+        continue;
+      }
+
+      for (int y = part.top(); y <= part.bottom(); ++y) {
+        const QRgb *src = reinterpret_cast<const QRgb *>(
+                              tile.constScanLine(y - tileRect.top())) +
+                          (part.left() - tileRect.left());
+        std::memcpy(target.pixels(part.left(), y), src,
+                    part.width() * sizeof(QRgb));
+      }
+    }
+  }
+}
+
+void Compositor::fill(const PixelBuffer &target, const QRect &rect,
+                      QRgb color) {
+  QRect area = rect.intersected(target.rect());
+  for (int y = area.top(); y <= area.bottom(); ++y) {
+    QRgb *line = target.pixels(area.left(), y);
+    std::fill(line, line + area.width(), color);
+  }
+}
@@ -0,0 +1,64 @@
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include "core/layer.h"
+#include "core/tiledimage.h"
+#include <QColor>
+#include <QImage>
+#include <QPoint>
+#include <QRect>
+
+struct BlendKernels;
+
+// Writable rows of an ARGB32_Premultiplied image whose top-left pixel sits
+// at origin in canvas coordinates. The image is detached once on
+// construction, so threads can then write disjoint parts through the
+// buffer without touching QImage's (non thread-safe) detach logic.
+class PixelBuffer {
+public:
+  explicit PixelBuffer(QImage &image, const QPoint &origin = QPoint());
+
+  QRect rect() const { return m_rect; }
+  // Pointer to canvas pixel (x, y), which must lie inside rect()
+  QRgb *pixels(int x, int y) const {
+    return reinterpret_cast<QRgb *>(m_bits +
+                                    (y - m_rect.top()) * m_bytesPerLine) +
+           (x - m_rect.left());
+  }
+
+private:
+  uchar *m_bits;
+  qsizetype m_bytesPerLine;
+  QRect m_rect;
+};
+
+// Blends layer pixels into an ARGB32_Premultiplied image with row kernels
+// picked once for the running CPU (AVX2, SSE4.1, NEON or scalar). Output
+// matches QPainter's SourceOver/Multiply/Screen/Overlay composition modes.
+class Compositor {
+public:
+  // Blends count pixels of src onto dest; opacity is 0.0 - 1.0
+  static void blendRow(Layer::BlendMode mode, QRgb *dest, const QRgb *src,
+                       int count, double opacity);
+
+  // Blends the part of tiles inside rect onto target (canvas coordinates).
+  // With a clip image, each pixel is first scaled by the clip's alpha at
+  // the same position (clipping masks); absent clip tiles hide the layer.
+  static void blendTiles(const PixelBuffer &target, const QRect &rect,
+                         const TiledImage &tiles, Layer::BlendMode mode,
+                         double opacity, const TiledImage *clip = nullptr);
+
+  // Replaces target pixels inside rect with those of tiles
+  static void copyTiles(const PixelBuffer &target, const QRect &rect,
+                        const TiledImage &tiles);
+
+  static void fill(const PixelBuffer &target, const QRect &rect, QRgb color);
+
+  // Name of the kernel set in use, e.g. "avx2"
+  static const char *instructionSet();
+
+private:
+  static const BlendKernels &kernels();
+};
+
+#endif // COMPOSITOR_H
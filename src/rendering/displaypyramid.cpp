@@ -0,0 +1,130 @@
+#include "displaypyramid.h"
+#include "rendering/compositor.h"
+#include "rendering/parallelfor.h"
+
+#include <QPoint>
+#include <cmath>
+
+DisplayPyramid::DisplayPyramid() {}
+
+void DisplayPyramid::reset(const QSize &size) {
+  m_size = size;
+  m_levels.clear();
+
+  int width = size.width();
+  int height = size.height();
+  while (width > 1 || height > 1) {
+    width = (width + 1) / 2;
+    height = (height + 1) / 2;
+
+    Level level;
+    level.columns = (width + TileSize - 1) / TileSize;
+    level.rows = (height + TileSize - 1) / TileSize;
+    level.image = QImage(width, height, QImage::Format_ARGB32_Premultiplied);
+    level.stale.assign(level.columns * level.rows, 1);
+    m_levels.push_back(std::move(level));
+  }
+}
+
+void DisplayPyramid::invalidate(const QRect &rect) {
+  QRect area = rect.intersected(QRect(QPoint(0, 0), m_size));
+  for (Level &level : m_levels) {
+    if (area.isEmpty())
+      return;
+
+    // Each level pixel is built from a 2x2 block of the level below
+    area = QRect(QPoint(area.left() / 2, area.top() / 2),
+                 QPoint(area.right() / 2, area.bottom() / 2));
+    for (int ty = area.top() / TileSize; ty <= area.bottom() / TileSize; ++ty) {
+      for (int tx = area.left() / TileSize; tx <= area.right() / TileSize;
+           ++tx)
+        level.stale[ty * level.columns + tx] = 1;
+    }
+  }
+}
+
+int DisplayPyramid::levelForScale(double scale) const {
+  if (scale >= 1.0 || m_levels.empty())
+    return 0;
+
+  // Halve as long as the level stays at or above the display resolution
+  int index = int(std::floor(std::log2(1.0 / scale) + 1e-9));
+  return qBound(0, index, int(m_levels.size()));
+}
+
+const QImage &DisplayPyramid::level(int index, const QImage &base,
+                                    const QRect &rect) {
+  Q_ASSERT(index >= 1 && index <= int(m_levels.size()));
+  Q_ASSERT(base.size() == m_size);
+
+  update(index, base, rect);
+  return m_levels[index - 1].image;
+}
+
+void DisplayPyramid::update(int index, const QImage &base, const QRect &rect) {
+  Level &level = m_levels[index - 1];
+  QRect area = rect.intersected(level.image.rect());
+  if (area.isEmpty())
+    return;
+
+  std::vector<QRect> pending;
+  QRect sourceArea;
+  for (int ty = area.top() / TileSize; ty <= area.bottom() / TileSize; ++ty) {
+    for (int tx = area.left() / TileSize; tx <= area.right() / TileSize;
+         ++tx) {
+      if (!level.stale[ty * level.columns + tx])
+        continue;
+      QRect tileRect = QRect(tx * TileSize, ty * TileSize, TileSize, TileSize)
+                           .intersected(level.image.rect());
+      pending.push_back(tileRect);
+      sourceArea |= QRect(tileRect.left() * 2, tileRect.top() * 2,
+                          tileRect.width() * 2, tileRect.height() * 2);
+    }
+  }
+  if (pending.empty())
+    return;
+
+  // The level below must be current wherever these tiles read from it
+  const QImage *source = &base;
+  if (index > 1) {
+    update(index - 1, base, sourceArea);
+    source = &m_levels[index - 2].image;
+  }
+
+  PixelBuffer target(level.image);
+  parallelFor(pending.size(),
+              [&](int i) { downsample(*source, target, pending[i]); });
+
+  for (const QRect &tileRect : pending) {
+    level.stale[(tileRect.top() / TileSize) * level.columns +
+                tileRect.left() / TileSize] = 0;
+  }
+}
+
+void DisplayPyramid::downsample(const QImage &source,
+                                const PixelBuffer &target, const QRect &rect) {
+  int lastX = source.width() - 1;
+  int lastY = source.height() - 1;
+
+  for (int y = rect.top(); y <= rect.bottom(); ++y) {
+    // Odd sizes repeat the last row / column
+    const QRgb *row0 = reinterpret_cast<const QRgb *>(
+        source.constScanLine(qMin(2 * y, lastY)));
+    const QRgb *row1 = reinterpret_cast<const QRgb *>(
+        source.constScanLine(qMin(2 * y + 1, lastY)));
+    QRgb *dest = target.pixels(0, y);
+
+    for (int x = rect.left(); x <= rect.right(); ++x) {
+      int x0 = qMin(2 * x, lastX);
+      int x1 = qMin(2 * x + 1, lastX);
+      QRgb p0 = row0[x0], p1 = row0[x1], p2 = row1[x0], p3 = row1[x1];
+
+      // Average of the four pixels, two channels at a time in 16-bit lanes
+      quint32 rb = (p0 & 0xff00ff) + (p1 & 0xff00ff) + (p2 & 0xff00ff) +
+                   (p3 & 0xff00ff) + 0x20002;
+      quint32 ag = ((p0 >> 8) & 0xff00ff) + ((p1 >> 8) & 0xff00ff) +
+                   ((p2 >> 8) & 0xff00ff) + ((p3 >> 8) & 0xff00ff) + 0x20002;
+      dest[x] = ((rb >> 2) & 0xff00ff) | (((ag >> 2) & 0xff00ff) << 8);
+    }
+  }
+}
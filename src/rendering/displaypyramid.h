@@ -0,0 +1,52 @@
+#ifndef DISPLAYPYRAMID_H
+#define DISPLAYPYRAMID_H
+
+#include <QImage>
+#include <QRect>
+#include <QSize>
+#include <vector>
+
+class PixelBuffer;
+
+// Mip chain of the composited canvas for zoomed-out display. Level 0 is
+// the composite itself (owned by the caller); level n is a 2x2 box-filtered
+// copy at 1/2^n of its size. Levels are split into tiles that are marked
+// stale when the composite changes and only re-filtered when a view at
+// that level needs them, so painting at low zoom costs a few small tiles
+// instead of a full-size downscale per frame.
+class DisplayPyramid {
+public:
+  static constexpr int TileSize = 256;
+
+  DisplayPyramid();
+
+  // Sizes the levels for a base image of size; everything is stale
+  void reset(const QSize &size);
+  // Marks the part of every level covering rect (base coordinates) stale
+  void invalidate(const QRect &rect);
+
+  int levelCount() const { return int(m_levels.size()) + 1; }
+  // Level whose resolution is the smallest one still >= scale
+  int levelForScale(double scale) const;
+
+  // Returns level index (>= 1) with its stale tiles inside rect (level
+  // coordinates) re-filtered from base and the levels in between
+  const QImage &level(int index, const QImage &base, const QRect &rect);
+
+private:
+  struct Level {
+    QImage image;
+    int columns = 0;
+    int rows = 0;
+    std::vector<quint8> stale; // Per tile
+  };
+
+  void update(int index, const QImage &base, const QRect &rect);
+  static void downsample(const QImage &source, const PixelBuffer &target,
+                         const QRect &rect);
+
+  QSize m_size;
+  std::vector<Level> m_levels; // m_levels[0] is level 1
+};
+
+#endif // DISPLAYPYRAMID_H
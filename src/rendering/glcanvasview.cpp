@@ -0,0 +1,225 @@
+#include "glcanvasview.h"
+#include "core/canvas.h"
+
+#include <QMatrix4x4>
+#include <QOpenGLContext>
+#include <QPainter>
+#include <algorithm>
+#include <vector>
+
+// 256 MB of RGBA tiles; the least recently drawn ones go first
+static const int MaxTextures = 1024;
+
+static const char *VertexShader = R"(
+attribute highp vec2 position;
+attribute highp vec2 texCoord;
+uniform highp mat4 matrix;
+varying highp vec2 uv;
+void main() {
+  uv = texCoord;
+  gl_Position = matrix * vec4(position, 0.0, 1.0);
+}
+)";
+
+static const char *FragmentShader = R"(
+varying highp vec2 uv;
+uniform sampler2D tile;
+void main() {
+  gl_FragColor = texture2D(tile, uv);
+}
+)";
+
+GLCanvasView::GLCanvasView(Canvas *canvas)
+    : QOpenGLWidget(canvas), m_canvas(canvas), m_frame(0) {
+  // Pointer and pen events fall through to the canvas
+  setAttribute(Qt::WA_TransparentForMouseEvents);
+}
+
+GLCanvasView::~GLCanvasView() { releaseTextures(); }
+
+bool GLCanvasView::isSupported() {
+  static bool supported = [] {
+    QOpenGLContext context;
+    return context.create();
+  }();
+  return supported;
+}
+
+void GLCanvasView::invalidate(const QRect &rect) {
+  for (auto it = m_textures.begin(); it != m_textures.end(); ++it) {
+    int level = int(it.key() >> 48);
+    int tx = int((it.key() >> 24) & 0xffffff);
+    int ty = int(it.key() & 0xffffff);
+    int size = TileSize << level;
+    if (QRect(tx * size, ty * size, size, size).intersects(rect))
+      it.value().stale = true;
+  }
+}
+
+void GLCanvasView::initializeGL() {
+  initializeOpenGLFunctions();
+  connect(context(), &QOpenGLContext::aboutToBeDestroyed, this,
+          &GLCanvasView::releaseTextures);
+
+  m_program = std::make_unique<QOpenGLShaderProgram>();
+  m_program->addShaderFromSourceCode(QOpenGLShader::Vertex, VertexShader);
+  m_program->addShaderFromSourceCode(QOpenGLShader::Fragment, FragmentShader);
+  m_program->bindAttributeLocation("position", 0);
+  m_program->bindAttributeLocation("texCoord", 1);
+  m_program->link();
+}
+
+void GLCanvasView::paintGL() {
+  m_canvas->prepareFrame();
+  ++m_frame;
+
+  QPainter painter(this);
+  QTransform view = m_canvas->viewTransform();
+
+  painter.beginNativePainting();
+  glClearColor(0.5f, 0.5f, 0.5f, 1.0f); // Qt::darkGray
+  glClear(GL_COLOR_BUFFER_BIT);
+  glDisable(GL_BLEND); // The composite is opaque
+
+  // Same level choice as the raster path: the nearest pyramid level at or
+  // above the zoom, so the GPU never reduces by more than 2x
+  const QImage &base = m_canvas->m_image;
+  QRect visible = view.inverted()
+                      .mapRect(QRectF(rect()))
+                      .toAlignedRect()
+                      .intersected(base.rect());
+  if (!visible.isEmpty() && m_program->isLinked()) {
+    int level = m_canvas->m_pyramid.levelForScale(m_canvas->m_zoom);
+    int factor = 1 << level;
+    QRect area(QPoint(visible.left() / factor, visible.top() / factor),
+               QPoint(visible.right() / factor, visible.bottom() / factor));
+    const QImage &image =
+        level == 0 ? base : m_canvas->m_pyramid.level(level, base, area);
+
+    QMatrix4x4 matrix;
+    matrix.ortho(0, width(), height(), 0, -1, 1);
+    matrix *= QMatrix4x4(view);
+
+    m_program->bind();
+    m_program->setUniformValue("matrix", matrix);
+    m_program->setUniformValue("tile", 0);
+    m_program->enableAttributeArray(0);
+    m_program->enableAttributeArray(1);
+    glActiveTexture(GL_TEXTURE0);
+
+    for (int ty = area.top() / TileSize; ty <= area.bottom() / TileSize; ++ty) {
+      for (int tx = area.left() / TileSize; tx <= area.right() / TileSize;
+           ++tx)
+        drawTile(level, tx, ty, image);
+    }
+
+    m_program->disableAttributeArray(0);
+    m_program->disableAttributeArray(1);
+    m_program->release();
+  }
+
+  evictTextures();
+  painter.endNativePainting();
+
+  m_canvas->paintOverlays(painter, view);
+}
+
+void GLCanvasView::drawTile(int level, int tx, int ty, const QImage &image) {
+  QRect tileRect = QRect(tx * TileSize, ty * TileSize, TileSize, TileSize)
+                       .intersected(image.rect());
+  if (tileRect.isEmpty())
+    return;
+
+  TileTexture &texture = m_textures[tileKey(level, tx, ty)];
+  if (!texture.id) {
+    glGenTextures(1, &texture.id);
+    glBindTexture(GL_TEXTURE_2D, texture.id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, TileSize, TileSize, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, nullptr);
+    texture.stale = true;
+  } else {
+    glBindTexture(GL_TEXTURE_2D, texture.id);
+  }
+
+  // Only tiles that changed since they were last drawn are uploaded.
+  // ARGB32 is BGRA in memory, which OpenGL ES cannot take directly.
+  if (texture.stale) {
+    QImage pixels = image.copy(tileRect).convertToFormat(
+        QImage::Format_RGBA8888_Premultiplied);
+    // Tiles at the right and bottom edge of the image repeat their last
+    // column and row once, so linear filtering at the edge blends with
+    // copies of it rather than with undefined texels
+    int width = qMin(tileRect.width() + 1, int(TileSize));
+    int height = qMin(tileRect.height() + 1, int(TileSize));
+    if (width != pixels.width() || height != pixels.height()) {
+      QImage padded(width, height, pixels.format());
+      for (int y = 0; y < height; ++y) {
+        const quint32 *from = reinterpret_cast<const quint32 *>(
+            pixels.constScanLine(qMin(y, pixels.height() - 1)));
+        quint32 *to = reinterpret_cast<quint32 *>(padded.scanLine(y));
+        std::copy(from, from + pixels.width(), to);
+        if (width > pixels.width())
+          to[width - 1] = from[pixels.width() - 1];
+      }
+      pixels = padded;
+    }
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, pixels.width(), pixels.height(),
+                    GL_RGBA, GL_UNSIGNED_BYTE, pixels.constBits());
+    texture.stale = false;
+  }
+  texture.lastFrame = m_frame;
+
+  // Magnified views show pixels as squares
+  GLint filter = m_canvas->m_zoom < 1.0 ? GL_LINEAR : GL_NEAREST;
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+
+  // The quad is in canvas coordinates; the matrix maps it to the widget
+  int factor = 1 << level;
+  GLfloat left = tileRect.left() * factor;
+  GLfloat top = tileRect.top() * factor;
+  GLfloat right = (tileRect.right() + 1) * factor;
+  GLfloat bottom = (tileRect.bottom() + 1) * factor;
+  GLfloat s = GLfloat(tileRect.width()) / TileSize;
+  GLfloat t = GLfloat(tileRect.height()) / TileSize;
+  const GLfloat positions[] = {left,  top,    right, top,
+                               left,  bottom, right, bottom};
+  const GLfloat texCoords[] = {0, 0, s, 0, 0, t, s, t};
+
+  m_program->setAttributeArray(0, GL_FLOAT, positions, 2);
+  m_program->setAttributeArray(1, GL_FLOAT, texCoords, 2);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+void GLCanvasView::evictTextures() {
+  if (m_textures.size() <= MaxTextures)
+    return;
+
+  std::vector<std::pair<quint64, quint64>> unused; // (last frame, key)
+  for (auto it = m_textures.constBegin(); it != m_textures.constEnd(); ++it) {
+    if (it.value().lastFrame < m_frame)
+      unused.push_back({it.value().lastFrame, it.key()});
+  }
+  std::sort(unused.begin(), unused.end());
+
+  size_t excess = m_textures.size() - MaxTextures;
+  for (size_t i = 0; i < unused.size() && i < excess; ++i) {
+    GLuint id = m_textures.value(unused[i].second).id;
+    glDeleteTextures(1, &id);
+    m_textures.remove(unused[i].second);
+  }
+}
+
+void GLCanvasView::releaseTextures() {
+  if (m_textures.isEmpty() && !m_program)
+    return;
+
+  makeCurrent();
+  for (const TileTexture &texture : m_textures)
+    glDeleteTextures(1, &texture.id);
+  m_textures.clear();
+  m_program.reset();
+  doneCurrent();
+}
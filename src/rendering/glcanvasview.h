@@ -0,0 +1,60 @@
+#ifndef GLCANVASVIEW_H
+#define GLCANVASVIEW_H
+
+#include <QHash>
+#include <QOpenGLFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLWidget>
+#include <QRect>
+#include <memory>
+
+class Canvas;
+
+// OpenGL presentation of a Canvas. The composite (or, zoomed out, its
+// display pyramid level) is kept on the GPU as one texture per 256 px
+// tile; a frame only uploads tiles that changed since they were last
+// drawn, then draws the visible ones with the view transform. Input still
+// goes to the Canvas underneath, and its overlays are painted on top with
+// QPainter.
+class GLCanvasView : public QOpenGLWidget, protected QOpenGLFunctions {
+  Q_OBJECT
+
+public:
+  static constexpr int TileSize = 256;
+
+  explicit GLCanvasView(Canvas *canvas);
+  ~GLCanvasView();
+
+  // Whether an OpenGL context can be created at all (a software
+  // rasterizer such as llvmpipe counts)
+  static bool isSupported();
+
+  // Marks textures covering rect (canvas coordinates) for re-upload
+  void invalidate(const QRect &rect);
+
+protected:
+  void initializeGL() override;
+  void paintGL() override;
+
+private:
+  struct TileTexture {
+    GLuint id = 0;
+    bool stale = true;
+    quint64 lastFrame = 0;
+  };
+
+  static quint64 tileKey(int level, int tx, int ty) {
+    return (quint64(level) << 48) | (quint64(tx) << 24) | quint64(ty);
+  }
+
+  void drawTile(int level, int tx, int ty, const QImage &image);
+  void evictTextures();
+  void releaseTextures();
+
+  Canvas *m_canvas;
+  std::unique_ptr<QOpenGLShaderProgram> m_program;
+  QHash<quint64, TileTexture> m_textures;
+  quint64 m_frame;
+};
+
+#endif // GLCANVASVIEW_H
@@ -0,0 +1,184 @@
+#include "layerthumbnails.h"
+#include "core/layermanager.h"
+#include "rendering/compositor.h"
+#include "rendering/parallelfor.h"
+
+#include <QMetaObject>
+#include <QPainter>
+#include <QReadLocker>
+#include <algorithm>
+
+// Requests arriving within this time are served by one refresh
+static const int RefreshDelay = 250; // ms
+
+// Checkerboard behind the thumbnail, so transparent parts show
+static const int CheckerSize = 6;
+
+LayerThumbnails::LayerThumbnails(LayerManager *manager, QObject *parent)
+    : QObject(parent), m_manager(manager), m_cancelled(false),
+      m_running(false) {
+  m_pool.setMaxThreadCount(1);
+  m_timer.setSingleShot(true);
+  m_timer.setInterval(RefreshDelay);
+  connect(&m_timer, &QTimer::timeout, this, &LayerThumbnails::start);
+}
+
+LayerThumbnails::~LayerThumbnails() {
+  m_cancelled = true;
+  m_pool.waitForDone();
+}
+
+void LayerThumbnails::request(const QString &layerId) {
+  m_pending.insert(layerId);
+  // A running refresh starts the timer again once it is done
+  if (!m_running && !m_timer.isActive())
+    m_timer.start();
+}
+
+void LayerThumbnails::remove(const QString &layerId) {
+  m_pending.remove(layerId);
+  m_reductions.remove(layerId);
+}
+
+void LayerThumbnails::start() {
+  if (m_running || m_pending.isEmpty())
+    return;
+
+  // The tiles are copied copy-on-write, so painting goes on meanwhile.
+  // Only the job touches a reduction while it runs.
+  auto jobs = std::make_shared<std::vector<Job>>();
+  {
+    QReadLocker locker(m_manager->documentLock());
+    for (const QString &id : m_pending) {
+      Layer *layer = m_manager->layerById(id);
+      if (!layer)
+        continue;
+      std::shared_ptr<Reduction> &reduction = m_reductions[id];
+      if (!reduction)
+        reduction = std::make_shared<Reduction>();
+      jobs->push_back({id, layer->tiles(), reduction});
+    }
+  }
+  m_pending.clear();
+  if (jobs->empty())
+    return;
+
+  m_running = true;
+  m_pool.start([=] {
+    for (Job &job : *jobs) {
+      if (m_cancelled)
+        return;
+      QImage thumbnail = render(job.tiles, *job.reduction);
+      job.tiles = TiledImage(); // The shared tiles are not needed anymore
+      QString id = job.layerId;
+      QMetaObject::invokeMethod(
+          this, [=] { emit thumbnailReady(id, thumbnail); },
+          Qt::QueuedConnection);
+    }
+    QMetaObject::invokeMethod(
+        this,
+        [this] {
+          m_running = false;
+          if (!m_pending.isEmpty())
+            m_timer.start();
+        },
+        Qt::QueuedConnection);
+  });
+}
+
+QImage LayerThumbnails::render(const TiledImage &tiles, Reduction &reduction) {
+  QSize size = tiles.size();
+  if (size.isEmpty())
+    return QImage();
+
+  // A new or resized layer starts over. Factors stop at the tile size, so
+  // every tile maps onto whole reduced pixels of its own.
+  if (reduction.size != size) {
+    int factor = 1;
+    while (factor < TiledImage::TileSize &&
+           qMax(size.width(), size.height()) / factor > 2 * Size)
+      factor *= 2;
+    reduction.size = size;
+    reduction.factor = factor;
+    reduction.image = QImage((size.width() + factor - 1) / factor,
+                             (size.height() + factor - 1) / factor,
+                             QImage::Format_ARGB32_Premultiplied);
+    reduction.revisions.assign(
+        size_t(tiles.tileColumns()) * tiles.tileRows(), ~quint64(0));
+  }
+
+  std::vector<QPoint> changed;
+  for (int ty = 0; ty < tiles.tileRows(); ++ty) {
+    for (int tx = 0; tx < tiles.tileColumns(); ++tx) {
+      quint64 &revision =
+          reduction.revisions[size_t(ty) * tiles.tileColumns() + tx];
+      if (tiles.revision(tx, ty) != revision) {
+        revision = tiles.revision(tx, ty);
+        changed.push_back(QPoint(tx, ty));
+      }
+    }
+  }
+  PixelBuffer target(reduction.image);
+  parallelFor(int(changed.size()), [&](int i) {
+    reduceTile(tiles, changed[i].x(), changed[i].y(), reduction.factor,
+               target);
+  });
+
+  QSize fitted = size.scaled(Size, Size, Qt::KeepAspectRatio)
+                     .expandedTo(QSize(1, 1));
+  QImage thumbnail(fitted, QImage::Format_ARGB32_Premultiplied);
+  QPainter painter(&thumbnail);
+  for (int y = 0; y < fitted.height(); y += CheckerSize) {
+    for (int x = 0; x < fitted.width(); x += CheckerSize) {
+      bool dark = (x / CheckerSize + y / CheckerSize) % 2;
+      painter.fillRect(QRect(x, y, CheckerSize, CheckerSize),
+                       dark ? QColor(204, 204, 204) : QColor(Qt::white));
+    }
+  }
+  painter.setRenderHint(QPainter::SmoothPixmapTransform);
+  painter.drawImage(thumbnail.rect(), reduction.image);
+  painter.end();
+  return thumbnail;
+}
+
+void LayerThumbnails::reduceTile(const TiledImage &tiles, int tx, int ty,
+                                 int factor, const PixelBuffer &target) {
+  QRect tileRect = TiledImage::tileRect(tx, ty);
+  QRect area = tileRect.intersected(tiles.rect());
+  QRect reduced(QPoint(area.left() / factor, area.top() / factor),
+                QPoint(area.right() / factor, area.bottom() / factor));
+
+  // A paged-out tile is read without paging it back in
+  QImage tile = tiles.peekTile(tx, ty);
+  for (int y = reduced.top(); y <= reduced.bottom(); ++y) {
+    QRgb *out = target.pixels(0, y);
+    if (tile.isNull()) {
+      std::fill(out + reduced.left(), out + reduced.right() + 1, 0);
+      continue;
+    }
+
+    // Pixels off the layer do not count towards the average
+    int top = y * factor;
+    int bottom = qMin(top + factor, area.bottom() + 1);
+    for (int x = reduced.left(); x <= reduced.right(); ++x) {
+      int left = x * factor;
+      int right = qMin(left + factor, area.right() + 1);
+      quint32 red = 0, green = 0, blue = 0, alpha = 0;
+      for (int sy = top; sy < bottom; ++sy) {
+        const QRgb *row =
+            reinterpret_cast<const QRgb *>(
+                tile.constScanLine(sy - tileRect.top())) +
+            (left - tileRect.left());
+        for (int i = 0; i < right - left; ++i) {
+          red += qRed(row[i]);
+          green += qGreen(row[i]);
+          blue += qBlue(row[i]);
+          alpha += qAlpha(row[i]);
+        }
+      }
+      quint32 count = quint32(right - left) * (bottom - top);
+      out[x] = qRgba((red + count / 2) / count, (green + count / 2) / count,
+                     (blue + count / 2) / count, (alpha + count / 2) / count);
+    }
+  }
+}
@@ -0,0 +1,71 @@
+#ifndef LAYERTHUMBNAILS_H
+#define LAYERTHUMBNAILS_H
+
+#include "core/tiledimage.h"
+#include <QHash>
+#include <QImage>
+#include <QObject>
+#include <QSet>
+#include <QString>
+#include <QThreadPool>
+#include <QTimer>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+class LayerManager;
+class PixelBuffer;
+
+// Builds layer thumbnails on a background thread. Each layer keeps a
+// reduced copy of itself (a power-of-two box filter, about twice the
+// thumbnail size) along with the revision of every tile it was made from,
+// so a refresh only re-reduces the tiles that changed since. Requests are
+// gathered for a moment before a refresh starts, so painting produces a
+// few refreshes a second rather than one per dab.
+class LayerThumbnails : public QObject {
+  Q_OBJECT
+
+public:
+  static constexpr int Size = 48; // Longest side, pixels
+
+  explicit LayerThumbnails(LayerManager *manager, QObject *parent = nullptr);
+  // Cancels a running refresh and waits for it
+  ~LayerThumbnails();
+
+  // Schedules a refresh of the layer's thumbnail
+  void request(const QString &layerId);
+  // Drops what is kept for a layer that went away
+  void remove(const QString &layerId);
+
+signals:
+  void thumbnailReady(const QString &layerId, const QImage &thumbnail);
+
+private:
+  struct Reduction {
+    QSize size;      // Of the layer
+    int factor = 0;  // Each reduced pixel averages factor x factor pixels
+    QImage image;    // ARGB32_Premultiplied
+    std::vector<quint64> revisions; // Per tile, when last reduced
+  };
+
+  struct Job {
+    QString layerId;
+    TiledImage tiles; // Copy-on-write copy of the layer's pixels
+    std::shared_ptr<Reduction> reduction;
+  };
+
+  void start();
+  static QImage render(const TiledImage &tiles, Reduction &reduction);
+  static void reduceTile(const TiledImage &tiles, int tx, int ty,
+                         int factor, const PixelBuffer &target);
+
+  LayerManager *m_manager;
+  QSet<QString> m_pending;
+  QHash<QString, std::shared_ptr<Reduction>> m_reductions;
+  QTimer m_timer;
+  QThreadPool m_pool; // One thread
+  std::atomic<bool> m_cancelled;
+  bool m_running;
+};
+
+#endif // LAYERTHUMBNAILS_H
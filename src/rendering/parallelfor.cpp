@@ -0,0 +1,41 @@
+#include "parallelfor.h"
+
+#include <QSemaphore>
+#include <QThreadPool>
+#include <QtGlobal>
+#include <atomic>
+
+void parallelFor(int count, const std::function<void(int)> &fn) {
+  if (count <= 0)
+    return;
+
+  QThreadPool *pool = QThreadPool::globalInstance();
+  int helpers = qMin(count, pool->maxThreadCount()) - 1;
+  if (helpers <= 0) {
+    for (int i = 0; i < count; ++i)
+      fn(i);
+    return;
+  }
+
+  // Work is handed out one index at a time, so fast threads take over the
+  // share of slow ones
+  std::atomic<int> next(0);
+  auto work = [&]() {
+    for (int i = next.fetch_add(1); i < count; i = next.fetch_add(1))
+      fn(i);
+  };
+
+  QSemaphore finished;
+  int started = 0;
+  for (int i = 0; i < helpers; ++i) {
+    if (!pool->tryStart([&]() {
+          work();
+          finished.release();
+        }))
+      break;
+    ++started;
+  }
+
+  work();
+  finished.acquire(started);
+}
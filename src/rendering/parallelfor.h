@@ -0,0 +1,12 @@
+#ifndef PARALLELFOR_H
+#define PARALLELFOR_H
+
+#include <functional>
+
+// Calls fn(i) for every i in [0, count) on the global QThreadPool and
+// returns once all calls are done. The calling thread takes part, and
+// helpers are only started while the pool has idle threads, so nested or
+// concurrent use cannot deadlock. fn must be safe to call concurrently.
+void parallelFor(int count, const std::function<void(int)> &fn);
+
+#endif // PARALLELFOR_H
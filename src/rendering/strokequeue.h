@@ -0,0 +1,64 @@
+#ifndef STROKEQUEUE_H
+#define STROKEQUEUE_H
+
+#include "core/brush.h"
+#include "core/selectionmask.h"
+#include <QPointF>
+#include <QString>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// Everything the stroke worker needs to start a stroke
+struct StrokeSetup {
+  QString layerId;
+  Brush brush;
+  SelectionMask selection;
+};
+
+struct StrokeSample {
+  enum Type { Begin, Point, End, Quit };
+
+  Type type = Point;
+  QPointF position;
+  double pressure = 1.0;
+  std::shared_ptr<const StrokeSetup> setup; // Begin only
+};
+
+// Fixed-size single-producer/single-consumer ring buffer. The GUI thread
+// pushes and the stroke worker pops; neither side ever takes a lock.
+class StrokeQueue {
+public:
+  explicit StrokeQueue(int capacity)
+      : m_slots(capacity + 1), m_head(0), m_tail(0) {}
+
+  // Returns false (and leaves sample untouched) when the queue is full
+  bool push(StrokeSample &sample) {
+    size_t head = m_head.load(std::memory_order_relaxed);
+    size_t next = (head + 1) % m_slots.size();
+    if (next == m_tail.load(std::memory_order_acquire))
+      return false;
+
+    m_slots[head] = std::move(sample);
+    m_head.store(next, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(StrokeSample &sample) {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail == m_head.load(std::memory_order_acquire))
+      return false;
+
+    sample = std::move(m_slots[tail]);
+    m_slots[tail] = StrokeSample();
+    m_tail.store((tail + 1) % m_slots.size(), std::memory_order_release);
+    return true;
+  }
+
+private:
+  std::vector<StrokeSample> m_slots;
+  std::atomic<size_t> m_head; // Next slot to write (producer)
+  std::atomic<size_t> m_tail; // Next slot to read (consumer)
+};
+
+#endif // STROKEQUEUE_H
@@ -0,0 +1,253 @@
+#include "strokerenderer.h"
+
+#include <QtGlobal>
+#include <algorithm>
+#include <cmath>
+
+// Below this diameter dabs are positioned with quarter-pixel precision;
+// larger dabs snap to whole pixels, where the difference is invisible
+static const double SubPixelLimit = 32.0;
+// Mask cache is dropped once it holds more than this
+static const qint64 MaskCacheBudget = 64ll * 1024 * 1024;
+
+static inline int div255(int x) { return (x + (x >> 8) + 0x80) >> 8; }
+
+// Scales all four channels of a premultiplied pixel by a / 255
+static inline QRgb byteMul(QRgb x, int a) {
+  quint32 t = (x & 0xff00ff) * a;
+  t = (t + ((t >> 8) & 0xff00ff) + 0x800080) >> 8;
+  t &= 0xff00ff;
+  x = ((x >> 8) & 0xff00ff) * a;
+  x = (x + ((x >> 8) & 0xff00ff) + 0x800080);
+  x &= 0xff00ff00;
+  return x | t;
+}
+
+StrokeRenderer::StrokeRenderer()
+    : m_target(nullptr), m_color(0), m_opacity(255), m_hasLastPoint(false),
+      m_lastPressure(1.0), m_sinceLastDab(0.0), m_maskBytes(0) {}
+
+void StrokeRenderer::begin(
+    TiledImage *target, const Brush &brush, const SelectionMask &selection,
+    const std::function<void(const QRect &)> &beforeTileWrite) {
+  end();
+
+  m_target = target;
+  m_brush = brush;
+  m_selection = selection;
+  m_beforeTileWrite = beforeTileWrite;
+  m_color = qPremultiply(brush.color().rgba());
+  m_opacity = qRound(brush.opacity() * 255 / 100.0);
+  m_hasLastPoint = false;
+  m_sinceLastDab = 0.0;
+}
+
+void StrokeRenderer::end() {
+  m_target = nullptr;
+  m_beforeTileWrite = nullptr;
+  m_tiles.clear();
+}
+
+QRect StrokeRenderer::lineTo(const QPointF &point, double pressure) {
+  if (!m_target)
+    return QRect();
+
+  pressure = qBound(0.0, pressure, 1.0);
+  if (!m_hasLastPoint) {
+    m_hasLastPoint = true;
+    m_lastPoint = point;
+    m_lastPressure = pressure;
+    m_sinceLastDab = 0.0;
+    return stamp(point, pressure);
+  }
+
+  // Walk the segment and drop a dab every spacing * diameter pixels; the
+  // distance left over carries into the next segment
+  QRect dirty;
+  QPointF delta = point - m_lastPoint;
+  double length = std::hypot(delta.x(), delta.y());
+  double travelled = 0.0;
+  while (length > 0.0) {
+    double t = travelled / length;
+    double p = m_lastPressure + (pressure - m_lastPressure) * t;
+    double step = qMax(0.5, diameter(p) * m_brush.spacing() / 100.0);
+
+    double next = travelled + step - m_sinceLastDab;
+    if (next > length)
+      break;
+
+    travelled = next;
+    m_sinceLastDab = 0.0;
+    t = travelled / length;
+    dirty |= stamp(m_lastPoint + delta * t,
+                   m_lastPressure + (pressure - m_lastPressure) * t);
+  }
+  m_sinceLastDab += length - travelled;
+
+  m_lastPoint = point;
+  m_lastPressure = pressure;
+  return dirty;
+}
+
+double StrokeRenderer::diameter(double pressure) const {
+  return qMax(1.0, m_brush.size() * pressure);
+}
+
+QRect StrokeRenderer::stamp(const QPointF &center, double pressure) {
+  double d = diameter(pressure);
+
+  QPoint base;
+  QPointF phase;
+  if (d < SubPixelLimit) {
+    base = QPoint(int(std::floor(center.x())), int(std::floor(center.y())));
+    int qx = qRound((center.x() - base.x()) * 4);
+    int qy = qRound((center.y() - base.y()) * 4);
+    base += QPoint(qx / 4, qy / 4);
+    phase = QPointF((qx % 4) / 4.0, (qy % 4) / 4.0);
+  } else {
+    base = center.toPoint();
+  }
+
+  std::shared_ptr<const DabMask> mask = dabMask(d, phase);
+  QRect dabRect(base + mask->offset, QSize(mask->size, mask->size));
+  QRect area = dabRect.intersected(m_target->rect());
+  bool limited = !m_selection.isEmpty();
+  if (limited)
+    area &= m_selection.bounds();
+  if (area.isEmpty())
+    return QRect();
+
+  // Tiles outside the selection are skipped before they are snapshotted
+  QRect range = m_target->tileRange(area);
+  for (int ty = range.top(); ty <= range.bottom(); ++ty) {
+    for (int tx = range.left(); tx <= range.right(); ++tx) {
+      const QImage *selection = nullptr;
+      if (limited && !m_selection.isSolid(tx, ty)) {
+        selection = &m_selection.tile(tx, ty);
+        if (selection->isNull())
+          continue;
+      }
+      stampTile(tx, ty, TiledImage::tileRect(tx, ty).intersected(area), *mask,
+                dabRect.topLeft(), selection);
+    }
+  }
+
+  return area;
+}
+
+void StrokeRenderer::stampTile(int tx, int ty, const QRect &area,
+                               const DabMask &mask, const QPoint &maskOrigin,
+                               const QImage *selection) {
+  quint64 key = (quint64(ty) << 32) | quint32(tx);
+  auto it = m_tiles.find(key);
+  if (it == m_tiles.end()) {
+    if (m_beforeTileWrite)
+      m_beforeTileWrite(
+          TiledImage::tileRect(tx, ty).intersected(m_target->rect()));
+
+    StrokeTile strokeTile;
+    strokeTile.original = m_target->tile(tx, ty);
+    strokeTile.coverage.assign(TiledImage::TileSize * TiledImage::TileSize, 0);
+    it = m_tiles.insert(key, strokeTile);
+  }
+
+  StrokeTile &strokeTile = it.value();
+  const QImage &original = strokeTile.original;
+  bool erase = m_brush.isEraser();
+  if (erase && original.isNull())
+    return; // Nothing to erase, and no reason to allocate the tile
+
+  QImage &tile = m_target->tileForWrite(tx, ty);
+  QRect tileRect = TiledImage::tileRect(tx, ty);
+  int tileX = area.left() - tileRect.left();
+
+  for (int y = area.top(); y <= area.bottom(); ++y) {
+    int tileY = y - tileRect.top();
+    const quint8 *dab = mask.coverage.data() +
+                        (y - maskOrigin.y()) * mask.size +
+                        (area.left() - maskOrigin.x());
+    quint8 *coverage =
+        strokeTile.coverage.data() + tileY * TiledImage::TileSize + tileX;
+    const QRgb *below =
+        original.isNull()
+            ? nullptr
+            : reinterpret_cast<const QRgb *>(original.constScanLine(tileY)) +
+                  tileX;
+    QRgb *dest = reinterpret_cast<QRgb *>(tile.scanLine(tileY)) + tileX;
+    const quint8 *limit =
+        selection ? selection->constScanLine(tileY) + tileX : nullptr;
+
+    // Each pixel is recomputed from its pre-stroke value using the highest
+    // coverage any dab gave it so far
+    for (int x = 0; x < area.width(); ++x) {
+      int cover = limit ? div255(dab[x] * limit[x]) : dab[x];
+      if (cover <= coverage[x])
+        continue;
+      coverage[x] = quint8(cover);
+
+      int alpha = div255(cover * m_opacity);
+      QRgb under = below ? below[x] : 0;
+      if (erase) {
+        dest[x] = byteMul(under, 255 - alpha);
+      } else {
+        QRgb src = byteMul(m_color, alpha);
+        dest[x] = src + byteMul(under, 255 - qAlpha(src));
+      }
+    }
+  }
+}
+
+std::shared_ptr<const DabMask> StrokeRenderer::dabMask(double diameter,
+                                                       const QPointF &phase) {
+  // Diameters are quantized to quarter pixels, phases to quarters as well
+  int size = qRound(diameter * 4);
+  int px = qRound(phase.x() * 4);
+  int py = qRound(phase.y() * 4);
+  quint64 key = (quint64(size) << 16) | (quint64(m_brush.hardness()) << 4) |
+                (px << 2) | py;
+
+  auto it = m_masks.constFind(key);
+  if (it != m_masks.constEnd())
+    return it.value();
+
+  if (m_maskBytes > MaskCacheBudget) {
+    m_masks.clear();
+    m_maskBytes = 0;
+  }
+
+  auto mask = std::make_shared<const DabMask>(
+      buildMask(size / 4.0, m_brush.hardness(), QPointF(px / 4.0, py / 4.0)));
+  m_maskBytes += mask->coverage.size();
+  m_masks.insert(key, mask);
+  return mask;
+}
+
+DabMask StrokeRenderer::buildMask(double diameter, int hardness,
+                                  const QPointF &phase) {
+  double radius = diameter / 2.0;
+  int reach = int(std::ceil(radius)) + 1;
+
+  DabMask mask;
+  mask.size = 2 * reach + 1;
+  mask.offset = QPoint(-reach, -reach);
+  mask.coverage.resize(mask.size * mask.size);
+
+  // Fully opaque up to the inner radius, then a smooth falloff to the edge
+  double inner = radius * hardness / 100.0;
+  for (int j = 0; j < mask.size; ++j) {
+    for (int i = 0; i < mask.size; ++i) {
+      double dx = i - reach + 0.5 - phase.x();
+      double dy = j - reach + 0.5 - phase.y();
+      double dist = std::sqrt(dx * dx + dy * dy);
+
+      // One pixel of antialiasing at the rim
+      double value = qBound(0.0, radius - dist + 0.5, 1.0);
+      if (dist > inner && radius > inner) {
+        double t = qBound(0.0, (dist - inner) / (radius - inner), 1.0);
+        value *= 1.0 - t * t * (3.0 - 2.0 * t);
+      }
+      mask.coverage[j * mask.size + i] = quint8(qRound(value * 255));
+    }
+  }
+  return mask;
+}
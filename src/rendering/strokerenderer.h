@@ -0,0 +1,81 @@
+#ifndef STROKERENDERER_H
+#define STROKERENDERER_H
+
+#include "core/brush.h"
+#include "core/selectionmask.h"
+#include "core/tiledimage.h"
+#include <QHash>
+#include <QPointF>
+#include <QRect>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Antialiased round brush footprint: one coverage byte per pixel of a
+// size x size box whose top-left pixel is offset from the dab's integer
+// position
+struct DabMask {
+  int size;
+  QPoint offset;
+  std::vector<quint8> coverage;
+};
+
+// Rasterizes brush strokes as a series of dabs stamped along the input
+// path. Dabs are spaced at a fraction of the brush diameter, their size
+// follows pen pressure, and their masks are built once per diameter,
+// hardness and sub-pixel phase and then reused.
+//
+// Within one stroke overlapping dabs keep the highest coverage instead of
+// piling up, so the brush opacity caps the whole stroke like a single
+// painted shape. A selection scales that coverage, so soft edges fade the
+// paint out.
+class StrokeRenderer {
+public:
+  StrokeRenderer();
+
+  // beforeTileWrite is called with the affected part of each tile before
+  // the stroke first modifies it (used for undo snapshots)
+  void begin(TiledImage *target, const Brush &brush,
+             const SelectionMask &selection,
+             const std::function<void(const QRect &)> &beforeTileWrite);
+  // Extends the stroke to point; the first call stamps a single dab.
+  // Returns the canvas rect that changed.
+  QRect lineTo(const QPointF &point, double pressure);
+  void end();
+
+  bool isActive() const { return m_target != nullptr; }
+
+private:
+  struct StrokeTile {
+    QImage original; // Layer tile before the stroke; null if it was absent
+    std::vector<quint8> coverage;
+  };
+
+  QRect stamp(const QPointF &center, double pressure);
+  // selection is the tile's coverage limit; null if fully selected
+  void stampTile(int tx, int ty, const QRect &area, const DabMask &mask,
+                 const QPoint &maskOrigin, const QImage *selection);
+  double diameter(double pressure) const;
+
+  std::shared_ptr<const DabMask> dabMask(double diameter, const QPointF &phase);
+  static DabMask buildMask(double diameter, int hardness,
+                           const QPointF &phase);
+
+  TiledImage *m_target;
+  Brush m_brush;
+  SelectionMask m_selection; // Empty: no limit
+  std::function<void(const QRect &)> m_beforeTileWrite;
+  QRgb m_color;  // Premultiplied, at full strength
+  int m_opacity; // 0-255 cap for the whole stroke
+
+  bool m_hasLastPoint;
+  QPointF m_lastPoint;
+  double m_lastPressure;
+  double m_sinceLastDab; // Distance travelled since the last dab
+
+  QHash<quint64, StrokeTile> m_tiles; // Tiles touched by this stroke
+  QHash<quint64, std::shared_ptr<const DabMask>> m_masks;
+  qint64 m_maskBytes;
+};
+
+#endif // STROKERENDERER_H
@@ -0,0 +1,176 @@
+#include "strokeworker.h"
+#include "core/history.h"
+#include "core/layermanager.h"
+#include "rendering/strokerenderer.h"
+
+#include <QMetaObject>
+#include <QWriteLocker>
+
+// Room for a few seconds of 1000 Hz pen input
+static const int QueueCapacity = 8192;
+
+StrokeWorker::StrokeWorker(LayerManager *manager, QObject *parent)
+    : QThread(parent), m_manager(manager), m_queue(QueueCapacity) {
+  m_overflowTimer.setInterval(1);
+  connect(&m_overflowTimer, &QTimer::timeout, this,
+          &StrokeWorker::flushOverflow);
+}
+
+StrokeWorker::~StrokeWorker() {
+  if (isRunning()) {
+    StrokeSample quit;
+    quit.type = StrokeSample::Quit;
+    enqueue(quit);
+    while (!m_overflow.empty()) {
+      flushOverflow();
+      QThread::yieldCurrentThread();
+    }
+    wait();
+  }
+}
+
+void StrokeWorker::beginStroke(const QString &layerId, const Brush &brush,
+                               const SelectionMask &selection, const QPointF &point,
+                               double pressure) {
+  auto setup = std::make_shared<StrokeSetup>();
+  setup->layerId = layerId;
+  setup->brush = brush;
+  setup->selection = selection;
+
+  StrokeSample sample;
+  sample.type = StrokeSample::Begin;
+  sample.position = point;
+  sample.pressure = pressure;
+  sample.setup = setup;
+  enqueue(sample);
+}
+
+void StrokeWorker::addPoint(const QPointF &point, double pressure) {
+  StrokeSample sample;
+  sample.position = point;
+  sample.pressure = pressure;
+  enqueue(sample);
+}
+
+void StrokeWorker::endStroke() {
+  StrokeSample sample;
+  sample.type = StrokeSample::End;
+  enqueue(sample);
+}
+
+void StrokeWorker::enqueue(StrokeSample sample) {
+  // Keep the order: nothing new goes in while older samples wait
+  flushOverflow();
+  if (!m_overflow.empty() || !m_queue.push(sample)) {
+    m_overflow.push_back(std::move(sample));
+    m_overflowTimer.start();
+    return;
+  }
+  m_available.release();
+}
+
+void StrokeWorker::flushOverflow() {
+  size_t pushed = 0;
+  while (pushed < m_overflow.size() && m_queue.push(m_overflow[pushed]))
+    ++pushed;
+
+  m_overflow.erase(m_overflow.begin(), m_overflow.begin() + pushed);
+  if (pushed > 0)
+    m_available.release(int(pushed));
+  if (m_overflow.empty())
+    m_overflowTimer.stop();
+}
+
+void StrokeWorker::run() {
+  StrokeRenderer renderer;
+  std::unique_ptr<TileEditCommand> edit;
+  QString layerId;
+  History *history = m_manager->history();
+
+  // Hands the finished stroke (or nullptr) to the history on its thread
+  auto finishStroke = [&](Layer *layer) {
+    renderer.end();
+    TileEditCommand *command = nullptr;
+    if (edit && layer && edit->captureAfter(*layer))
+      command = edit.release();
+    edit.reset();
+    QMetaObject::invokeMethod(
+        history,
+        [history, command]() {
+          history->completeEdit(std::unique_ptr<HistoryCommand>(command));
+        },
+        Qt::QueuedConnection);
+  };
+
+  for (;;) {
+    // Take everything queued so far as one batch
+    m_available.acquire();
+    int count = 1 + m_available.available();
+    m_available.acquire(count - 1);
+
+    QRect dirty;
+    QString dirtyLayerId;
+    bool quit = false;
+    {
+      QWriteLocker locker(m_manager->documentLock());
+
+      // The layer may have been removed since the previous batch
+      Layer *layer = edit ? m_manager->layerById(layerId) : nullptr;
+      if (edit && !layer)
+        finishStroke(nullptr);
+
+      for (int i = 0; i < count; ++i) {
+        StrokeSample sample;
+        m_queue.pop(sample);
+
+        switch (sample.type) {
+        case StrokeSample::Begin: {
+          if (edit)
+            finishStroke(layer);
+
+          // Report what the previous stroke painted against its own layer
+          const StrokeSetup &setup = *sample.setup;
+          if (!dirty.isEmpty() && dirtyLayerId != setup.layerId) {
+            emit regionPainted(dirtyLayerId, dirty);
+            dirty = QRect();
+          }
+
+          layerId = setup.layerId;
+          layer = m_manager->layerById(layerId);
+          edit = std::make_unique<TileEditCommand>(layerId);
+          if (!layer)
+            break;
+
+          Layer *target = layer;
+          TileEditCommand *command = edit.get();
+          renderer.begin(&target->tiles(), setup.brush, setup.selection,
+                         [target, command](const QRect &rect) {
+                           command->captureBefore(*target, rect);
+                         });
+          dirty |= renderer.lineTo(sample.position, sample.pressure);
+          dirtyLayerId = layerId;
+          break;
+        }
+        case StrokeSample::Point:
+          if (renderer.isActive()) {
+            dirty |= renderer.lineTo(sample.position, sample.pressure);
+            dirtyLayerId = layerId;
+          }
+          break;
+        case StrokeSample::End:
+          if (edit)
+            finishStroke(layer);
+          break;
+        case StrokeSample::Quit:
+          quit = true;
+          break;
+        }
+      }
+    }
+
+    if (!dirty.isEmpty())
+      emit regionPainted(dirtyLayerId, dirty);
+    if (quit)
+      return;
+  }
+}
@@ -0,0 +1,54 @@
+#ifndef STROKEWORKER_H
+#define STROKEWORKER_H
+
+#include "rendering/strokequeue.h"
+#include <QRect>
+#include <QSemaphore>
+#include <QString>
+#include <QThread>
+#include <QTimer>
+#include <vector>
+
+class LayerManager;
+
+// Rasterizes brush strokes on a dedicated thread. The GUI thread only
+// queues input samples, so input handling never waits for dabs to be
+// drawn. The worker holds the document write lock while it stamps a batch
+// of samples and reports the painted area through regionPainted(). Each
+// finished stroke is handed to the undo history as one command.
+class StrokeWorker : public QThread {
+  Q_OBJECT
+
+public:
+  explicit StrokeWorker(LayerManager *manager, QObject *parent = nullptr);
+  ~StrokeWorker();
+
+  // GUI thread only
+  void beginStroke(const QString &layerId, const Brush &brush,
+                   const SelectionMask &selection, const QPointF &point,
+                   double pressure);
+  void addPoint(const QPointF &point, double pressure);
+  void endStroke();
+
+signals:
+  // Emitted from the worker thread after each batch
+  void regionPainted(const QString &layerId, const QRect &rect);
+
+protected:
+  void run() override;
+
+private slots:
+  void flushOverflow();
+
+private:
+  void enqueue(StrokeSample sample);
+
+  LayerManager *m_manager;
+  StrokeQueue m_queue;
+  QSemaphore m_available; // One count per queued sample
+  // Samples that did not fit into the queue; retried from the GUI thread
+  std::vector<StrokeSample> m_overflow;
+  QTimer m_overflowTimer;
+};
+
+#endif // STROKEWORKER_H
@@ -1,5 +1,8 @@
 #include "mainwindow.h"
 #include "core/canvas.h"
+#include "io/autosave.h"
+#include "io/imageexport.h"
+#include "io/imageimport.h"
 #include "ui/panels/brushpanel.h"
 #include "ui/panels/layerpanel.h"
 #include "utils/shortcuts/shortcutmanager.h"
@@ -15,10 +18,16 @@
 #include <QMenu>
 #include <QMenuBar>
 #include <QMessageBox>
+#include <QTimer>
 #include <QToolBar>
 #include <QVBoxLayout>
 
-MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) { setupUi(); }
+MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
+  setupUi();
+
+  // Once the window is up, offer what a crashed session left behind
+  QTimer::singleShot(0, this, &MainWindow::recoverAutoSave);
+}
 
 MainWindow::~MainWindow() {}
 
@@ -38,6 +47,17 @@ void MainWindow::setupUi() {
 
   setCentralWidget(centralWidget);
 
+  m_autoSave = new AutoSave(m_canvas->layerManager(), this);
+  m_autoSave->reset(QString());
+
+  m_import = new ImageImport(this);
+  connect(m_import, &ImageImport::finished, this,
+          &MainWindow::onImportFinished);
+
+  m_export = new ImageExport(this);
+  connect(m_export, &ImageExport::finished, this,
+          &MainWindow::onExportFinished);
+
   createMenus();
   createToolbars();
   createDockPanels();
@@ -73,21 +93,54 @@ void MainWindow::createMenus() {
   connect(exitAction, &QAction::triggered, this, &QWidget::close);
 
   QMenu *editMenu = menuBar->addMenu("&Edit");
+  History *history = m_canvas->layerManager()->history();
+
   QAction *undoAction = editMenu->addAction("Undo");
+  undoAction->setEnabled(history->canUndo());
+  connect(undoAction, &QAction::triggered, history, &History::undo);
+  connect(history, &History::canUndoChanged, undoAction, &QAction::setEnabled);
   shortcuts->registerAction("edit.undo", undoAction,
                             QKeySequence::Undo); // Ctrl+Z
 
   QAction *redoAction = editMenu->addAction("Redo");
+  redoAction->setEnabled(history->canRedo());
+  connect(redoAction, &QAction::triggered, history, &History::redo);
+  connect(history, &History::canRedoChanged, redoAction, &QAction::setEnabled);
   shortcuts->registerAction("edit.redo", redoAction,
                             QKeySequence::Redo); // Ctrl+Shift+Z
 
+  // Area the eyedropper averages; entry n has a radius of n pixels
+  editMenu->addSeparator();
+  QMenu *sampleMenu = editMenu->addMenu("Eyedropper Sample");
+  QActionGroup *sampleGroup = new QActionGroup(this);
+  const char *sampleSizes[] = {"Point", "3 x 3 Average", "5 x 5 Average"};
+  for (int radius = 0; radius < 3; ++radius) {
+    QAction *action = sampleMenu->addAction(sampleSizes[radius]);
+    action->setCheckable(true);
+    action->setChecked(radius == m_canvas->sampleRadius());
+    sampleGroup->addAction(action);
+    connect(action, &QAction::triggered, this,
+            [this, radius] { m_canvas->setSampleRadius(radius); });
+  }
+
   QMenu *viewMenu = menuBar->addMenu("&View");
   // Will be populated in createDockPanels() with dock toggle actions
   m_viewMenu = viewMenu;
   viewMenu->addSeparator();
-  viewMenu->addAction("Zoom In");
-  viewMenu->addAction("Zoom Out");
-  viewMenu->addAction("Fit to Screen");
+  QAction *zoomInAction = viewMenu->addAction("Zoom In");
+  connect(zoomInAction, &QAction::triggered, m_canvas, &Canvas::zoomIn);
+  shortcuts->registerAction("view.zoomIn", zoomInAction,
+                            QKeySequence::ZoomIn); // Ctrl++
+
+  QAction *zoomOutAction = viewMenu->addAction("Zoom Out");
+  connect(zoomOutAction, &QAction::triggered, m_canvas, &Canvas::zoomOut);
+  shortcuts->registerAction("view.zoomOut", zoomOutAction,
+                            QKeySequence::ZoomOut); // Ctrl+-
+
+  QAction *fitAction = viewMenu->addAction("Fit to Screen");
+  connect(fitAction, &QAction::triggered, m_canvas, &Canvas::fitToScreen);
+  shortcuts->registerAction("view.fit", fitAction,
+                            QKeySequence(Qt::CTRL | Qt::Key_0));
 
   QMenu *layerMenu = menuBar->addMenu("&Layer");
   QAction *newLayerAction = layerMenu->addAction("New Layer");
@@ -97,6 +150,30 @@ void MainWindow::createMenus() {
   layerMenu->addAction("Delete Layer");
   layerMenu->addAction("Duplicate Layer");
 
+  QMenu *selectMenu = menuBar->addMenu("&Select");
+  QAction *selectAllAction = selectMenu->addAction("All");
+  connect(selectAllAction, &QAction::triggered, this, &MainWindow::selectAll);
+  shortcuts->registerAction("select.all", selectAllAction,
+                            QKeySequence::SelectAll); // Ctrl+A
+
+  QAction *deselectAction = selectMenu->addAction("Deselect");
+  connect(deselectAction, &QAction::triggered, this, &MainWindow::deselect);
+  shortcuts->registerAction("select.none", deselectAction,
+                            QKeySequence(Qt::CTRL | Qt::Key_D));
+
+  QAction *invertAction = selectMenu->addAction("Inverse");
+  connect(invertAction, &QAction::triggered, this,
+          &MainWindow::invertSelection);
+  shortcuts->registerAction("select.invert", invertAction,
+                            QKeySequence(Qt::CTRL | Qt::SHIFT | Qt::Key_I));
+
+  selectMenu->addSeparator();
+  QAction *featherAction = selectMenu->addAction("Feather...");
+  connect(featherAction, &QAction::triggered, this,
+          &MainWindow::featherSelection);
+  shortcuts->registerAction("select.feather", featherAction,
+                            QKeySequence(Qt::SHIFT | Qt::Key_F6));
+
   QMenu *filterMenu = menuBar->addMenu("Filte&r");
   filterMenu->addAction("Blur");
   filterMenu->addAction("Sharpen");
@@ -218,9 +295,9 @@ void MainWindow::createDockPanels() {
   // Connect layer panel to get canvas size
   connect(layerPanel, &LayerPanel::requestCanvasSize, this,
           [this](int &width, int &height) {
-            QImage &img = m_canvas->layerManager()->currentLayer()->image();
-            width = img.width();
-            height = img.height();
+            Layer *layer = m_canvas->layerManager()->currentLayer();
+            width = layer->width();
+            height = layer->height();
           });
 
   addDockWidget(Qt::RightDockWidgetArea, layersDock);
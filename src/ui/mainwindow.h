@@ -2,8 +2,12 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QString>
 
+class AutoSave;
 class Canvas;
+class ImageExport;
+class ImageImport;
 
 class MainWindow : public QMainWindow {
   Q_OBJECT
@@ -20,21 +24,33 @@ private:
   void createToolbars();
   void createDockPanels();
 
+  bool saveDocument(const QString &fileName);
+  // Offers to rebuild the document from an autosave journal
+  bool recoverDocument(const QString &journal);
+
 private slots:
   void onNew();
   void onOpen();
   void onSave();
   void onSaveAs();
+  void recoverAutoSave();
+  void onImportFinished();
+  void onExportFinished(bool ok, const QString &error);
 
   // Select menu slots
   void selectAll();
   void deselect();
   void invertSelection();
+  void featherSelection();
 
 private:
   Canvas *m_canvas;
   QMenu *m_viewMenu;               // For adding dock panel toggle actions
   QActionGroup *m_toolActionGroup; // For exclusive tool selection
+  QString m_documentPath;          // .aria file Save writes to, if any
+  AutoSave *m_autoSave;
+  ImageImport *m_import; // Decodes opened images in the background
+  ImageExport *m_export; // Writes PNG, OpenRaster and PSD in the background
 };
 
 #endif // MAINWINDOW_H
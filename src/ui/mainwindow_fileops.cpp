@@ -1,53 +1,217 @@
 #include "core/canvas.h"
+#include "io/ariafile.h"
+#include "io/autosave.h"
+#include "io/imageexport.h"
+#include "io/imageimport.h"
 #include "ui/dialogs/welcomedialog.h"
 #include "mainwindow.h"
 
+#include <QApplication>
 #include <QDialog>
+#include <QFile>
 #include <QFileDialog>
+#include <QFileInfo>
 #include <QImageReader>
 #include <QImageWriter>
 #include <QInputDialog>
 #include <QMessageBox>
+#include <QProgressDialog>
 
 void MainWindow::onNew() {
   WelcomeDialog dialog(this);
   if (dialog.exec() == QDialog::Accepted) {
     m_canvas->newImage(dialog.canvasWidth(), dialog.canvasHeight(), Qt::white);
+    m_documentPath.clear();
+    m_autoSave->reset(QString());
   }
 }
 
 void MainWindow::onOpen() {
   QString fileName = QFileDialog::getOpenFileName(
-      this, "Open Image", QString(), "Images (*.png *.jpg *.jpeg *.bmp)");
+      this, "Open Image", QString(),
+      "All Supported (*.aria *.ora *.psd *.psb *.png *.jpg *.jpeg *.bmp);;"
+      "Aria Documents (*.aria);;OpenRaster (*.ora);;"
+      "Photoshop (*.psd *.psb);;Images (*.png *.jpg *.jpeg *.bmp)");
   if (fileName.isEmpty())
     return;
 
-  QImage image(fileName);
-  if (image.isNull()) {
-    QMessageBox::warning(this, "Open Image", "Failed to load image.");
+  if (QFileInfo(fileName).suffix().toLower() == "aria") {
+    QString journal = AutoSave::journalPath(fileName);
+    if (QFile::exists(journal) && recoverDocument(journal))
+      return;
+
+    AriaFile::Document document;
+    QString error;
+    if (!AriaFile::read(fileName, document, &error)) {
+      QMessageBox::warning(this, "Open Image",
+                           "Failed to open document: " + error);
+      return;
+    }
+    m_canvas->setDocument(document.size, std::move(document.layers),
+                          document.currentLayer);
+    m_documentPath = fileName;
+    m_autoSave->reset(fileName);
     return;
   }
 
-  m_canvas->newImage(image.width(), image.height());
-  if (m_canvas->layerManager()->layerCount() > 0) {
-    m_canvas->layerManager()->layerAt(0)->setImage(image);
-    m_canvas->update();
+  // Decoding runs in the background; the window-modal dialog keeps the
+  // current document from being edited meanwhile
+  auto *progress = new QProgressDialog(
+      "Opening " + QFileInfo(fileName).fileName() + "...", "Cancel", 0, 0,
+      this);
+  progress->setWindowTitle("Open Image");
+  progress->setWindowModality(Qt::WindowModal);
+  progress->setMinimumDuration(500);
+  connect(progress, &QProgressDialog::canceled, m_import,
+          &ImageImport::cancel);
+  connect(m_import, &ImageImport::progress, progress,
+          [progress](int done, int total) {
+            progress->setRange(0, total);
+            progress->setValue(done);
+          });
+  connect(m_import, &ImageImport::finished, progress, &QObject::deleteLater);
+  m_import->start(fileName);
+}
+
+void MainWindow::onImportFinished() {
+  AriaFile::Document document;
+  QString error;
+  if (!m_import->takeDocument(document, &error)) {
+    if (!error.isEmpty()) // Otherwise cancelled
+      QMessageBox::warning(this, "Open Image",
+                           "Failed to load image: " + error);
+    return;
   }
+
+  m_canvas->setDocument(document.size, std::move(document.layers),
+                        document.currentLayer);
+  m_documentPath.clear();
+  m_autoSave->reset(QString());
 }
 
 void MainWindow::onSave() {
+  if (m_documentPath.isEmpty())
+    onSaveAs();
+  else
+    saveDocument(m_documentPath);
+}
+
+void MainWindow::onSaveAs() {
   QString fileName = QFileDialog::getSaveFileName(
       this, "Save Image", QString(),
-      "PNG Images (*.png);;JPEG Images (*.jpg *.jpeg)");
+      "Aria Documents (*.aria);;OpenRaster (*.ora);;"
+      "Photoshop (*.psd *.psb);;PNG Images (*.png);;"
+      "JPEG Images (*.jpg *.jpeg)");
   if (fileName.isEmpty())
     return;
 
-  int width = m_canvas->layerManager()->layerAt(0)->image().width();
-  int height = m_canvas->layerManager()->layerAt(0)->image().height();
+  QString suffix = QFileInfo(fileName).suffix().toLower();
+  if (suffix.isEmpty()) {
+    fileName += ".aria";
+    suffix = "aria";
+  }
+  if (suffix == "aria") {
+    if (saveDocument(fileName))
+      m_documentPath = fileName;
+    return;
+  }
+
+  // OpenRaster and Photoshop files keep the layers; other formats get the
+  // flattened image. Those ImageExport handles are written band by band
+  // in the background, and painting can go on meanwhile.
+  if (ImageExport::canWrite(suffix)) {
+    if (m_export->isRunning()) {
+      QMessageBox::information(this, "Save Image",
+                               "An export is already running.");
+      return;
+    }
+    auto *progress = new QProgressDialog(
+        "Exporting " + QFileInfo(fileName).fileName() + "...", "Cancel", 0,
+        0, this);
+    progress->setWindowTitle("Save Image");
+    progress->setWindowModality(Qt::NonModal);
+    progress->setMinimumDuration(500);
+    connect(progress, &QProgressDialog::canceled, m_export,
+            &ImageExport::cancel);
+    connect(m_export, &ImageExport::progress, progress,
+            [progress](int done, int total) {
+              progress->setRange(0, total);
+              progress->setValue(done);
+            });
+    connect(m_export, &ImageExport::finished, progress,
+            &QObject::deleteLater);
+    m_export->start(fileName, *m_canvas->layerManager());
+    return;
+  }
+
+  int width = m_canvas->layerManager()->layerAt(0)->width();
+  int height = m_canvas->layerManager()->layerAt(0)->height();
   QImage composite = m_canvas->layerManager()->composite(width, height);
   if (!composite.save(fileName)) {
     QMessageBox::warning(this, "Save Image", "Failed to save image.");
   }
 }
 
-void MainWindow::onSaveAs() { onSave(); }
+void MainWindow::onExportFinished(bool ok, const QString &error) {
+  if (!ok && !error.isEmpty()) // Otherwise cancelled
+    QMessageBox::warning(this, "Save Image", "Failed to save image: " + error);
+}
+
+bool MainWindow::saveDocument(const QString &fileName) {
+  QApplication::setOverrideCursor(Qt::WaitCursor);
+  QString error;
+  quint64 revision = 0;
+  bool saved = AriaFile::write(fileName, *m_canvas->layerManager(), &error,
+                               &revision);
+  QApplication::restoreOverrideCursor();
+
+  if (!saved) {
+    QMessageBox::warning(this, "Save Image",
+                         "Failed to save document: " + error);
+    return false;
+  }
+
+  // The file now holds everything up to revision; journal only what
+  // comes after, including strokes that landed while it was written
+  m_autoSave->reset(fileName, revision);
+  return true;
+}
+
+bool MainWindow::recoverDocument(const QString &journal) {
+  QMessageBox::StandardButton answer = QMessageBox::question(
+      this, "Recover Document",
+      "Aria did not shut down properly. Recover the unsaved changes from "
+      "the autosave?");
+  if (answer != QMessageBox::Yes) {
+    AutoSave::discard(journal);
+    return false;
+  }
+
+  AriaFile::Document document;
+  QString documentPath;
+  QString error;
+  if (!AutoSave::recover(journal, document, &documentPath, &error)) {
+    QMessageBox::warning(this, "Recover Document",
+                         "Failed to recover document: " + error);
+    return false;
+  }
+
+  m_canvas->setDocument(document.size, std::move(document.layers),
+                        document.currentLayer);
+  m_documentPath = documentPath;
+  // The recovered changes are not in the document file yet, so the new
+  // journal starts with all of them. The old journal stays until that
+  // checkpoint is written, which happens right away.
+  m_autoSave->resetRecovered(documentPath, journal);
+  m_autoSave->checkpoint();
+  return true;
+}
+
+void MainWindow::recoverAutoSave() {
+  // One document is open at a time; journals not recovered now are
+  // offered again on the next start
+  for (const QString &journal : AutoSave::pendingJournals()) {
+    if (recoverDocument(journal))
+      return;
+  }
+}
@@ -1,36 +1,33 @@
 #include "core/canvas.h"
 #include "mainwindow.h"
 
+#include <QInputDialog>
+
 // Selection menu implementations
 
 void MainWindow::selectAll() {
-  if (!m_canvas)
-    return;
-
-  // Create selection of entire canvas
-  int width = m_canvas->layerManager()->composite(800, 600).width();
-  int height = m_canvas->layerManager()->composite(800, 600).height();
-
-  // Set selection to full canvas rectangle
-  QRect fullRect(0, 0, width, height);
-  // TODO: Add method to Canvas to set selection programmatically
-  // For now, this is a placeholder
+  if (m_canvas)
+    m_canvas->selectAll();
 }
 
 void MainWindow::deselect() {
-  if (!m_canvas)
-    return;
-
-  // Clear selection
-  // TODO: Add method to Canvas to clear selection
-  // For now this is a placeholder
+  if (m_canvas)
+    m_canvas->deselect();
 }
 
 void MainWindow::invertSelection() {
-  if (!m_canvas)
+  if (m_canvas)
+    m_canvas->invertSelection();
+}
+
+void MainWindow::featherSelection() {
+  if (!m_canvas || m_canvas->selection().isEmpty())
     return;
 
-  // Invert current selection
-  // TODO: Implement selection inversion
-  // For now this is a placeholder
+  bool ok = false;
+  double radius = QInputDialog::getDouble(this, "Feather Selection",
+                                          "Radius (pixels):", 5.0, 0.5,
+                                          250.0, 1, &ok);
+  if (ok)
+    m_canvas->featherSelection(radius);
 }
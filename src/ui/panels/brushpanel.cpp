@@ -105,6 +105,37 @@ void BrushPanel::setupUi() {
   hardnessLayout->addLayout(hardnessControlLayout);
   mainLayout->addWidget(hardnessGroup);
 
+  // Stabilizer
+  QGroupBox *stabilizerGroup = new QGroupBox("Stabilizer", this);
+  QVBoxLayout *stabilizerLayout = new QVBoxLayout(stabilizerGroup);
+
+  QHBoxLayout *stabilizerControlLayout = new QHBoxLayout();
+  m_stabilizerSlider = new QSlider(Qt::Horizontal, this);
+  m_stabilizerSlider->setRange(0, 100);
+  m_stabilizerSlider->setValue(0);
+
+  m_stabilizerSpinBox = new QSpinBox(this);
+  m_stabilizerSpinBox->setRange(0, 100);
+  m_stabilizerSpinBox->setValue(0);
+
+  connect(m_stabilizerSlider, &QSlider::valueChanged, m_stabilizerSpinBox,
+          &QSpinBox::setValue);
+  connect(m_stabilizerSpinBox, QOverload<int>::of(&QSpinBox::valueChanged),
+          m_stabilizerSlider, &QSlider::setValue);
+  connect(m_stabilizerSlider, &QSlider::valueChanged, this,
+          &BrushPanel::onStabilizerChanged);
+
+  stabilizerControlLayout->addWidget(m_stabilizerSlider);
+  stabilizerControlLayout->addWidget(m_stabilizerSpinBox);
+  stabilizerLayout->addLayout(stabilizerControlLayout);
+
+  m_predictionCheckBox = new QCheckBox("Predict Stroke", this);
+  m_predictionCheckBox->setChecked(true);
+  connect(m_predictionCheckBox, &QCheckBox::toggled, this,
+          &BrushPanel::onPredictionToggled);
+  stabilizerLayout->addWidget(m_predictionCheckBox);
+  mainLayout->addWidget(stabilizerGroup);
+
   mainLayout->addStretch();
 }
 
@@ -116,13 +147,13 @@ void BrushPanel::onSizeChanged(int size) {
 
 void BrushPanel::onOpacityChanged(int opacity) {
   if (m_canvas && m_canvas->brush()) {
-    m_canvas->brush()->setOpacity(opacity / 100.0);
+    m_canvas->brush()->setOpacity(opacity);
   }
 }
 
 void BrushPanel::onHardnessChanged(int hardness) {
   if (m_canvas && m_canvas->brush()) {
-    m_canvas->brush()->setHardness(hardness / 100.0);
+    m_canvas->brush()->setHardness(hardness);
   }
 }
 
@@ -131,3 +162,15 @@ void BrushPanel::onEraserToggled(bool checked) {
     m_canvas->brush()->setEraser(checked);
   }
 }
+
+void BrushPanel::onStabilizerChanged(int strength) {
+  if (m_canvas) {
+    m_canvas->setStabilizer(strength);
+  }
+}
+
+void BrushPanel::onPredictionToggled(bool checked) {
+  if (m_canvas) {
+    m_canvas->setStrokePrediction(checked);
+  }
+}
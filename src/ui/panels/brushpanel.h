@@ -21,6 +21,8 @@ private slots:
   void onOpacityChanged(int opacity);
   void onHardnessChanged(int hardness);
   void onEraserToggled(bool checked); // Added slot
+  void onStabilizerChanged(int strength);
+  void onPredictionToggled(bool checked);
 
 private:
   void setupUi();
@@ -37,6 +39,10 @@ private:
 
   QSlider *m_hardnessSlider;
   QSpinBox *m_hardnessSpinBox;
+
+  QSlider *m_stabilizerSlider;
+  QSpinBox *m_stabilizerSpinBox;
+  QCheckBox *m_predictionCheckBox;
 };
 
 #endif // BRUSHPANEL_H
@@ -1,25 +1,36 @@
 #include "layerpanel.h"
 #include "core/layer.h"
 #include "core/layermanager.h"
+#include "rendering/layerthumbnails.h"
 
 #include <QHBoxLayout>
 #include <QHeaderView>
+#include <QIcon>
 #include <QListView>
+#include <QPixmap>
 #include <QPushButton>
 #include <QStandardItemModel>
 #include <QToolButton>
 #include <QVBoxLayout>
 
 LayerPanel::LayerPanel(LayerManager *manager, QWidget *parent)
-    : QWidget(parent), m_manager(manager) {
+    : QWidget(parent), m_manager(manager),
+      m_thumbnails(new LayerThumbnails(manager, this)), m_syncing(false) {
   setupUi();
 
   connect(m_manager, &LayerManager::layerAdded, this,
-          &LayerPanel::refreshLayerList);
+          &LayerPanel::onLayerAdded);
   connect(m_manager, &LayerManager::layerRemoved, this,
-          &LayerPanel::refreshLayerList);
+          &LayerPanel::onLayerRemoved);
   connect(m_manager, &LayerManager::layerMoved, this,
-          &LayerPanel::refreshLayerList);
+          &LayerPanel::onLayerMoved);
+  connect(m_manager, &LayerManager::layerContentChanged, this,
+          [this](int index) {
+            if (Layer *layer = m_manager->layerAt(index))
+              m_thumbnails->request(layer->id());
+          });
+  connect(m_thumbnails, &LayerThumbnails::thumbnailReady, this,
+          &LayerPanel::onThumbnailReady);
   connect(m_manager, &LayerManager::currentLayerChanged, this,
           [this](int index) {
             m_layerListView->setCurrentIndex(
@@ -59,6 +70,8 @@ void LayerPanel::setupUi() {
 
   // Layer List
   m_layerListView = new QListView(this);
+  m_layerListView->setIconSize(
+      QSize(LayerThumbnails::Size, LayerThumbnails::Size));
   m_layerModel = new QStandardItemModel(this);
   m_layerListView->setModel(m_layerModel);
 
@@ -88,7 +101,7 @@ void LayerPanel::onDuplicateLayer() {
 
 void LayerPanel::onLayerSelectionChanged(const QModelIndex &current,
                                          const QModelIndex &previous) {
-  if (!current.isValid())
+  if (!current.isValid() || m_syncing)
     return;
 
   // Map list index (top-down) to layer index (bottom-up)
@@ -100,21 +113,62 @@ void LayerPanel::refreshLayerList() {
   m_layerModel->clear();
 
   // List layers from top to bottom
-  for (int i = m_manager->layerCount() - 1; i >= 0; --i) {
-    Layer *layer = m_manager->layerAt(i);
-    if (!layer)
-      continue;
-
-    QStandardItem *item = new QStandardItem(layer->name());
-    item->setCheckable(true);
-    item->setCheckState(layer->isVisible() ? Qt::Checked : Qt::Unchecked);
-
-    // TODO: Add thumbnail
-
-    m_layerModel->appendRow(item);
-  }
+  for (int i = m_manager->layerCount() - 1; i >= 0; --i)
+    m_layerModel->appendRow(createItem(i));
 
   // Restore selection
   int currentRow = m_manager->layerCount() - 1 - m_manager->currentLayerIndex();
   m_layerListView->setCurrentIndex(m_layerModel->index(currentRow, 0));
 }
+
+QStandardItem *LayerPanel::createItem(int index) {
+  Layer *layer = m_manager->layerAt(index);
+  QStandardItem *item = new QStandardItem(layer->name());
+  item->setData(layer->id(), Qt::UserRole);
+  item->setCheckable(true);
+  item->setCheckState(layer->isVisible() ? Qt::Checked : Qt::Unchecked);
+  m_thumbnails->request(layer->id());
+  return item;
+}
+
+int LayerPanel::rowForLayer(int index) const {
+  return m_manager->layerCount() - 1 - index;
+}
+
+// The stack already changed when these run. The manager follows each
+// change with currentLayerChanged, so the current row moving meanwhile
+// must not pick a layer from the half-updated list.
+
+void LayerPanel::onLayerAdded(int index) {
+  m_syncing = true;
+  m_layerModel->insertRow(rowForLayer(index), createItem(index));
+  m_syncing = false;
+}
+
+void LayerPanel::onLayerRemoved(int index) {
+  // One row more than layers is left, so the removed layer sat one lower
+  int row = rowForLayer(index) + 1;
+  if (QStandardItem *item = m_layerModel->item(row))
+    m_thumbnails->remove(item->data(Qt::UserRole).toString());
+  m_syncing = true;
+  m_layerModel->removeRow(row);
+  m_syncing = false;
+}
+
+void LayerPanel::onLayerMoved(int from, int to) {
+  m_syncing = true;
+  QList<QStandardItem *> row = m_layerModel->takeRow(rowForLayer(from));
+  m_layerModel->insertRow(rowForLayer(to), row);
+  m_syncing = false;
+}
+
+void LayerPanel::onThumbnailReady(const QString &layerId,
+                                  const QImage &thumbnail) {
+  for (int row = 0; row < m_layerModel->rowCount(); ++row) {
+    QStandardItem *item = m_layerModel->item(row);
+    if (item->data(Qt::UserRole).toString() == layerId) {
+      item->setIcon(QIcon(QPixmap::fromImage(thumbnail)));
+      return;
+    }
+  }
+}
@@ -1,11 +1,13 @@
 #ifndef LAYERPANEL_H
 #define LAYERPANEL_H
 
+#include <QImage>
 #include <QListView>
 #include <QStandardItemModel>
 #include <QWidget>
 
 class LayerManager;
+class LayerThumbnails;
 
 class LayerPanel : public QWidget {
   Q_OBJECT
@@ -24,13 +26,23 @@ private slots:
   void onLayerSelectionChanged(const QModelIndex &current,
                                const QModelIndex &previous);
   void refreshLayerList();
+  // The model follows the layer stack row by row; rows are listed top
+  // layer first
+  void onLayerAdded(int index);
+  void onLayerRemoved(int index);
+  void onLayerMoved(int from, int to);
+  void onThumbnailReady(const QString &layerId, const QImage &thumbnail);
 
 private:
   void setupUi();
+  QStandardItem *createItem(int index);
+  int rowForLayer(int index) const;
 
   LayerManager *m_manager;
   QListView *m_layerListView;
   QStandardItemModel *m_layerModel;
+  LayerThumbnails *m_thumbnails;
+  bool m_syncing; // The model is being changed to follow the stack
 };
 
 #endif // LAYERPANEL_H
@@ -0,0 +1,150 @@
+#include "lz4block.h"
+
+#include <cstring>
+
+static const int HashBits = 12;
+static const int MinMatch = 4;
+static const int MaxOffset = 65535;
+// The format requires the last match to start at least 12 bytes before
+// the end of the block and the last 5 bytes to be literals
+static const int MatchLimit = 12;
+static const int LastLiterals = 5;
+
+static inline quint32 read32(const uchar *p) {
+  quint32 value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static inline int hash(quint32 sequence) {
+  return int((sequence * 2654435761u) >> (32 - HashBits));
+}
+
+// Writes the 255-run extension of a length whose nibble saturated at 15
+static inline uchar *writeLength(uchar *op, int length) {
+  for (length -= 15; length >= 255; length -= 255)
+    *op++ = 255;
+  *op++ = uchar(length);
+  return op;
+}
+
+int lz4Compress(const char *source, int size, char *dest, int capacity) {
+  const uchar *src = reinterpret_cast<const uchar *>(source);
+  uchar *op = reinterpret_cast<uchar *>(dest);
+  uchar *const end = op + capacity;
+
+  int table[1 << HashBits];
+  std::memset(table, 0xff, sizeof(table)); // -1: no earlier position
+
+  int ip = 0;
+  int anchor = 0;
+  auto writeSequence = [&](int literals, int offset,
+                           int matchLength) -> bool {
+    // Token, length extensions, literals and offset
+    if (end - op < 1 + literals + literals / 255 + 1 + 2 +
+                       matchLength / 255 + 1)
+      return false;
+
+    uchar *token = op++;
+    *token = uchar(qMin(literals, 15) << 4);
+    if (literals >= 15)
+      op = writeLength(op, literals);
+    std::memcpy(op, src + anchor, literals);
+    op += literals;
+
+    if (matchLength > 0) {
+      *op++ = uchar(offset);
+      *op++ = uchar(offset >> 8);
+      int length = matchLength - MinMatch;
+      *token |= uchar(qMin(length, 15));
+      if (length >= 15)
+        op = writeLength(op, length);
+    }
+    return true;
+  };
+
+  while (ip < size - MatchLimit) {
+    quint32 sequence = read32(src + ip);
+    int h = hash(sequence);
+    int candidate = table[h];
+    table[h] = ip;
+
+    if (candidate < 0 || ip - candidate > MaxOffset ||
+        read32(src + candidate) != sequence) {
+      ++ip;
+      continue;
+    }
+
+    int length = MinMatch;
+    while (ip + length < size - LastLiterals &&
+           src[candidate + length] == src[ip + length])
+      ++length;
+
+    if (!writeSequence(ip - anchor, ip - candidate, length))
+      return 0;
+    ip += length;
+    anchor = ip;
+  }
+
+  if (!writeSequence(size - anchor, 0, 0))
+    return 0;
+  return int(op - reinterpret_cast<uchar *>(dest));
+}
+
+bool lz4Decompress(const char *source, int sourceSize, char *dest, int size) {
+  const uchar *ip = reinterpret_cast<const uchar *>(source);
+  const uchar *const inEnd = ip + sourceSize;
+  uchar *op = reinterpret_cast<uchar *>(dest);
+  uchar *const start = op;
+  uchar *const outEnd = op + size;
+
+  auto readLength = [&](int length) -> int {
+    if (length != 15)
+      return length;
+    uchar byte;
+    do {
+      if (ip >= inEnd)
+        return -1;
+      byte = *ip++;
+      length += byte;
+    } while (byte == 255);
+    return length;
+  };
+
+  while (ip < inEnd) {
+    uchar token = *ip++;
+
+    int literals = readLength(token >> 4);
+    if (literals < 0 || literals > inEnd - ip || literals > outEnd - op)
+      return false;
+    std::memcpy(op, ip, literals);
+    ip += literals;
+    op += literals;
+
+    // The last sequence has no match part
+    if (ip == inEnd)
+      break;
+
+    if (inEnd - ip < 2)
+      return false;
+    int offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > op - start)
+      return false;
+
+    int length = readLength(token & 15);
+    if (length < 0)
+      return false;
+    length += MinMatch;
+    if (length > outEnd - op)
+      return false;
+
+    // Matches may overlap their own output (runs), so copy forwards
+    const uchar *match = op - offset;
+    for (int i = 0; i < length; ++i)
+      op[i] = match[i];
+    op += length;
+  }
+
+  return op == outEnd;
+}
@@ -0,0 +1,19 @@
+#ifndef LZ4BLOCK_H
+#define LZ4BLOCK_H
+
+#include <QtGlobal>
+
+// Minimal codec for the LZ4 block format: greedy single-probe matching,
+// which trades ratio for speed. Tiles of flat colour or transparency
+// compress to a few hundred bytes at memcpy-like speed, which is what
+// paging and saving tiles needs; zlib is kept for where size matters more.
+
+// Compresses size bytes of source into dest. Returns the compressed size,
+// or 0 if the result would not fit in capacity bytes.
+int lz4Compress(const char *source, int size, char *dest, int capacity);
+
+// Decompresses a block into exactly size bytes of dest. Returns false for
+// corrupt input or a size mismatch.
+bool lz4Decompress(const char *source, int sourceSize, char *dest, int size);
+
+#endif // LZ4BLOCK_H
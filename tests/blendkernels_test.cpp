@@ -0,0 +1,239 @@
+#include "core/layer.h"
+#include "rendering/blendkernels.h"
+
+#include <QImage>
+#include <QPainter>
+#include <QRandomGenerator>
+#include <QString>
+#include <QTest>
+#include <cstring>
+#include <vector>
+
+// Checks every compiled kernel set the CPU supports against QPainter and
+// against the scalar reference, on random premultiplied rows whose lengths
+// leave tails after the 4 and 8 pixel vector loops.
+
+static const int RowLengths[] = {1, 3, 4, 7, 8, 9, 15, 17, 33, 257};
+static const double Opacities[] = {1.0, 0.75, 0.5, 0.25, 0.01, 0.0};
+static const Layer::BlendMode Modes[] = {Layer::Normal, Layer::Multiply,
+                                         Layer::Screen, Layer::Overlay};
+
+static const char *modeName(Layer::BlendMode mode) {
+  switch (mode) {
+  case Layer::Multiply:
+    return "multiply";
+  case Layer::Screen:
+    return "screen";
+  case Layer::Overlay:
+    return "overlay";
+  default:
+    return "normal";
+  }
+}
+
+static QPainter::CompositionMode compositionMode(Layer::BlendMode mode) {
+  switch (mode) {
+  case Layer::Multiply:
+    return QPainter::CompositionMode_Multiply;
+  case Layer::Screen:
+    return QPainter::CompositionMode_Screen;
+  case Layer::Overlay:
+    return QPainter::CompositionMode_Overlay;
+  default:
+    return QPainter::CompositionMode_SourceOver;
+  }
+}
+
+static BlendRowFunc rowFunc(const BlendKernels &k, Layer::BlendMode mode) {
+  switch (mode) {
+  case Layer::Multiply:
+    return k.multiply;
+  case Layer::Screen:
+    return k.screen;
+  case Layer::Overlay:
+    return k.overlay;
+  default:
+    return k.sourceOver;
+  }
+}
+
+static const BlendKernels *kernelSet(const QByteArray &name) {
+  for (const BlendKernels *k : availableBlendKernels()) {
+    if (name == k->name)
+      return k;
+  }
+  return nullptr;
+}
+
+// Premultiplied pixels with fully transparent and opaque ones mixed in
+static std::vector<QRgb> randomRow(QRandomGenerator &random, int count) {
+  std::vector<QRgb> row(count);
+  for (QRgb &pixel : row) {
+    int a;
+    switch (random.bounded(4)) {
+    case 0:
+      a = 0;
+      break;
+    case 1:
+      a = 255;
+      break;
+    default:
+      a = random.bounded(256);
+      break;
+    }
+    pixel = qRgba(random.bounded(a + 1), random.bounded(a + 1),
+                  random.bounded(a + 1), a);
+  }
+  return row;
+}
+
+static std::vector<QRgb> painterBlend(const std::vector<QRgb> &dest,
+                                      const std::vector<QRgb> &src,
+                                      Layer::BlendMode mode, double opacity) {
+  int count = int(dest.size());
+  QImage target(count, 1, QImage::Format_ARGB32_Premultiplied);
+  QImage source(count, 1, QImage::Format_ARGB32_Premultiplied);
+  std::memcpy(target.scanLine(0), dest.data(), count * sizeof(QRgb));
+  std::memcpy(source.scanLine(0), src.data(), count * sizeof(QRgb));
+
+  QPainter painter(&target);
+  painter.setCompositionMode(compositionMode(mode));
+  painter.setOpacity(opacity);
+  painter.drawImage(0, 0, source);
+  painter.end();
+
+  const QRgb *row = reinterpret_cast<const QRgb *>(target.constScanLine(0));
+  return std::vector<QRgb>(row, row + count);
+}
+
+// Empty when the rows agree, otherwise the first differing pixel
+static QString difference(const std::vector<QRgb> &actual,
+                          const std::vector<QRgb> &expected) {
+  for (size_t i = 0; i < actual.size(); ++i) {
+    if (actual[i] != expected[i]) {
+      return QStringLiteral("pixel %1 of %2: %3, expected %4")
+          .arg(i)
+          .arg(actual.size())
+          .arg(actual[i], 8, 16, QLatin1Char('0'))
+          .arg(expected[i], 8, 16, QLatin1Char('0'));
+    }
+  }
+  return QString();
+}
+
+class BlendKernelsTest : public QObject {
+  Q_OBJECT
+
+private slots:
+  void matchesQPainter_data();
+  void matchesQPainter();
+  void matchesScalar_data();
+  void matchesScalar();
+  void clipToAlphaMatchesScalar_data();
+  void clipToAlphaMatchesScalar();
+};
+
+static void addKernelRows(bool vectorOnly) {
+  QTest::addColumn<QByteArray>("kernels");
+  QTest::addColumn<int>("mode");
+  for (const BlendKernels *k : availableBlendKernels()) {
+    if (vectorOnly && k == scalarBlendKernels())
+      continue;
+    for (Layer::BlendMode mode : Modes)
+      QTest::addRow("%s/%s", k->name, modeName(mode))
+          << QByteArray(k->name) << int(mode);
+  }
+}
+
+void BlendKernelsTest::matchesQPainter_data() { addKernelRows(false); }
+
+void BlendKernelsTest::matchesQPainter() {
+  QFETCH(QByteArray, kernels);
+  QFETCH(int, mode);
+  const BlendKernels *k = kernelSet(kernels);
+  QVERIFY(k);
+  BlendRowFunc blend = rowFunc(*k, Layer::BlendMode(mode));
+
+  QRandomGenerator random(1);
+  for (double opacity : Opacities) {
+    for (int count : RowLengths) {
+      std::vector<QRgb> dest = randomRow(random, count);
+      std::vector<QRgb> src = randomRow(random, count);
+      std::vector<QRgb> expected =
+          painterBlend(dest, src, Layer::BlendMode(mode), opacity);
+
+      blend(dest.data(), src.data(), count, blendConstAlpha(opacity));
+      QString diff = difference(dest, expected);
+      QVERIFY2(diff.isEmpty(),
+               qPrintable(QStringLiteral("opacity %1, %2")
+                              .arg(opacity)
+                              .arg(diff)));
+    }
+  }
+}
+
+void BlendKernelsTest::matchesScalar_data() {
+  if (availableBlendKernels().size() == 1)
+    QSKIP("No vector kernels for this CPU");
+  addKernelRows(true);
+}
+
+void BlendKernelsTest::matchesScalar() {
+  QFETCH(QByteArray, kernels);
+  QFETCH(int, mode);
+  const BlendKernels *k = kernelSet(kernels);
+  QVERIFY(k);
+  BlendRowFunc blend = rowFunc(*k, Layer::BlendMode(mode));
+  BlendRowFunc reference =
+      rowFunc(*scalarBlendKernels(), Layer::BlendMode(mode));
+
+  QRandomGenerator random(2);
+  for (double opacity : Opacities) {
+    int alpha = blendConstAlpha(opacity);
+    for (int count : RowLengths) {
+      std::vector<QRgb> dest = randomRow(random, count);
+      std::vector<QRgb> src = randomRow(random, count);
+      std::vector<QRgb> expected = dest;
+
+      reference(expected.data(), src.data(), count, alpha);
+      blend(dest.data(), src.data(), count, alpha);
+      QString diff = difference(dest, expected);
+      QVERIFY2(diff.isEmpty(),
+               qPrintable(QStringLiteral("opacity %1, %2")
+                              .arg(opacity)
+                              .arg(diff)));
+    }
+  }
+}
+
+void BlendKernelsTest::clipToAlphaMatchesScalar_data() {
+  if (availableBlendKernels().size() == 1)
+    QSKIP("No vector kernels for this CPU");
+  QTest::addColumn<QByteArray>("kernels");
+  for (const BlendKernels *k : availableBlendKernels()) {
+    if (k != scalarBlendKernels())
+      QTest::addRow("%s", k->name) << QByteArray(k->name);
+  }
+}
+
+void BlendKernelsTest::clipToAlphaMatchesScalar() {
+  QFETCH(QByteArray, kernels);
+  const BlendKernels *k = kernelSet(kernels);
+  QVERIFY(k);
+
+  QRandomGenerator random(3);
+  for (int count : RowLengths) {
+    std::vector<QRgb> src = randomRow(random, count);
+    std::vector<QRgb> mask = randomRow(random, count);
+    std::vector<QRgb> actual(count), expected(count);
+
+    scalarBlendKernels()->clipToAlpha(expected.data(), src.data(),
+                                      mask.data(), count);
+    k->clipToAlpha(actual.data(), src.data(), mask.data(), count);
+    QString diff = difference(actual, expected);
+    QVERIFY2(diff.isEmpty(), qPrintable(diff));
+  }
+}
+
+QTEST_GUILESS_MAIN(BlendKernelsTest)
+#include "blendkernels_test.moc"